@@ -0,0 +1,160 @@
+#include "bench.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "platform.h"
+#include "window.h"
+
+#define BENCH_WARMUP_FRAMES 5
+
+typedef struct {
+  int cols, rows;
+} GridSize;
+
+static const GridSize grid_sizes[] = {{80, 24}, {120, 40}, {192, 108}};
+
+typedef struct {
+  const char* name;
+  void (*setup)(const BenchHooks* hooks, int cols, int rows);
+  void (*frame)(const BenchHooks* hooks, int cols, int rows, int n);  // output before frame n, or NULL
+} Scene;
+
+static Buffer out;
+static uint32_t seed;
+
+static uint32_t next_random(void) {
+  seed = seed * 1664525u + 1013904223u;
+  return seed >> 8;
+}
+
+static char ascii_at(int x, int y) { return (char)('!' + (x * 7 + y * 13) % 94); }
+
+// Rows of exactly cols characters wrap by themselves. The last cell stays
+// blank so the screen doesn't scroll.
+static bool last_cell(int x, int y, int cols, int rows) { return x == cols - 1 && y == rows - 1; }
+
+static void fill_ascii(const BenchHooks* hooks, int cols, int rows) {
+  buffer_clear(&out);
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols && !last_cell(x, y, cols, rows); x++) buffer_putc(&out, ascii_at(x, y));
+  }
+  hooks->feed(out.data, out.len);
+}
+
+static void setup_empty(const BenchHooks* hooks, int cols, int rows) {
+  (void)hooks;
+  (void)cols;
+  (void)rows;
+}
+
+// Every cell its own foreground, background and weight
+static void setup_sgr(const BenchHooks* hooks, int cols, int rows) {
+  static const int fg_base[] = {30, 90};
+  static const int bg_base[] = {40, 100};
+  char sgr[32];
+
+  seed = 1;
+  buffer_clear(&out);
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols && !last_cell(x, y, cols, rows); x++) {
+      uint32_t r = next_random();
+      int n = snprintf(sgr, sizeof(sgr), "\x1b[0;%s%d;%dm", (r & 1) ? "1;" : "", fg_base[(r >> 1) & 1] + (r >> 2) % 8,
+                       bg_base[(r >> 5) & 1] + (r >> 6) % 8);
+      buffer_append(&out, sgr, n);
+      buffer_putc(&out, ascii_at(x, y));
+    }
+  }
+  buffer_append(&out, "\x1b[0m", 4);
+  hooks->feed(out.data, out.len);
+}
+
+static void setup_selection(const BenchHooks* hooks, int cols, int rows) {
+  fill_ascii(hooks, cols, rows);
+  hooks->select_all(true);
+}
+
+// An eighth of the screen scrolls in before every frame
+static void scroll_frame(const BenchHooks* hooks, int cols, int rows, int n) {
+  int lines = rows / 8 > 0 ? rows / 8 : 1;
+  buffer_clear(&out);
+  for (int i = 0; i < lines; i++) {
+    buffer_append(&out, "\r\n", 2);
+    for (int x = 0; x < cols - 1; x++) buffer_putc(&out, ascii_at(x, n * lines + i));
+  }
+  hooks->feed(out.data, out.len);
+}
+
+static const Scene scenes[] = {
+    {"empty", setup_empty, NULL},
+    {"ascii", fill_ascii, NULL},
+    {"sgr-soup", setup_sgr, NULL},
+    {"selection", setup_selection, NULL},
+    {"scroll-churn", fill_ascii, scroll_frame},
+};
+
+// CPU time of this thread only, a threaded driver's own workers are in GPU time
+static double thread_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double wall_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+bool bench_run(const BenchHooks* hooks, int frames) {
+  if (frames < 1) frames = BENCH_DEFAULT_FRAMES;
+
+  printf("renderer: %s, %d frames per run\n", (const char*)glGetString(GL_RENDERER), frames);
+  printf("%-14s %-9s %10s %10s %10s %8s\n", "scene", "grid", "cpu ms/f", "gpu ms/f", "wall ms/f", "draws/f");
+
+  for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+    const Scene* scene = &scenes[s];
+    for (size_t g = 0; g < sizeof(grid_sizes) / sizeof(grid_sizes[0]); g++) {
+      int cols = grid_sizes[g].cols, rows = grid_sizes[g].rows;
+      if (!hooks->reset(cols, rows)) {
+        fprintf(stderr, "bench: could not size the target for %dx%d\n", cols, rows);
+        return false;
+      }
+      scene->setup(hooks, cols, rows);
+      window_take_draw_calls();
+
+      double cpu = 0.0, gpu = 0.0, wall = 0.0;
+      long draws = 0;
+      for (int n = -BENCH_WARMUP_FRAMES; n < frames; n++) {
+        double cpu_start = thread_ms();
+        double wall_start = wall_ms();
+        window_gpu_timer_begin();
+        if (scene->frame) scene->frame(hooks, cols, rows, n + BENCH_WARMUP_FRAMES);
+        hooks->render();
+        window_swap();
+        double cpu_end = thread_ms();
+        double gpu_frame = window_gpu_timer_end();  // returns once the frame has executed
+        double wall_end = wall_ms();
+        int draws_frame = window_take_draw_calls();
+        if (n < 0) continue;
+
+        cpu += cpu_end - cpu_start;
+        gpu += gpu_frame;
+        wall += wall_end - wall_start;
+        draws += draws_frame;
+      }
+
+      char grid[16];
+      snprintf(grid, sizeof(grid), "%dx%d", cols, rows);
+      printf("%-14s %-9s %10.3f %10.3f %10.3f %8ld\n", scene->name, grid, cpu / frames, gpu / frames, wall / frames,
+             draws / frames);
+      fflush(stdout);
+    }
+  }
+
+  hooks->select_all(false);
+  buffer_free(&out);
+  return true;
+}
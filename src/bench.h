@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BENCH_DEFAULT_FRAMES 120
+
+// What the benchmark drives, supplied by the terminal
+typedef struct {
+  bool (*reset)(int cols, int rows);           // blank grid, window sized to fit it
+  void (*feed)(const char* data, size_t len);  // parsed as if read from the PTY
+  void (*select_all)(bool on);
+  void (*render)(void);  // one frame into the back buffer
+} BenchHooks;
+
+// Renders synthetic screens at several grid sizes on the headless backend and
+// prints CPU time, GPU time and draw calls per frame to stdout
+bool bench_run(const BenchHooks* hooks, int frames);
+
+#endif
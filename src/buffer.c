@@ -0,0 +1,68 @@
+#include "buffer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool buffer_reserve(Buffer* b, size_t extra) {
+  if (b->cap - b->len >= extra) return true;
+
+  size_t need = b->len + extra;
+  size_t cap = b->cap ? b->cap : 4096;
+  while (cap < need) cap *= 2;
+
+  char* data = realloc(b->data, cap);
+  if (!data) return false;
+
+  b->data = data;
+  b->cap = cap;
+  return true;
+}
+
+bool buffer_append(Buffer* b, const void* data, size_t n) {
+  if (!buffer_reserve(b, n)) return false;
+  memcpy(b->data + b->len, data, n);
+  b->len += n;
+  return true;
+}
+
+bool buffer_putc(Buffer* b, char c) {
+  if (!buffer_reserve(b, 1)) return false;
+  b->data[b->len++] = c;
+  return true;
+}
+
+static int base64_value(unsigned char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+bool buffer_append_base64(Buffer* out, const char* s, size_t len) {
+  if (!buffer_reserve(out, len / 4 * 3 + 3)) return false;
+
+  uint32_t acc = 0;
+  int bits = 0;
+  for (size_t i = 0; i < len && s[i] != '='; i++) {
+    int v = base64_value((unsigned char)s[i]);
+    if (v < 0) return false;
+    acc = (acc << 6) | v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out->data[out->len++] = (char)(acc >> bits);
+    }
+  }
+  return true;
+}
+
+void buffer_clear(Buffer* b) { b->len = 0; }
+
+void buffer_free(Buffer* b) {
+  free(b->data);
+  b->data = NULL;
+  b->len = b->cap = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Growable byte buffer. Capacity grows geometrically so appending N bytes is
+// amortized O(N); large buffers are realloc'd in place by mremap on glibc.
+typedef struct {
+  char* data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+bool buffer_reserve(Buffer* b, size_t extra);
+bool buffer_append(Buffer* b, const void* data, size_t n);
+bool buffer_putc(Buffer* b, char c);
+bool buffer_append_base64(Buffer* b, const char* s, size_t len);  // decodes s, false on a bad character
+void buffer_clear(Buffer* b);
+void buffer_free(Buffer* b);
+
+#endif
@@ -0,0 +1,54 @@
+#include "cells.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void cells_fill(uint32_t* dst, uint32_t value, size_t n) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  __m128i v = _mm_set1_epi32((int)value);
+  for (; i + 16 <= n; i += 16) {
+    _mm_storeu_si128((__m128i*)(dst + i), v);
+    _mm_storeu_si128((__m128i*)(dst + i + 4), v);
+    _mm_storeu_si128((__m128i*)(dst + i + 8), v);
+    _mm_storeu_si128((__m128i*)(dst + i + 12), v);
+  }
+  for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(dst + i), v);
+#elif defined(__ARM_NEON)
+  uint32x4_t v = vdupq_n_u32(value);
+  for (; i + 16 <= n; i += 16) {
+    vst1q_u32(dst + i, v);
+    vst1q_u32(dst + i + 4, v);
+    vst1q_u32(dst + i + 8, v);
+    vst1q_u32(dst + i + 12, v);
+  }
+  for (; i + 4 <= n; i += 4) vst1q_u32(dst + i, v);
+#endif
+
+  for (; i < n; i++) dst[i] = value;
+}
+
+size_t cells_find_nonzero(const uint32_t* v, size_t from, size_t n) {
+  size_t i = from;
+
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(v + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(v + i + 4));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_or_si128(a, b), zero)) != 0xFFFF) break;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  for (; i + 8 <= n; i += 8) {
+    if (vmaxvq_u32(vorrq_u32(vld1q_u32(v + i), vld1q_u32(v + i + 4)))) break;
+  }
+#endif
+
+  // the block with the hit, or the tail
+  while (i < n && !v[i]) i++;
+  return i;
+}
@@ -0,0 +1,12 @@
+#ifndef CELLS_H
+#define CELLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernels over one of a row's cell arrays. Vector code where available,
+// otherwise scalar loops with the same results.
+void cells_fill(uint32_t* dst, uint32_t value, size_t n);
+size_t cells_find_nonzero(const uint32_t* v, size_t from, size_t n);  // n when the rest are 0
+
+#endif
@@ -0,0 +1,312 @@
+#include "fonts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "platform.h"
+
+#define FONTS_MAX 16
+#define CACHE_MAGIC "ZFNT"
+#define CACHE_VERSION 1
+
+typedef struct {
+  uint32_t first, last;
+} Range;
+
+typedef struct {
+  char* path;
+  int64_t size, mtime_sec, mtime_nsec;  // what the cached coverage was read from
+  FT_Face face;                         // opened when a codepoint first needs it
+  bool failed;                          // FreeType can't use it
+  Range* ranges;                        // ascending, never adjacent
+  uint32_t range_count;
+} Font;
+
+// Cache file, native byte order: CacheHeader, then per font a CacheEntry,
+// its path padded with zeros to a multiple of 8, and its ranges
+typedef struct {
+  char magic[4];
+  uint32_t version;
+} CacheHeader;
+
+typedef struct {
+  uint32_t path_len, range_count;
+  int64_t size, mtime_sec, mtime_nsec;
+} CacheEntry;
+
+static const char* configured[FONTS_MAX];
+static int configured_count = 0;
+static Font fonts[FONTS_MAX];
+static int font_count = 0;
+static FT_Library library;
+
+static char* cache_data = NULL;
+static size_t cache_len = 0;
+
+void fonts_add(const char* path) {
+  if (configured_count < FONTS_MAX) configured[configured_count++] = path;
+}
+
+static bool cache_dir(char* out, size_t size) {
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdg && *xdg) {
+    snprintf(out, size, "%s/term", xdg);
+  } else if (home && *home) {
+    snprintf(out, size, "%s/.cache/term", home);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static size_t entry_size(const CacheEntry* e) {
+  return sizeof(*e) + (e->path_len + 7) / 8 * 8 + (size_t)e->range_count * sizeof(Range);
+}
+
+// The entry at *pos, NULL at the end of the file or where it is damaged
+static const CacheEntry* next_entry(size_t* pos) {
+  if (cache_len - *pos < sizeof(CacheEntry)) return NULL;
+  const CacheEntry* e = (const CacheEntry*)(cache_data + *pos);
+  if (e->path_len == 0 || e->path_len > 4096 || e->range_count > (1u << 24) || entry_size(e) > cache_len - *pos) {
+    return NULL;
+  }
+  *pos += entry_size(e);
+  return e;
+}
+
+static const char* entry_path(const CacheEntry* e) { return (const char*)(e + 1); }
+
+static const Range* entry_ranges(const CacheEntry* e) {
+  return (const Range*)(entry_path(e) + (e->path_len + 7) / 8 * 8);
+}
+
+static bool entry_matches(const CacheEntry* e, const Font* f) {
+  return e->size == f->size && e->mtime_sec == f->mtime_sec && e->mtime_nsec == f->mtime_nsec &&
+         e->path_len == strlen(f->path) && memcmp(entry_path(e), f->path, e->path_len) == 0;
+}
+
+static void load_cache(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return;
+  CacheHeader h;
+  struct stat st;
+  if (fstat(fileno(f), &st) == 0 && st.st_size > (off_t)sizeof(h) && fread(&h, sizeof(h), 1, f) == 1 &&
+      memcmp(h.magic, CACHE_MAGIC, 4) == 0 && h.version == CACHE_VERSION) {
+    cache_len = st.st_size - sizeof(h);
+    cache_data = malloc(cache_len);
+    if (!cache_data || fread(cache_data, 1, cache_len, f) != cache_len) {
+      free(cache_data);
+      cache_data = NULL;
+      cache_len = 0;
+    }
+  }
+  fclose(f);
+}
+
+static bool cached_coverage(Font* font) {
+  size_t pos = 0;
+  for (const CacheEntry* e; (e = next_entry(&pos));) {
+    if (!entry_matches(e, font)) continue;
+    font->ranges = malloc((e->range_count ? e->range_count : 1) * sizeof(Range));
+    if (!font->ranges) return false;
+    memcpy(font->ranges, entry_ranges(e), e->range_count * sizeof(Range));
+    font->range_count = e->range_count;
+    return true;
+  }
+  return false;
+}
+
+static bool in_chain(const char* path, uint32_t len) {
+  for (int i = 0; i < font_count; i++) {
+    if (strlen(fonts[i].path) == len && memcmp(fonts[i].path, path, len) == 0) return true;
+  }
+  return false;
+}
+
+// Every font in the chain, then the entries of fonts that aren't, so other
+// configurations keep theirs. Replaced whole so readers never see half a file.
+static void save_cache(const char* dir, const char* path) {
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  // the parents first, mkdir doesn't make them
+  char parent[4096];
+  snprintf(parent, sizeof(parent), "%s", dir);
+  for (char* p = parent + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    mkdir(parent, 0700);
+    *p = '/';
+  }
+  mkdir(dir, 0700);
+
+  FILE* f = fopen(tmp, "wb");
+  if (!f) return;
+  static const char zeros[8];
+  CacheHeader h = {.magic = CACHE_MAGIC, .version = CACHE_VERSION};
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  for (int i = 0; i < font_count && ok; i++) {
+    const Font* font = &fonts[i];
+    if (!font->ranges) continue;
+    CacheEntry e = {.path_len = strlen(font->path),
+                    .range_count = font->range_count,
+                    .size = font->size,
+                    .mtime_sec = font->mtime_sec,
+                    .mtime_nsec = font->mtime_nsec};
+    ok = fwrite(&e, sizeof(e), 1, f) == 1 && fwrite(font->path, 1, e.path_len, f) == e.path_len &&
+         fwrite(zeros, 1, (8 - e.path_len % 8) % 8, f) == (8 - e.path_len % 8) % 8 &&
+         fwrite(font->ranges, sizeof(Range), font->range_count, f) == font->range_count;
+  }
+  size_t pos = 0;
+  for (const CacheEntry* e; ok && (e = next_entry(&pos));) {
+    if (!in_chain(entry_path(e), e->path_len)) ok = fwrite(e, 1, entry_size(e), f) == entry_size(e);
+  }
+  if (fclose(f) != 0) ok = false;
+  if (!ok || rename(tmp, path) != 0) unlink(tmp);
+}
+
+static bool open_face(Font* font) {
+  if (font->face) return true;
+  if (font->failed) return false;
+  // Bitmap-only fonts (color emoji) can't be drawn at the atlas's sizes
+  if (FT_New_Face(library, font->path, 0, &font->face) != 0 || !FT_IS_SCALABLE(font->face)) {
+    if (font->face) FT_Done_Face(font->face);
+    font->face = NULL;
+    font->failed = true;
+    return false;
+  }
+  return true;
+}
+
+// One walk over the charmap, which lists codepoints in ascending order
+static bool read_coverage(Font* font) {
+  uint32_t cap = 64;
+  font->ranges = malloc(cap * sizeof(Range));
+  font->range_count = 0;
+  if (!font->ranges) return false;
+
+  FT_UInt glyph;
+  for (FT_ULong cp = FT_Get_First_Char(font->face, &glyph); glyph != 0; cp = FT_Get_Next_Char(font->face, cp, &glyph)) {
+    Range* last = font->range_count ? &font->ranges[font->range_count - 1] : NULL;
+    if (last && last->last + 1 == cp) {
+      last->last = cp;
+      continue;
+    }
+    if (font->range_count == cap) {
+      Range* grown = realloc(font->ranges, cap * 2 * sizeof(Range));
+      if (!grown) return false;
+      font->ranges = grown;
+      cap *= 2;
+    }
+    font->ranges[font->range_count++] = (Range){cp, cp};
+  }
+  return true;
+}
+
+static bool covers(const Font* font, uint32_t cp) {
+  uint32_t lo = 0, hi = font->range_count;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (cp < font->ranges[mid].first) {
+      hi = mid;
+    } else if (cp > font->ranges[mid].last) {
+      lo = mid + 1;
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Files that don't exist are left out of the chain without a word
+static Font* add_font(const char* path) {
+  struct stat st;
+  if (font_count == FONTS_MAX || stat(path, &st) != 0 || in_chain(path, strlen(path))) return NULL;
+  Font* font = &fonts[font_count];
+  memset(font, 0, sizeof(*font));
+  font->path = strdup(path);
+  if (!font->path) return NULL;
+  font->size = st.st_size;
+  font->mtime_sec = st.st_mtim.tv_sec;
+  font->mtime_nsec = st.st_mtim.tv_nsec;
+  font_count++;
+  return font;
+}
+
+static void drop_last_font(void) {
+  Font* font = &fonts[--font_count];
+  if (font->face) FT_Done_Face(font->face);
+  free(font->path);
+  free(font->ranges);
+}
+
+bool fonts_open(FT_Library ft) {
+  library = ft;
+  char dir[4096], path[4096];
+  bool have_cache = cache_dir(dir, sizeof(dir));
+  snprintf(path, sizeof(path), "%s/fonts.cache", dir);
+  if (have_cache) load_cache(path);
+
+  for (int i = 0; i < configured_count; i++) {
+    Font* font = add_font(configured[i]);
+    if (!font && !in_chain(configured[i], strlen(configured[i]))) fprintf(stderr, "font: can't open %s\n", configured[i]);
+    if (font && !open_face(font)) {
+      fprintf(stderr, "font: can't use %s\n", configured[i]);
+      drop_last_font();
+    }
+  }
+
+  // The first platform font that opens, the old single font
+  const char** primary = platform_get_font_paths();
+  for (int i = 0; primary[i]; i++) {
+    Font* font = add_font(primary[i]);
+    if (!font) continue;
+    if (open_face(font)) break;
+    drop_last_font();
+  }
+
+  const char** fallbacks = platform_get_fallback_font_paths();
+  for (int i = 0; fallbacks[i]; i++) add_font(fallbacks[i]);
+
+  if (font_count == 0 || !open_face(&fonts[0])) {
+    fprintf(stderr, "Could not open any font\n");
+    free(cache_data);
+    cache_data = NULL;
+    return false;
+  }
+
+  bool changed = false;
+  for (int i = 0; i < font_count; i++) {
+    Font* font = &fonts[i];
+    if (cached_coverage(font)) continue;
+    // A font that won't open or read covers nothing and is asked again next time
+    if (!open_face(font) || !read_coverage(font)) {
+      free(font->ranges);
+      font->ranges = NULL;
+      font->range_count = 0;
+      continue;
+    }
+    changed = true;
+  }
+  if (changed && have_cache) save_cache(dir, path);
+  free(cache_data);
+  cache_data = NULL;
+  cache_len = 0;
+  return true;
+}
+
+FT_Face fonts_primary(void) { return font_count ? fonts[0].face : NULL; }
+
+FT_Face fonts_face_for(uint32_t codepoint) {
+  for (int i = 0; i < font_count; i++) {
+    if (covers(&fonts[i], codepoint) && open_face(&fonts[i])) return fonts[i].face;
+  }
+  return NULL;
+}
+
+void fonts_close(void) {
+  while (font_count > 0) drop_last_font();
+}
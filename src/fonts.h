@@ -0,0 +1,22 @@
+#ifndef FONTS_H
+#define FONTS_H
+
+#include <ft2build.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include FT_FREETYPE_H
+
+// Font fallback chain. Each codepoint is drawn with the first font in the
+// chain that maps it. Which codepoints a font maps is read from its charmap
+// once into a table of ranges and kept in a cache file, so picking the font
+// is a binary search per font, and fallbacks are only opened when a
+// codepoint needs them. The chain is the fonts given to fonts_add() in
+// order, then the first platform font that opens, then the platform's
+// fallbacks.
+void fonts_add(const char* path);  // before fonts_open()
+bool fonts_open(FT_Library ft);    // false when no font opens at all
+FT_Face fonts_primary(void);
+FT_Face fonts_face_for(uint32_t codepoint);  // NULL when no font in the chain has it
+void fonts_close(void);
+
+#endif
@@ -0,0 +1,664 @@
+#define _XOPEN_SOURCE 700  // realpath() is an XSI extension
+
+#include "graphics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "window.h"
+
+#define GRAPHICS_MAX_SIDE 10000       // pixels, larger images are refused
+#define GRAPHICS_INTERNAL_ID 0x80000000u  // ids we pick ourselves start here
+#define GRAPHICS_TEMP_MARKER "tty-graphics-protocol"  // in the name of every t=t file we may delete
+
+typedef struct {
+  char action;        // a: t transmit, T transmit and place, p place, d delete, q query
+  char transmission;  // t: d inline, f file, t temporary file, s shared memory
+  char delete_what;   // d
+  char compression;   // o: z for zlib, 0 for none
+  uint32_t format;    // f: 24 RGB, 32 RGBA, 100 PNG
+  uint32_t id, number, placement;  // i, I, p
+  uint32_t width, height;          // s, v: pixels of raw data
+  uint32_t size, offset;           // S, O: bytes to read from a file or shared memory
+  int more, quiet, cursor_movement;  // m, q, C
+  int x, y, w, h;                    // source rect in pixels
+  int off_x, off_y;                  // X, Y: offset within the first cell
+  int cols, rows;                    // c, r: cells to scale into, 0 for the image's own size
+  int z;
+} Command;
+
+typedef struct {
+  uint32_t id, number;
+  int width, height;
+  uint8_t* pixels;  // RGBA rows, width * 4 bytes apart, on the heap
+  size_t bytes;
+  uint32_t texture;  // 0 when not resident
+  uint32_t serial;
+  uint64_t last_used;  // use_clock of the last transmit, place or draw
+  uint64_t drawn_frame;
+} Image;
+
+typedef struct {
+  uint32_t image_id, id;
+  int64_t line;  // of the top left cell
+  int col;
+  int cols, rows;                // cells covered
+  int req_cols, req_rows;        // c, r as given
+  int src_x, src_y, src_w, src_h;
+  int off_x, off_y;
+  int z;
+  uint64_t order;  // ties in z draw in placement order
+} Placement;
+
+static Image* images = NULL;
+static size_t image_count = 0, image_cap = 0;
+static Placement* placements = NULL;
+static size_t placement_count = 0, placement_cap = 0;
+
+static size_t cpu_bytes = 0, gpu_bytes = 0;
+static uint64_t use_clock = 0, frame = 1;
+static uint32_t next_serial = 1, next_internal_id = GRAPHICS_INTERNAL_ID;
+
+// A chunked (m=1) inline transmission, keys from its first chunk
+static Command pending;
+static Buffer pending_data;
+static bool pending_active = false;
+
+// Pixel data before decoding, the inline payload or what was read from a
+// file into file. Never a mapping: the client could truncate the file under
+// us and every later read of the pixels would fault.
+typedef struct {
+  const uint8_t* data;
+  size_t len;
+  Buffer file;
+} Source;
+
+static uint32_t parse_number(const char** p, const char* end, bool* negative) {
+  uint32_t v = 0;
+  *negative = *p < end && **p == '-';
+  if (*negative) (*p)++;
+  while (*p < end && **p >= '0' && **p <= '9') v = v * 10 + (*(*p)++ - '0');
+  return v;
+}
+
+// key=value pairs separated by commas, values are one letter or a number
+static void parse_keys(const char* s, const char* end, Command* cmd) {
+  *cmd = (Command){.action = 't', .transmission = 'd', .delete_what = 'a', .format = 32};
+
+  while (s < end) {
+    char key = *s;
+    if (s + 2 > end || s[1] != '=') break;
+    s += 2;
+
+    bool negative;
+    const char* value = s;
+    uint32_t n = parse_number(&s, end, &negative);
+    int signed_n = negative ? -(int)n : (int)n;
+
+    switch (key) {
+      case 'a': cmd->action = *value; s = value + 1; break;
+      case 't': cmd->transmission = *value; s = value + 1; break;
+      case 'd': cmd->delete_what = *value; s = value + 1; break;
+      case 'o': cmd->compression = *value; s = value + 1; break;
+      case 'f': cmd->format = n; break;
+      case 'i': cmd->id = n; break;
+      case 'I': cmd->number = n; break;
+      case 'p': cmd->placement = n; break;
+      case 's': cmd->width = n; break;
+      case 'v': cmd->height = n; break;
+      case 'S': cmd->size = n; break;
+      case 'O': cmd->offset = n; break;
+      case 'm': cmd->more = signed_n; break;
+      case 'q': cmd->quiet = signed_n; break;
+      case 'C': cmd->cursor_movement = signed_n; break;
+      case 'x': cmd->x = signed_n; break;
+      case 'y': cmd->y = signed_n; break;
+      case 'w': cmd->w = signed_n; break;
+      case 'h': cmd->h = signed_n; break;
+      case 'X': cmd->off_x = signed_n; break;
+      case 'Y': cmd->off_y = signed_n; break;
+      case 'c': cmd->cols = signed_n; break;
+      case 'r': cmd->rows = signed_n; break;
+      case 'z': cmd->z = signed_n; break;
+      default:
+        while (s < end && *s != ',') s++;
+        break;
+    }
+    if (s < end && *s == ',') s++;
+  }
+}
+
+// Replies go out only for commands that named their image
+static void respond(const Command* cmd, Buffer* reply, const char* status) {
+  bool ok = strcmp(status, "OK") == 0;
+  if ((!cmd->id && !cmd->number) || cmd->quiet >= 2 || (ok && cmd->quiet == 1)) return;
+
+  char head[64];
+  int n = snprintf(head, sizeof(head), "\x1b_Gi=%u", cmd->id);
+  if (cmd->number) n += snprintf(head + n, sizeof(head) - n, ",I=%u", cmd->number);
+  if (cmd->placement) n += snprintf(head + n, sizeof(head) - n, ",p=%u", cmd->placement);
+  buffer_append(reply, head, n);
+  buffer_putc(reply, ';');
+  buffer_append(reply, status, strlen(status));
+  buffer_append(reply, "\x1b\\", 2);
+}
+
+static Image* find_image(uint32_t id) {
+  for (size_t i = 0; i < image_count; i++) {
+    if (images[i].id == id) return &images[i];
+  }
+  return NULL;
+}
+
+// Newest image with a client-chosen number
+static Image* find_number(uint32_t number) {
+  for (size_t i = image_count; i-- > 0;) {
+    if (images[i].number == number) return &images[i];
+  }
+  return NULL;
+}
+
+static void release_texture(Image* image) {
+  if (!image->texture) return;
+  window_image_free(image->texture);
+  image->texture = 0;
+  gpu_bytes -= image->bytes;
+}
+
+static void delete_placement(size_t i) { placements[i] = placements[--placement_count]; }
+
+static void delete_image(Image* image) {
+  for (size_t i = placement_count; i-- > 0;) {
+    if (placements[i].image_id == image->id) delete_placement(i);
+  }
+  release_texture(image);
+  free(image->pixels);
+  cpu_bytes -= image->bytes;
+  *image = images[--image_count];
+}
+
+static void free_source(Source* src) { buffer_free(&src->file); }
+
+// Reads size bytes at offset of an open file, the whole rest of it when size
+// is 0. The file may shrink meanwhile, a short read is missing data.
+static const char* read_fd(int fd, uint32_t size, uint32_t offset, Source* src) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return "EBADF:Not a regular file";
+  if ((off_t)offset >= st.st_size) return "ENODATA:Offset past the end of the data";
+  size_t len = size ? size : (size_t)(st.st_size - offset);
+  if ((off_t)offset + (off_t)len > st.st_size) return "ENODATA:Insufficient image data";
+  if (len > GRAPHICS_STORAGE_MAX) return "EFBIG:Image data too large";
+  if (!buffer_reserve(&src->file, len)) return "ENOMEM:Out of memory";
+
+  while (src->file.len < len) {
+    ssize_t n = pread(fd, src->file.data + src->file.len, len - src->file.len, (off_t)offset + src->file.len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return "ENODATA:Insufficient image data";
+    src->file.len += n;
+  }
+  src->data = (const uint8_t*)src->file.data;
+  src->len = len;
+  return NULL;
+}
+
+// A t=t file is ours to delete only if it is a regular file directly in a
+// temporary directory and its name says it was made for us
+static bool is_temp_file(const char* name) {
+  char path[PATH_MAX], dir[PATH_MAX];
+  struct stat st;
+  if (!realpath(name, path) || lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+  char* base = strrchr(path, '/');
+  if (!base || !strstr(base + 1, GRAPHICS_TEMP_MARKER)) return false;
+  *base = '\0';
+
+  const char* tmpdirs[] = {getenv("TMPDIR"), "/tmp", "/dev/shm"};
+  for (size_t i = 0; i < sizeof(tmpdirs) / sizeof(tmpdirs[0]); i++) {
+    if (tmpdirs[i] && realpath(tmpdirs[i], dir) && strcmp(dir, path[0] ? path : "/") == 0) return true;
+  }
+  return false;
+}
+
+// Inline data, or the file or shared memory object the payload names
+static const char* open_source(const Command* cmd, Buffer* payload, Source* src) {
+  if (cmd->transmission == 'd') {
+    *src = (Source){.data = (const uint8_t*)payload->data, .len = payload->len};
+    return NULL;
+  }
+  if (!buffer_putc(payload, '\0')) return "ENOMEM:Out of memory";
+  const char* name = payload->data;
+
+  const char* err;
+  int fd;
+  switch (cmd->transmission) {
+    case 'f':
+    case 't':
+      // never blocks on a FIFO or follows a link, and read_fd() refuses anything but a regular file
+      fd = open(name, O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC);
+      if (fd < 0) return "ENOENT:Could not open the file";
+      err = read_fd(fd, cmd->size, cmd->offset, src);
+      close(fd);
+      if (cmd->transmission == 't' && is_temp_file(name)) unlink(name);
+      return err;
+
+    case 's':
+      fd = shm_open(name, O_RDONLY, 0);
+      if (fd < 0) return "ENOENT:Could not open the shared memory object";
+      err = read_fd(fd, cmd->size, cmd->offset, src);
+      close(fd);
+      shm_unlink(name);
+      return err;
+
+    default:
+      return "EINVAL:Unknown transmission medium";
+  }
+}
+
+static bool inflate_all(const Source* src, Buffer* out) {
+  z_stream zs = {0};
+  if (inflateInit(&zs) != Z_OK) return false;
+
+  zs.next_in = (Bytef*)src->data;
+  zs.avail_in = src->len;
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    if (out->len > GRAPHICS_STORAGE_MAX || !buffer_reserve(out, 1 << 16)) break;
+    zs.next_out = (Bytef*)out->data + out->len;
+    zs.avail_out = out->cap - out->len;
+    ret = inflate(&zs, Z_NO_FLUSH);
+    out->len = out->cap - zs.avail_out;
+  }
+  inflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+static uint8_t* decode_png(const uint8_t* data, size_t len, int* width, int* height) {
+  png_image png;
+  memset(&png, 0, sizeof(png));
+  png.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&png, data, len)) return NULL;
+
+  png.format = PNG_FORMAT_RGBA;
+  uint8_t* pixels = NULL;
+  if (png.width <= GRAPHICS_MAX_SIDE && png.height <= GRAPHICS_MAX_SIDE) pixels = malloc(PNG_IMAGE_SIZE(png));
+  if (!pixels || !png_image_finish_read(&png, NULL, pixels, 0, NULL)) {
+    free(pixels);
+    png_image_free(&png);
+    return NULL;
+  }
+  *width = png.width;
+  *height = png.height;
+  return pixels;
+}
+
+// Decodes src into image. Uncompressed RGBA is kept in the buffer it was
+// read or received into rather than copied.
+static const char* decode(const Command* cmd, Source* src, Buffer* payload, Image* image) {
+  Buffer inflated = {0};
+  const uint8_t* data = src->data;
+  size_t len = src->len;
+  if (cmd->compression == 'z') {
+    if (!inflate_all(src, &inflated)) {
+      buffer_free(&inflated);
+      return "EINVAL:Could not inflate the data";
+    }
+    data = (const uint8_t*)inflated.data;
+    len = inflated.len;
+  } else if (cmd->compression) {
+    return "EINVAL:Unknown compression";
+  }
+
+  const char* err = NULL;
+  if (cmd->format == 100) {
+    image->pixels = decode_png(data, len, &image->width, &image->height);
+    if (!image->pixels) err = "EBADPNG:Could not decode the PNG";
+  } else if (cmd->format == 24 || cmd->format == 32) {
+    size_t bpp = cmd->format / 8;
+    image->width = cmd->width;
+    image->height = cmd->height;
+    size_t need = (size_t)cmd->width * cmd->height * bpp;
+    if (!cmd->width || !cmd->height || cmd->width > GRAPHICS_MAX_SIDE || cmd->height > GRAPHICS_MAX_SIDE) {
+      err = "EINVAL:Bad image size";
+    } else if (len < need) {
+      err = "ENODATA:Insufficient image data";
+    } else if (cmd->format == 32 && data == src->data) {
+      Buffer* owner = src->file.data ? &src->file : payload;
+      image->pixels = (uint8_t*)owner->data;
+      *owner = (Buffer){0};
+    } else if ((image->pixels = malloc((size_t)cmd->width * cmd->height * 4))) {
+      size_t count = (size_t)cmd->width * cmd->height;
+      for (size_t i = 0; i < count; i++) {
+        memcpy(image->pixels + i * 4, data + i * bpp, bpp);
+        if (bpp == 3) image->pixels[i * 4 + 3] = 0xFF;
+      }
+    } else {
+      err = "ENOMEM:Out of memory";
+    }
+  } else {
+    err = "EINVAL:Unknown format";
+  }
+
+  buffer_free(&inflated);
+  image->bytes = (size_t)image->width * image->height * 4;
+  return err;
+}
+
+// Makes room under GRAPHICS_STORAGE_MAX by dropping least recently used images
+static void make_room(size_t bytes) {
+  while (image_count && cpu_bytes + bytes > GRAPHICS_STORAGE_MAX) {
+    Image* oldest = &images[0];
+    for (size_t i = 1; i < image_count; i++) {
+      if (images[i].last_used < oldest->last_used) oldest = &images[i];
+    }
+    delete_image(oldest);
+  }
+}
+
+// Grows the array before replacing anything, so a failure keeps the old image
+static Image* add_image(Image* decoded) {
+  if (image_count == image_cap) {
+    size_t cap = image_cap ? image_cap * 2 : 16;
+    Image* grown = realloc(images, cap * sizeof(*images));
+    if (!grown) return NULL;
+    images = grown;
+    image_cap = cap;
+  }
+
+  Image* old = decoded->id ? find_image(decoded->id) : NULL;
+  if (old) delete_image(old);
+  make_room(decoded->bytes);
+
+  decoded->serial = next_serial++;
+  decoded->last_used = ++use_clock;
+  cpu_bytes += decoded->bytes;
+  images[image_count] = *decoded;
+  return &images[image_count++];
+}
+
+static void place(const Command* cmd, Image* image, const GraphicsContext* ctx, int* cols, int* rows) {
+  Placement p = {.image_id = image->id, .id = cmd->placement, .line = ctx->cursor_line, .col = ctx->cursor_col,
+                 .req_cols = cmd->cols > 0 ? cmd->cols : 0, .req_rows = cmd->rows > 0 ? cmd->rows : 0,
+                 .off_x = cmd->off_x, .off_y = cmd->off_y, .z = cmd->z, .order = ++use_clock};
+
+  // source rect, clamped to the image
+  p.src_x = cmd->x < 0 ? 0 : (cmd->x < image->width ? cmd->x : image->width - 1);
+  p.src_y = cmd->y < 0 ? 0 : (cmd->y < image->height ? cmd->y : image->height - 1);
+  p.src_w = cmd->w > 0 && cmd->w < image->width - p.src_x ? cmd->w : image->width - p.src_x;
+  p.src_h = cmd->h > 0 && cmd->h < image->height - p.src_y ? cmd->h : image->height - p.src_y;
+
+  // cells covered, the missing one of c and r keeps the aspect ratio
+  float w = p.src_w, h = p.src_h;
+  if (p.req_cols) w = p.req_cols * ctx->cell_width;
+  if (p.req_rows) h = p.req_rows * ctx->cell_height;
+  if (p.req_cols && !p.req_rows) h = w * p.src_h / p.src_w;
+  if (p.req_rows && !p.req_cols) w = h * p.src_w / p.src_h;
+  p.cols = p.req_cols ? p.req_cols : (int)((p.off_x + w) / ctx->cell_width + 0.999f);
+  p.rows = p.req_rows ? p.req_rows : (int)((p.off_y + h) / ctx->cell_height + 0.999f);
+  if (p.cols < 1) p.cols = 1;
+  if (p.rows < 1) p.rows = 1;
+
+  // the same image and placement id replaces the old placement
+  for (size_t i = 0; p.id && i < placement_count; i++) {
+    if (placements[i].image_id == p.image_id && placements[i].id == p.id) {
+      delete_placement(i);
+      break;
+    }
+  }
+
+  if (placement_count == placement_cap) {
+    size_t cap = placement_cap ? placement_cap * 2 : 16;
+    Placement* grown = realloc(placements, cap * sizeof(*placements));
+    if (!grown) return;
+    placements = grown;
+    placement_cap = cap;
+  }
+  placements[placement_count++] = p;
+  image->last_used = ++use_clock;
+
+  if (cmd->cursor_movement != 1) {
+    *cols = p.cols;
+    *rows = p.rows - 1;
+  }
+}
+
+static void transmit(Command* cmd, Buffer* payload, const GraphicsContext* ctx, Buffer* reply, int* cols,
+                     int* rows) {
+  if (cmd->id && cmd->number) {
+    respond(cmd, reply, "EINVAL:Both i and I given");
+    return;
+  }
+
+  Source src = {0};
+  Image decoded = {0};
+  const char* err = open_source(cmd, payload, &src);
+  if (!err) err = decode(cmd, &src, payload, &decoded);
+  free_source(&src);
+
+  if (err || cmd->action == 'q') {
+    free(decoded.pixels);
+    respond(cmd, reply, err ? err : "OK");
+    return;
+  }
+
+  decoded.id = cmd->id ? cmd->id : next_internal_id++;
+  decoded.number = cmd->number;
+  Image* image = add_image(&decoded);
+  if (!image) {
+    free(decoded.pixels);
+    respond(cmd, reply, "ENOMEM:Out of memory");
+    return;
+  }
+  cmd->id = cmd->number ? image->id : cmd->id;
+  if (cmd->action == 'T') place(cmd, image, ctx, cols, rows);
+  respond(cmd, reply, "OK");
+}
+
+static bool covers(const Placement* p, int64_t line, int col) {
+  return line >= p->line && line < p->line + p->rows && (col < 0 || (col >= p->col && col < p->col + p->cols));
+}
+
+// d=... selects placements, upper case also frees images left without any
+static void delete_command(const Command* cmd, const GraphicsContext* ctx) {
+  char what = cmd->delete_what;
+  bool free_images = what >= 'A' && what <= 'Z';
+  if (free_images) what += 'a' - 'A';
+
+  Image* by_number = what == 'n' ? find_number(cmd->number) : NULL;
+  int64_t cell_line = ctx->screen_line + cmd->y - 1;  // x and y are 1-based screen cells
+
+  for (size_t i = placement_count; i-- > 0;) {
+    const Placement* p = &placements[i];
+    bool hit = false;
+    switch (what) {
+      case 'a': hit = p->line + p->rows > ctx->screen_line; break;
+      case 'i': hit = p->image_id == cmd->id && (!cmd->placement || p->id == cmd->placement); break;
+      case 'n': hit = by_number && p->image_id == by_number->id && (!cmd->placement || p->id == cmd->placement); break;
+      case 'c': hit = covers(p, ctx->cursor_line, ctx->cursor_col); break;
+      case 'p': hit = covers(p, cell_line, cmd->x - 1); break;
+      case 'x': hit = cmd->x - 1 >= p->col && cmd->x - 1 < p->col + p->cols; break;
+      case 'y': hit = covers(p, cell_line, -1); break;
+      case 'z': hit = p->z == cmd->z; break;
+    }
+    if (hit) delete_placement(i);
+  }
+
+  if (!free_images) return;
+  for (size_t i = image_count; i-- > 0;) {
+    bool placed = false;
+    for (size_t k = 0; k < placement_count && !placed; k++) placed = placements[k].image_id == images[i].id;
+    if (!placed) delete_image(&images[i]);
+  }
+}
+
+void graphics_command(const char* s, size_t len, const GraphicsContext* ctx, Buffer* reply, int* cols, int* rows) {
+  *cols = *rows = 0;
+  const char* semi = memchr(s, ';', len);
+  const char* keys_end = semi ? semi : s + len;
+  const char* payload = semi ? semi + 1 : s + len;
+  size_t payload_len = (size_t)(s + len - payload);
+
+  Command cmd;
+  parse_keys(s, keys_end, &cmd);
+
+  // later chunks of an inline transmission only say whether more follow
+  if (pending_active) {
+    int more = cmd.more;
+    if (!buffer_append_base64(&pending_data, payload, payload_len)) {
+      pending_active = false;
+      buffer_free(&pending_data);
+      respond(&pending, reply, "EINVAL:Bad base64 data");
+      return;
+    }
+    if (more) return;
+    cmd = pending;
+    pending_active = false;
+  } else {
+    buffer_clear(&pending_data);
+    if (!buffer_append_base64(&pending_data, payload, payload_len)) {
+      respond(&cmd, reply, "EINVAL:Bad base64 data");
+      return;
+    }
+    if (cmd.more && cmd.transmission == 'd') {
+      pending = cmd;
+      pending_active = true;
+      return;
+    }
+  }
+
+  switch (cmd.action) {
+    case 't':
+    case 'T':
+    case 'q':
+      transmit(&cmd, &pending_data, ctx, reply, cols, rows);
+      break;
+
+    case 'p': {
+      Image* image = cmd.id ? find_image(cmd.id) : find_number(cmd.number);
+      if (!image) {
+        respond(&cmd, reply, "ENOENT:No such image");
+        break;
+      }
+      if (cmd.number) cmd.id = image->id;
+      place(&cmd, image, ctx, cols, rows);
+      respond(&cmd, reply, "OK");
+      break;
+    }
+
+    case 'd':
+      delete_command(&cmd, ctx);
+      break;
+
+    default:
+      respond(&cmd, reply, "EINVAL:Unsupported action");
+      break;
+  }
+
+  // a big inline image shouldn't pin its buffer
+  if (pending_data.cap > (1 << 20)) buffer_free(&pending_data);
+}
+
+void graphics_delete_lines(int64_t first, int64_t last) {
+  for (size_t i = placement_count; i-- > 0;) {
+    if (placements[i].line >= first && placements[i].line <= last) delete_placement(i);
+  }
+}
+
+void graphics_forget_before(int64_t oldest) {
+  for (size_t i = placement_count; i-- > 0;) {
+    if (placements[i].line + placements[i].rows <= oldest) delete_placement(i);
+  }
+}
+
+static int compare_placements(const void* a, const void* b) {
+  const Placement* pa = *(const Placement* const*)a;
+  const Placement* pb = *(const Placement* const*)b;
+  if (pa->z != pb->z) return pa->z < pb->z ? -1 : 1;
+  return pa->order < pb->order ? -1 : pa->order > pb->order;
+}
+
+void graphics_draw(int64_t first_line, int rows, float x, float y, float cell_width, float cell_height,
+                   bool below_text) {
+  static const Placement** visible = NULL;
+  static size_t visible_cap = 0;
+
+  if (!placement_count) return;
+  if (visible_cap < placement_count) {
+    const Placement** grown = realloc(visible, placement_count * sizeof(*visible));
+    if (!grown) return;
+    visible = grown;
+    visible_cap = placement_count;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < placement_count; i++) {
+    const Placement* p = &placements[i];
+    if ((p->z < 0) != below_text || p->line >= first_line + rows || p->line + p->rows <= first_line) continue;
+    visible[n++] = p;
+  }
+  qsort(visible, n, sizeof(*visible), compare_placements);
+
+  float grid_top = y, grid_bottom = y + rows * cell_height;
+  for (size_t i = 0; i < n; i++) {
+    const Placement* p = visible[i];
+    Image* image = find_image(p->image_id);
+    if (!image) continue;
+
+    float w = p->src_w, h = p->src_h;
+    if (p->req_cols) w = p->req_cols * cell_width;
+    if (p->req_rows) h = p->req_rows * cell_height;
+    if (p->req_cols && !p->req_rows) h = w * p->src_h / p->src_w;
+    if (p->req_rows && !p->req_cols) w = h * p->src_w / p->src_h;
+    float left = x + p->col * cell_width + p->off_x;
+    float top = y + (p->line - first_line) * cell_height + p->off_y;
+
+    // clip to the grid rows, taking the same share off the source
+    int src_y = p->src_y, src_h = p->src_h;
+    if (top < grid_top) {
+      int cut = (int)((grid_top - top) / h * p->src_h);
+      src_y += cut;
+      src_h -= cut;
+      h -= grid_top - top;
+      top = grid_top;
+    }
+    if (top + h > grid_bottom) {
+      int keep = (int)((grid_bottom - top) / h * src_h + 0.5f);
+      h = grid_bottom - top;
+      src_h = keep;
+    }
+    if (h <= 0 || src_h <= 0) continue;
+
+    if (!image->texture) {
+      image->texture = window_image_upload(image->pixels, image->width, image->height);
+      if (image->texture) gpu_bytes += image->bytes;
+    }
+    image->drawn_frame = frame;
+    image->last_used = ++use_clock;
+
+    WindowImage wi = {.texture = image->texture, .rgba = image->pixels, .width = image->width,
+                      .height = image->height, .serial = image->serial};
+    window_draw_image(&wi, p->src_x, src_y, p->src_w, src_h, left, top, w, h);
+  }
+}
+
+void graphics_end_frame(void) {
+  while (gpu_bytes > GRAPHICS_GPU_BUDGET) {
+    Image* oldest = NULL;
+    for (size_t i = 0; i < image_count; i++) {
+      Image* image = &images[i];
+      if (!image->texture || image->drawn_frame == frame) continue;
+      if (!oldest || image->last_used < oldest->last_used) oldest = image;
+    }
+    if (!oldest) break;  // everything resident is on screen
+    release_texture(oldest);
+  }
+  frame++;
+}
@@ -0,0 +1,40 @@
+#ifndef GRAPHICS_H
+#define GRAPHICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+// Kitty graphics protocol, the body of APC G ... ST. Pixel data arrives inline
+// as base64 or out of band through shared memory (t=s) or a file (t=f, t=t).
+// Placements are anchored to absolute line numbers, so they scroll with text.
+#define GRAPHICS_STORAGE_MAX (320u << 20)  // decoded bytes kept, least recently used images go first
+#define GRAPHICS_GPU_BUDGET (256u << 20)   // texture bytes kept resident between frames
+
+// Where a command lands. Lines are absolute, like the scrollback's.
+typedef struct {
+  int64_t cursor_line;
+  int cursor_col;
+  int64_t screen_line;  // top row of the screen
+  int screen_rows;
+  float cell_width, cell_height;  // pixels
+} GraphicsContext;
+
+// Handles one command, appending any reply for the program to reply. The
+// cursor then moves right by *cols cells and down by *rows lines.
+void graphics_command(const char* s, size_t len, const GraphicsContext* ctx, Buffer* reply, int* cols, int* rows);
+
+// Drops placements anchored in [first, last], and those before oldest, which
+// have scrolled out of history
+void graphics_delete_lines(int64_t first, int64_t last);
+void graphics_forget_before(int64_t oldest);
+
+// Draws placements overlapping rows [first_line, first_line + rows) whose z is
+// below zero (under the text) or not, with (x, y) the top left of first_line
+void graphics_draw(int64_t first_line, int rows, float x, float y, float cell_width, float cell_height,
+                   bool below_text);
+// Evicts textures over GRAPHICS_GPU_BUDGET that this frame didn't draw
+void graphics_end_frame(void);
+
+#endif
@@ -0,0 +1,98 @@
+#include "hud.h"
+
+#include <stdio.h>
+
+#include "platform.h"
+#include "window.h"
+
+#define HUD_SAMPLES 120
+#define HUD_LINE_HEIGHT 16.0f
+#define HUD_WIDTH 340.0f
+
+typedef struct {
+  double render_ms;
+  double swap_ms;
+  double at;  // glfwGetTime() when the frame was presented
+  int cells;
+  int draw_calls;
+} HudSample;
+
+static bool visible = false;
+static HudSample samples[HUD_SAMPLES];
+static int sample_count = 0;
+static int sample_next = 0;
+
+static size_t parsed_bytes = 0;  // since window_start
+static double window_start = 0.0;
+static double parsed_per_sec = 0.0;
+
+void hud_toggle(void) { visible = !visible; }
+
+bool hud_visible(void) { return visible; }
+
+void hud_count_parsed(size_t bytes) { parsed_bytes += bytes; }
+
+void hud_frame(double render_ms, double swap_ms, int cells, int draw_calls) {
+  double now = glfwGetTime();
+  samples[sample_next] = (HudSample){render_ms, swap_ms, now, cells, draw_calls};
+  sample_next = (sample_next + 1) % HUD_SAMPLES;
+  if (sample_count < HUD_SAMPLES) sample_count++;
+
+  if (now - window_start >= 1.0) {
+    parsed_per_sec = parsed_bytes / (now - window_start);
+    parsed_bytes = 0;
+    window_start = now;
+  }
+}
+
+static void hud_line(float x, float* y, float r, float g, float b, const char* text) {
+  window_set_text_color(r, g, b);
+  window_draw_text(x, *y, text);
+  *y += HUD_LINE_HEIGHT;
+}
+
+void hud_draw(size_t grid_bytes, size_t history_bytes) {
+  if (!visible || sample_count == 0) return;
+
+  double render_sum = 0, render_max = 0, swap_sum = 0;
+  long cells_sum = 0, calls_sum = 0;
+  for (int i = 0; i < sample_count; i++) {
+    render_sum += samples[i].render_ms;
+    swap_sum += samples[i].swap_ms;
+    if (samples[i].render_ms > render_max) render_max = samples[i].render_ms;
+    cells_sum += samples[i].cells;
+    calls_sum += samples[i].draw_calls;
+  }
+
+  // FPS from presentation timestamps of the samples we have
+  int newest = (sample_next + HUD_SAMPLES - 1) % HUD_SAMPLES;
+  int oldest = (sample_next + HUD_SAMPLES - sample_count) % HUD_SAMPLES;
+  double span = samples[newest].at - samples[oldest].at;
+  double fps = span > 0 ? (sample_count - 1) / span : 0;
+
+  int glyphs, atlas_used, atlas_total;
+  window_get_atlas_usage(&glyphs, &atlas_used, &atlas_total);
+
+  // fixed size whatever the terminal is zoomed to, render_terminal() sets it again
+  window_set_text_scale(1.0f);
+  int width, height;
+  window_get_size(&width, &height);
+  float x = width - HUD_WIDTH - 8.0f;
+  float y = 8.0f;
+  window_draw_rect(x - 6.0f, y, HUD_WIDTH, HUD_LINE_HEIGHT * 7 + 8.0f, 0.0f, 0.0f, 0.0f);
+  y += HUD_LINE_HEIGHT;
+
+  char line[96];
+  snprintf(line, sizeof(line), "frame %.2f ms avg  %.2f max  %.0f fps", render_sum / sample_count, render_max, fps);
+  hud_line(x, &y, 0.4f, 1.0f, 0.4f, line);
+  snprintf(line, sizeof(line), "swap  %.2f ms avg", swap_sum / sample_count);
+  hud_line(x, &y, 0.4f, 1.0f, 0.4f, line);
+  snprintf(line, sizeof(line), "parse %.2f MB/s", parsed_per_sec / 1e6);
+  hud_line(x, &y, 1.0f, 0.8f, 0.3f, line);
+  snprintf(line, sizeof(line), "cells %ld/frame  draws %ld/frame", cells_sum / sample_count, calls_sum / sample_count);
+  hud_line(x, &y, 0.5f, 0.8f, 1.0f, line);
+  snprintf(line, sizeof(line), "atlas %d glyphs  %d%% full", glyphs, atlas_total ? atlas_used * 100 / atlas_total : 0);
+  hud_line(x, &y, 0.5f, 0.8f, 1.0f, line);
+  snprintf(line, sizeof(line), "grid %.1f KB  history %.1f MB", grid_bytes / 1024.0, history_bytes / 1048576.0);
+  hud_line(x, &y, 0.8f, 0.8f, 0.8f, line);
+}
@@ -0,0 +1,15 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Performance overlay, toggled with F12 (or started with --hud). Numbers are
+// rolling over the last HUD_SAMPLES frames, throughput over the last second.
+void hud_toggle(void);
+bool hud_visible(void);
+void hud_count_parsed(size_t bytes);
+void hud_frame(double render_ms, double swap_ms, int cells, int draw_calls);
+void hud_draw(size_t grid_bytes, size_t history_bytes);
+
+#endif
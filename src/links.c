@@ -0,0 +1,304 @@
+#include "links.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LINK_GC_MIN (1 << 16)   // arena bytes before collection is considered
+#define LINK_CACHE_ROWS 1024    // rows of detection results kept, direct mapped by generation
+
+// Arena entries are a 4 byte length followed by the URI and a NUL
+static char* arena = NULL;
+static size_t arena_len = 0, arena_cap = 0;
+static size_t arena_live = 0;  // arena_len after the last collection
+
+// Open-addressed intern table of arena offsets + 1, 0 marks a free slot
+static uint32_t* slots = NULL;
+static size_t slot_count = 0, slot_used = 0;
+
+static char* old_arena = NULL;  // arena being collected from
+
+static uint32_t hash_bytes(const char* s, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+static uint32_t entry_len(const char* entry) {
+  uint32_t len;
+  memcpy(&len, entry, sizeof(len));
+  return len;
+}
+
+static bool slots_grow(void) {
+  size_t count = slot_count ? slot_count * 2 : 256;
+  uint32_t* grown = calloc(count, sizeof(*grown));
+  if (!grown) return false;
+
+  for (size_t i = 0; i < slot_count; i++) {
+    if (!slots[i]) continue;
+    const char* entry = &arena[slots[i] - 1];
+    size_t k = hash_bytes(entry + 4, entry_len(entry)) & (count - 1);
+    while (grown[k]) k = (k + 1) & (count - 1);
+    grown[k] = slots[i];
+  }
+
+  free(slots);
+  slots = grown;
+  slot_count = count;
+  return true;
+}
+
+uint32_t link_intern(const char* uri, size_t len) {
+  if (len == 0 || len > UINT32_MAX - 5) return 0;
+  if (slot_used * 2 >= slot_count && !slots_grow()) return 0;
+
+  size_t k = hash_bytes(uri, len) & (slot_count - 1);
+  for (; slots[k]; k = (k + 1) & (slot_count - 1)) {
+    const char* entry = &arena[slots[k] - 1];
+    if (entry_len(entry) == len && memcmp(entry + 4, uri, len) == 0) return slots[k];
+  }
+
+  if (arena_cap - arena_len < len + 5) {
+    size_t cap = arena_cap ? arena_cap : 4096;
+    while (cap - arena_len < len + 5) cap *= 2;
+    char* grown = realloc(arena, cap);
+    if (!grown) return 0;
+    arena = grown;
+    arena_cap = cap;
+  }
+
+  uint32_t offset = arena_len;
+  uint32_t n = len;
+  memcpy(&arena[arena_len], &n, sizeof(n));
+  memcpy(&arena[arena_len + 4], uri, len);
+  arena[arena_len + 4 + len] = '\0';
+  arena_len += len + 5;
+
+  slots[k] = offset + 1;
+  slot_used++;
+  return offset + 1;
+}
+
+const char* link_uri(uint32_t id, size_t* len) {
+  if (!id) return NULL;
+  const char* entry = &arena[id - 1];
+  if (len) *len = entry_len(entry);
+  return entry + 4;
+}
+
+bool link_needs_gc(void) { return arena_len > LINK_GC_MIN && arena_len > arena_live * 2; }
+
+void link_gc_begin(void) {
+  old_arena = arena;
+  arena = NULL;
+  arena_len = arena_cap = 0;
+  memset(slots, 0, slot_count * sizeof(*slots));
+  slot_used = 0;
+}
+
+uint32_t link_gc_keep(uint32_t id) {
+  if (!id) return 0;
+  const char* entry = &old_arena[id - 1];
+  return link_intern(entry + 4, entry_len(entry));
+}
+
+void link_gc_end(void) {
+  free(old_arena);
+  old_arena = NULL;
+  arena_live = arena_len;
+}
+
+const char* link_arena(size_t* len) {
+  *len = arena_len;
+  return arena;
+}
+
+// The arena and table a restore replaced, kept until link_arena_restore_end()
+static char* prev_arena = NULL;
+static uint32_t* prev_slots = NULL;
+static size_t prev_len = 0, prev_cap = 0, prev_live = 0, prev_slot_count = 0, prev_slot_used = 0;
+
+bool link_arena_restore(const char* bytes, size_t len) {
+  size_t entries = 0;
+  for (size_t i = 0; i < len; i += entry_len(bytes + i) + 5, entries++) {
+    if (len - i < 5 || entry_len(bytes + i) > len - i - 5 || bytes[i + 4 + entry_len(bytes + i)] != '\0') return false;
+  }
+
+  size_t count = 256;
+  while (entries * 2 >= count) count *= 2;
+  char* copy = malloc(len ? len : 1);
+  uint32_t* table = calloc(count, sizeof(*table));
+  if (!copy || !table) {
+    free(copy);
+    free(table);
+    return false;
+  }
+  memcpy(copy, bytes, len);
+
+  for (size_t i = 0; i < len; i += entry_len(copy + i) + 5) {
+    size_t k = hash_bytes(copy + i + 4, entry_len(copy + i)) & (count - 1);
+    while (table[k]) k = (k + 1) & (count - 1);
+    table[k] = i + 1;
+  }
+
+  prev_arena = arena;
+  prev_len = arena_len;
+  prev_cap = arena_cap;
+  prev_live = arena_live;
+  prev_slots = slots;
+  prev_slot_count = slot_count;
+  prev_slot_used = slot_used;
+  arena = copy;
+  arena_len = arena_cap = arena_live = len;
+  slots = table;
+  slot_count = count;
+  slot_used = entries;
+  return true;
+}
+
+bool link_id_valid(uint32_t id) {
+  if (!id) return true;
+  size_t at = id - 1;
+  if (at >= arena_len || arena_len - at < 5 || entry_len(arena + at) > arena_len - at - 5) return false;
+
+  // only the start of an entry is an id, and every start is in the table
+  size_t k = hash_bytes(arena + at + 4, entry_len(arena + at)) & (slot_count - 1);
+  for (; slots[k]; k = (k + 1) & (slot_count - 1)) {
+    if (slots[k] == id) return true;
+  }
+  return false;
+}
+
+void link_arena_restore_end(bool keep) {
+  if (keep) {
+    free(prev_arena);
+    free(prev_slots);
+  } else {
+    free(arena);
+    free(slots);
+    arena = prev_arena;
+    arena_len = prev_len;
+    arena_cap = prev_cap;
+    arena_live = prev_live;
+    slots = prev_slots;
+    slot_count = prev_slot_count;
+    slot_used = prev_slot_used;
+  }
+  prev_arena = NULL;
+  prev_slots = NULL;
+}
+
+typedef struct {
+  uint64_t gen;  // 0 marks an empty entry
+  uint8_t count;
+  LinkSpan spans[LINK_SPANS_PER_ROW];
+} LinkRow;
+
+static LinkRow cache[LINK_CACHE_ROWS];
+
+static LinkRow* cache_entry(uint64_t gen) { return &cache[(gen * 0x9E3779B97F4A7C15ull) >> 54]; }
+
+int links_cached(uint64_t gen, const LinkSpan** spans) {
+  LinkRow* row = cache_entry(gen);
+  if (row->gen != gen || !gen) return -1;
+  *spans = row->spans;
+  return row->count;
+}
+
+static bool is_alpha(uint32_t c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+static bool is_digit(uint32_t c) { return c >= '0' && c <= '9'; }
+static bool is_alnum(uint32_t c) { return is_alpha(c) || is_digit(c); }
+
+static bool is_url_char(uint32_t c) {
+  if (c >= 0x80) return true;
+  return c > 0x20 && c < 0x7F && !strchr("<>\"'`{}|\\^", (int)c);
+}
+
+static bool is_path_char(uint32_t c) { return is_alnum(c) || (c && c < 0x80 && strchr("_-./~+@", (int)c)); }
+
+static const char* const schemes[] = {"https://", "http://", "file://", "ftp://", "ssh://", "git://", "mailto:"};
+
+// Length of the scheme starting at text[i], 0 if none does
+static int match_scheme(const uint32_t* text, int i, int n) {
+  for (size_t s = 0; s < sizeof(schemes) / sizeof(schemes[0]); s++) {
+    int k = 0;
+    while (schemes[s][k] && i + k < n && text[i + k] == (unsigned char)schemes[s][k]) k++;
+    if (!schemes[s][k]) return k;
+  }
+  return 0;
+}
+
+// End (exclusive) of a URL whose scheme ends at i. Trailing punctuation and
+// closing brackets without an opening one in the URL belong to the prose.
+static int url_end(const uint32_t* text, int i, int n) {
+  int end = i, parens = 0, brackets = 0;
+  while (end < n && is_url_char(text[end])) {
+    uint32_t c = text[end];
+    if (c == '(') parens++;
+    if (c == '[') brackets++;
+    if ((c == ')' && --parens < 0) || (c == ']' && --brackets < 0)) break;
+    end++;
+  }
+  while (end > i && strchr(".,:;!?", (int)(text[end - 1] < 0x80 ? text[end - 1] : 'x'))) end--;
+  return end;
+}
+
+// End (exclusive) of "path:line[:col]" starting at i, or 0. The path needs a
+// letter and a '/' or an extension, so times and ratios don't match.
+static int file_ref_end(const uint32_t* text, int i, int n) {
+  int end = i;
+  bool letter = false, slash = false, dot = false;
+  while (end < n && is_path_char(text[end])) {
+    if (is_alpha(text[end])) letter = true;
+    if (text[end] == '/') slash = true;
+    if (text[end] == '.' && end + 1 < n && is_alnum(text[end + 1])) dot = true;
+    end++;
+  }
+  if (!letter || !(slash || dot)) return 0;
+  if (end + 1 >= n || text[end] != ':' || !is_digit(text[end + 1])) return 0;
+
+  end++;
+  while (end < n && is_digit(text[end])) end++;
+  if (end + 1 < n && text[end] == ':' && is_digit(text[end + 1])) {
+    end++;
+    while (end < n && is_digit(text[end])) end++;
+  }
+  return end;
+}
+
+int links_scan(uint64_t gen, const uint32_t* text, int n, const LinkSpan** spans) {
+  LinkRow* row = cache_entry(gen);
+  row->gen = gen;
+  row->count = 0;
+
+  int i = 0;
+  while (i < n && row->count < LINK_SPANS_PER_ROW) {
+    // only look for a link at the start of a word
+    if (i > 0 && is_alnum(text[i - 1])) {
+      i++;
+      continue;
+    }
+
+    int scheme = is_alpha(text[i]) ? match_scheme(text, i, n) : 0;
+    int end = scheme ? url_end(text, i + scheme, n) : 0;
+    if (end > i + scheme) {
+      row->spans[row->count++] = (LinkSpan){i, end - 1, LINK_URL};
+      i = end;
+      continue;
+    }
+
+    end = is_path_char(text[i]) ? file_ref_end(text, i, n) : 0;
+    if (end) {
+      row->spans[row->count++] = (LinkSpan){i, end - 1, LINK_FILE};
+      i = end;
+      continue;
+    }
+
+    // skip the rest of this token
+    while (i < n && is_path_char(text[i])) i++;
+    if (i < n && !is_path_char(text[i])) i++;
+  }
+
+  *spans = row->spans;
+  return row->count;
+}
@@ -0,0 +1,38 @@
+#ifndef LINKS_H
+#define LINKS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// OSC 8 hyperlink targets, interned in an arena the same way as grapheme
+// clusters. Cells hold the id, 0 for none; link_gc_* rebuilds the arena from
+// the ids still referenced.
+uint32_t link_intern(const char* uri, size_t len);
+const char* link_uri(uint32_t id, size_t* len);
+bool link_needs_gc(void);
+void link_gc_begin(void);
+uint32_t link_gc_keep(uint32_t id);
+void link_gc_end(void);
+const char* link_arena(size_t* len);  // for snapshots, restoring keeps every id valid
+bool link_arena_restore(const char* bytes, size_t len);  // undone like cluster_arena_restore()
+bool link_id_valid(uint32_t id);
+void link_arena_restore_end(bool keep);
+
+// Links found in the plain text of a row. Results are cached by the row's
+// content generation, so a row is only scanned again after it changes.
+#define LINK_SPANS_PER_ROW 8
+
+typedef enum { LINK_URL, LINK_FILE } LinkKind;
+
+typedef struct {
+  int16_t x0, x1;  // columns, both inclusive
+  uint8_t kind;
+} LinkSpan;
+
+// Returns the cached span count for gen, or -1 if the row must be scanned
+int links_cached(uint64_t gen, const LinkSpan** spans);
+// Scans text (one codepoint per column, 0 for blank cells) and caches the result under gen
+int links_scan(uint64_t gen, const uint32_t* text, int n, const LinkSpan** spans);
+
+#endif
@@ -0,0 +1,100 @@
+#include "marks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Live marks are marks[head, count). Forgotten ones are only moved out of the
+// way once they make up half the array.
+static PromptMark* marks = NULL;
+static size_t head = 0, count = 0, cap = 0;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Index of the first live mark with a prompt below line
+static size_t upper_bound(int64_t line) {
+  size_t lo = head, hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (marks[mid].prompt <= line) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static PromptMark* newest(void) { return count > head ? &marks[count - 1] : NULL; }
+
+void marks_prompt(int64_t line) {
+  marks_delete_from(line);
+
+  if (count == cap) {
+    size_t grown_cap = cap ? cap * 2 : 64;
+    PromptMark* grown = realloc(marks, grown_cap * sizeof(*marks));
+    if (!grown) {
+      perror("marks_prompt");
+      return;
+    }
+    marks = grown;
+    cap = grown_cap;
+  }
+  marks[count++] = (PromptMark){.prompt = line, .output = -1, .end = -1, .status = -1, .duration = -1};
+}
+
+void marks_output(int64_t line, int col) {
+  PromptMark* m = newest();
+  if (!m || line < m->prompt) return;
+  m->output = line;
+  m->output_col = col;
+  m->end = -1;
+  m->started = now_seconds();
+}
+
+void marks_finish(int64_t line, int col, int status) {
+  PromptMark* m = newest();
+  if (!m || m->end >= 0 || line < m->prompt) return;
+  m->end = line;
+  m->end_col = col;
+  m->status = status;
+  if (m->output >= 0) m->duration = now_seconds() - m->started;
+}
+
+void marks_delete_from(int64_t line) {
+  while (count > head && marks[count - 1].prompt >= line) count--;
+}
+
+void marks_forget_before(int64_t oldest) {
+  // a command stays while any of its lines are left, which is up to the next prompt
+  size_t first = upper_bound(oldest);
+  if (first > head) head = first - 1;
+
+  if (head > 0 && head >= count / 2) {
+    memmove(marks, marks + head, (count - head) * sizeof(*marks));
+    count -= head;
+    head = 0;
+  }
+}
+
+const PromptMark* marks_at(int64_t line) {
+  size_t i = upper_bound(line);
+  return i > head ? &marks[i - 1] : NULL;
+}
+
+const PromptMark* marks_after(int64_t line) {
+  size_t i = upper_bound(line);
+  return i < count ? &marks[i] : NULL;
+}
+
+const PromptMark* marks_output_at(int64_t line) {
+  for (size_t i = upper_bound(line); i > head; i--) {
+    if (marks[i - 1].output >= 0) return &marks[i - 1];
+  }
+  return NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef MARKS_H
+#define MARKS_H
+
+#include <stdint.h>
+
+// Shell integration marks (OSC 133), one per command: where its prompt was
+// drawn, where its output started and ended, its exit status and how long it
+// ran. Lines are absolute, as for history. Prompts only ever appear below the
+// previous one, so marks are appended in order and every lookup is a binary
+// search, however long the history.
+typedef struct {
+  int64_t prompt;          // line of OSC 133;A
+  int64_t output, end;     // OSC 133;C and ;D positions, -1 until seen
+  int output_col, end_col;  // end is exclusive
+  int status;              // from ;D, -1 when not given
+  double started;          // monotonic seconds at ;C
+  double duration;         // -1 while running or without ;C
+} PromptMark;
+
+// A prompt at line drops any marks at or below it, output redrawn over them
+void marks_prompt(int64_t line);
+void marks_output(int64_t line, int col);
+void marks_finish(int64_t line, int col, int status);
+void marks_delete_from(int64_t line);
+void marks_forget_before(int64_t oldest);
+
+const PromptMark* marks_at(int64_t line);        // the command line belongs to, NULL above the first prompt
+const PromptMark* marks_after(int64_t line);     // the first prompt below line
+const PromptMark* marks_output_at(int64_t line);  // like marks_at, skipping commands without output
+
+#endif
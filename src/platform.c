@@ -1,5 +1,15 @@
 #include "platform.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <libproc.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 void platform_set_gl_hints(void) {
 #ifdef __APPLE__
@@ -19,6 +29,10 @@ bool platform_init_gl(void) {
   // (macOS links OpenGL framework directly, doesn't need GLEW)
   glewExperimental = GL_TRUE;
   GLenum glew_err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  // A headless EGL context has no X display, the GL entry points still loaded
+  if (glew_err == GLEW_ERROR_NO_GLX_DISPLAY) glew_err = GLEW_OK;
+#endif
   if (glew_err != GLEW_OK) {
     return false;
   }
@@ -26,6 +40,64 @@ bool platform_init_gl(void) {
   return true;
 }
 
+#ifndef __APPLE__
+static EGLDisplay headless_display = EGL_NO_DISPLAY;
+static EGLContext headless_context = EGL_NO_CONTEXT;
+#endif
+
+// Current GL 3.3 context without a window or display server (Mesa's surfaceless
+// EGL platform, llvmpipe when there is no GPU), render into a framebuffer object
+bool platform_create_headless_gl(void) {
+#ifdef __APPLE__
+  fprintf(stderr, "Headless rendering needs EGL\n");
+  return false;
+#else
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (!get_platform_display) {
+    fprintf(stderr, "EGL: eglGetPlatformDisplayEXT unavailable\n");
+    return false;
+  }
+  headless_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  EGLint major, minor;
+  if (headless_display == EGL_NO_DISPLAY || !eglInitialize(headless_display, &major, &minor)) {
+    fprintf(stderr, "EGL: no surfaceless display (0x%x)\n", eglGetError());
+    return false;
+  }
+
+  // EGL_SURFACE_TYPE defaults to windows, which the surfaceless platform has none of
+  const EGLint config_attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config;
+  EGLint configs = 0;
+  if (!eglChooseConfig(headless_display, config_attribs, &config, 1, &configs) || configs < 1) {
+    fprintf(stderr, "EGL: no OpenGL config\n");
+    return false;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+  const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+  headless_context = eglCreateContext(headless_display, config, EGL_NO_CONTEXT, context_attribs);
+  if (headless_context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless_context)) {
+    fprintf(stderr, "EGL: could not make a surfaceless 3.3 context current (0x%x)\n", eglGetError());
+    return false;
+  }
+  return true;
+#endif
+}
+
+void platform_destroy_headless_gl(void) {
+#ifndef __APPLE__
+  if (headless_display == EGL_NO_DISPLAY) return;
+  eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (headless_context != EGL_NO_CONTEXT) eglDestroyContext(headless_display, headless_context);
+  eglTerminate(headless_display);
+  headless_display = EGL_NO_DISPLAY;
+  headless_context = EGL_NO_CONTEXT;
+#endif
+}
+
 const char** platform_get_font_paths(void) {
   static const char* font_paths[] = {
 #ifdef __APPLE__
@@ -46,3 +118,69 @@ const char** platform_get_font_paths(void) {
   };
   return font_paths;
 }
+
+const char** platform_get_fallback_font_paths(void) {
+  static const char* font_paths[] = {
+#ifdef __APPLE__
+      "/System/Library/Fonts/Menlo.ttc",
+      "/System/Library/Fonts/Apple Symbols.ttf",
+      "/System/Library/Fonts/Supplemental/Arial Unicode.ttf",
+      "/System/Library/Fonts/Hiragino Sans GB.ttc",
+#else
+      // Arch
+      "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+      "/usr/share/fonts/TTF/DejaVuSans.ttf",
+      "/usr/share/fonts/noto/NotoSansMono-Regular.ttf",
+      "/usr/share/fonts/noto/NotoSansSymbols-Regular.ttf",
+      "/usr/share/fonts/noto/NotoSansSymbols2-Regular.ttf",
+      "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc",
+      // Debian/Ubuntu
+      "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+      "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf",
+      "/usr/share/fonts/truetype/noto/NotoSansMono-Regular.ttf",
+      "/usr/share/fonts/truetype/noto/NotoSansSymbols-Regular.ttf",
+      "/usr/share/fonts/truetype/noto/NotoSansSymbols2-Regular.ttf",
+      "/usr/share/fonts/opentype/noto/NotoSansCJK-Regular.ttc",
+#endif
+      NULL
+  };
+  return font_paths;
+}
+
+// Working directory of another process, used to resolve relative paths it printed
+bool platform_process_cwd(int pid, char* out, size_t size) {
+  if (pid <= 0 || size == 0) return false;
+#ifdef __APPLE__
+  struct proc_vnodepathinfo info;
+  if (proc_pidinfo(pid, PROC_PIDVNODEPATHINFO, 0, &info, sizeof(info)) != sizeof(info)) return false;
+  snprintf(out, size, "%s", info.pvi_cdir.vip_path);
+  return true;
+#else
+  char proc[64];
+  snprintf(proc, sizeof(proc), "/proc/%d/cwd", pid);
+  ssize_t n = readlink(proc, out, size - 1);
+  if (n < 0) return false;
+  out[n] = '\0';
+  return true;
+#endif
+}
+
+// Hands a URL or path to the desktop's opener without waiting for it
+void platform_open_link(const char* target) {
+#ifdef __APPLE__
+  const char* opener = "open";
+#else
+  const char* opener = "xdg-open";
+#endif
+
+  // the intermediate child exits at once so the opener is never left a zombie
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (fork() == 0) {
+      execlp(opener, opener, target, (char*)NULL);
+      _exit(127);
+    }
+    _exit(0);
+  }
+  if (pid > 0) waitpid(pid, NULL, 0);
+}
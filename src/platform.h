@@ -2,6 +2,7 @@
 #define PLATFORM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __APPLE__
 #include <util.h>
@@ -17,6 +18,11 @@
 // Platform abstraction - hides all #ifdef __APPLE__ from main code
 void platform_set_gl_hints(void);
 bool platform_init_gl(void);
+bool platform_create_headless_gl(void);
+void platform_destroy_headless_gl(void);
 const char** platform_get_font_paths(void);
+const char** platform_get_fallback_font_paths(void);  // for what the monospace font lacks, most useful first
+bool platform_process_cwd(int pid, char* out, size_t size);
+void platform_open_link(const char* target);
 
 #endif // PLATFORM_H
@@ -0,0 +1,331 @@
+#define _DEFAULT_SOURCE  // syscall() is outside POSIX
+#include "ptyio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+static int pty_fd = -1;
+
+#ifdef __linux__
+#define RING_ENTRIES 16
+#define BUFFER_COUNT 64    // power of two, the size of the provided buffer ring
+#define BUFFER_SIZE 4096   // a PTY master hands over at most this much per read
+#define BUFFER_GROUP 0
+#define TAG_READ 1
+#define TAG_WRITE 2
+#define OP_READ_MULTISHOT 49  // IORING_OP_READ_MULTISHOT, Linux 6.7, newer than some headers
+
+// A buffer the kernel filled and the parser hasn't fully taken yet
+typedef struct {
+  uint16_t bid;
+  uint16_t off, len;
+} Filled;
+
+static bool uring = false;
+static int ring_fd = -1;
+
+static struct {
+  uint32_t *head, *tail, *array;
+  uint32_t mask;
+} sq;
+static struct {
+  uint32_t *head, *tail;
+  uint32_t mask;
+  struct io_uring_cqe* cqes;
+} cq;
+static struct io_uring_sqe* sqes = NULL;
+static void* sq_map = NULL;
+static void* cq_map = NULL;
+static size_t sq_map_len, cq_map_len, sqes_len;
+
+static struct io_uring_buf_ring* buf_ring = NULL;
+static char* buffers = NULL;
+static Filled filled[BUFFER_COUNT];
+static uint32_t filled_head = 0, filled_count = 0;
+
+static bool multishot = true;  // until the kernel turns it down, then one read at a time
+static bool starved = false;   // the read stopped for lack of buffers, re-armed as they come back
+static bool hung_up = false;
+static bool wrote = false;     // a write completed since the last wait
+static void (*write_done)(ssize_t) = NULL;
+
+static int uring_enter(unsigned submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, ring_fd, submit, min_complete, flags, arg, argsz);
+}
+
+static uint32_t sq_pending(void) { return *sq.tail - __atomic_load_n(sq.head, __ATOMIC_ACQUIRE); }
+
+// Submitted with the next io_uring_enter
+static bool push_sqe(const struct io_uring_sqe* sqe) {
+  if (sq_pending() > sq.mask) return false;
+  uint32_t tail = *sq.tail;
+  sqes[tail & sq.mask] = *sqe;
+  sq.array[tail & sq.mask] = tail & sq.mask;
+  __atomic_store_n(sq.tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Multishot keeps filling buffers until they run out, single reads are
+// re-armed as each one completes
+static void arm_read(void) {
+  struct io_uring_sqe sqe = {0};
+  sqe.opcode = multishot ? OP_READ_MULTISHOT : IORING_OP_READ;
+  sqe.fd = pty_fd;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = BUFFER_GROUP;
+  sqe.len = multishot ? 0 : BUFFER_SIZE;
+  sqe.user_data = TAG_READ;
+  push_sqe(&sqe);
+}
+
+// Field by field, the first entry shares its last bytes with the ring's tail
+static void give_buffer(uint16_t bid) {
+  uint16_t tail = buf_ring->tail;
+  struct io_uring_buf* b = &buf_ring->bufs[tail & (BUFFER_COUNT - 1)];
+  b->addr = (uintptr_t)(buffers + (size_t)bid * BUFFER_SIZE);
+  b->len = BUFFER_SIZE;
+  b->bid = bid;
+  __atomic_store_n(&buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static void complete_read(int32_t res, uint32_t flags) {
+  if (flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0) {
+      filled[(filled_head + filled_count++) % BUFFER_COUNT] = (Filled){.bid = bid, .len = res};
+    } else {
+      give_buffer(bid);
+    }
+  }
+  if (flags & IORING_CQE_F_MORE) return;
+
+  if (res == -EINVAL && multishot) {
+    multishot = false;
+    arm_read();
+  } else if (res == -ENOBUFS) {
+    starved = true;
+  } else if (res > 0 || res == -EINTR || res == -EAGAIN) {
+    arm_read();
+  } else {
+    hung_up = true;  // end of file or EIO, the child side is gone
+  }
+}
+
+static void reap(void) {
+  uint32_t head = *cq.head;
+  uint32_t tail = __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe* cqe = &cq.cqes[head & cq.mask];
+    if (cqe->user_data == TAG_WRITE) {
+      wrote = true;
+      if (write_done) write_done(cqe->res);
+    } else {
+      complete_read(cqe->res, cqe->flags);
+    }
+  }
+  __atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+}
+
+static void teardown(void) {
+  if (sqes) munmap(sqes, sqes_len);
+  if (cq_map && cq_map != sq_map) munmap(cq_map, cq_map_len);
+  if (sq_map) munmap(sq_map, sq_map_len);
+  if (ring_fd >= 0) close(ring_fd);  // unregisters the buffer ring with it
+  free(buf_ring);
+  free(buffers);
+  sqes = NULL;
+  sq_map = cq_map = NULL;
+  ring_fd = -1;
+  buf_ring = NULL;
+  buffers = NULL;
+  uring = false;
+}
+
+// Needs timed waits (Linux 5.11) and provided buffer rings (5.19)
+static bool setup(void) {
+  // Room for a completion per buffer, a multishot read stops when the CQ overflows
+  struct io_uring_params p = {.flags = IORING_SETUP_CQSIZE, .cq_entries = 2 * BUFFER_COUNT};
+  ring_fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+  if (ring_fd < 0 || !(p.features & IORING_FEAT_EXT_ARG)) return false;
+
+  sq_map_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && cq_map_len > sq_map_len) sq_map_len = cq_map_len;
+
+  sq_map = mmap(NULL, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_map == MAP_FAILED) {
+    sq_map = NULL;
+    return false;
+  }
+  cq_map = single_mmap ? sq_map : mmap(NULL, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, IORING_OFF_CQ_RING);
+  if (cq_map == MAP_FAILED) {
+    cq_map = NULL;
+    return false;
+  }
+  sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    sqes = NULL;
+    return false;
+  }
+
+  char* s = sq_map;
+  sq.head = (uint32_t*)(s + p.sq_off.head);
+  sq.tail = (uint32_t*)(s + p.sq_off.tail);
+  sq.array = (uint32_t*)(s + p.sq_off.array);
+  sq.mask = *(uint32_t*)(s + p.sq_off.ring_mask);
+  char* c = cq_map;
+  cq.head = (uint32_t*)(c + p.cq_off.head);
+  cq.tail = (uint32_t*)(c + p.cq_off.tail);
+  cq.mask = *(uint32_t*)(c + p.cq_off.ring_mask);
+  cq.cqes = (struct io_uring_cqe*)(c + p.cq_off.cqes);
+
+  void* ring_mem = NULL;
+  if (posix_memalign(&ring_mem, 4096, BUFFER_COUNT * sizeof(struct io_uring_buf)) != 0) return false;
+  buf_ring = ring_mem;
+  memset(buf_ring, 0, BUFFER_COUNT * sizeof(struct io_uring_buf));
+  buffers = malloc((size_t)BUFFER_COUNT * BUFFER_SIZE);
+  if (!buffers) return false;
+
+  struct io_uring_buf_reg reg = {.ring_addr = (uintptr_t)buf_ring, .ring_entries = BUFFER_COUNT, .bgid = BUFFER_GROUP};
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) return false;
+  for (uint16_t bid = 0; bid < BUFFER_COUNT; bid++) give_buffer(bid);
+
+  // On a non-blocking fd every read that finds nothing completes with EAGAIN
+  // instead of waiting in the kernel. The ring never blocks this thread anyway.
+  int fl = fcntl(pty_fd, F_GETFL);
+  if (fl != -1) fcntl(pty_fd, F_SETFL, fl & ~O_NONBLOCK);
+
+  arm_read();
+  uring = true;
+  return true;
+}
+
+static int uring_wait(int timeout_ms) {
+  reap();
+  if (filled_count == 0 && timeout_ms != 0) {
+    struct __kernel_timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = (long long)(timeout_ms % 1000) * 1000000};
+    struct io_uring_getevents_arg arg = {.sigmask_sz = _NSIG / 8, .ts = (uintptr_t)&ts};
+    uring_enter(sq_pending(), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    reap();
+  } else if (sq_pending() > 0) {
+    uring_enter(sq_pending(), 0, 0, NULL, 0);
+  }
+
+  int ready = (filled_count > 0 ? PTYIO_READ : 0) | (wrote ? PTYIO_WRITE : 0);
+  wrote = false;
+  return ready;
+}
+
+static ssize_t uring_read(char* dst, size_t len) {
+  if (filled_count == 0) reap();
+
+  size_t n = 0;
+  while (filled_count > 0 && n < len) {
+    Filled* f = &filled[filled_head];
+    size_t take = f->len - f->off;
+    if (take > len - n) take = len - n;
+    memcpy(dst + n, buffers + (size_t)f->bid * BUFFER_SIZE + f->off, take);
+    n += take;
+    f->off += take;
+    if (f->off == f->len) {
+      give_buffer(f->bid);
+      filled_head = (filled_head + 1) % BUFFER_COUNT;
+      filled_count--;
+    }
+  }
+
+  if (starved && filled_count < BUFFER_COUNT) {
+    starved = false;
+    arm_read();
+  }
+  if (n > 0) return n;
+  if (hung_up) return 0;
+  errno = EAGAIN;
+  return -1;
+}
+#endif
+
+void ptyio_init(int fd, bool try_uring) {
+  pty_fd = fd;
+#ifdef __linux__
+  if (fd >= 0 && try_uring && !setup()) teardown();
+#else
+  (void)try_uring;
+#endif
+}
+
+bool ptyio_uring_active(void) {
+#ifdef __linux__
+  return uring;
+#else
+  return false;
+#endif
+}
+
+int ptyio_wait(int timeout_ms, bool want_write) {
+#ifdef __linux__
+  if (uring) return uring_wait(timeout_ms);
+#endif
+  struct pollfd pfd = {.fd = pty_fd, .events = POLLIN | (want_write ? POLLOUT : 0)};
+  if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+  return ((pfd.revents & POLLIN) ? PTYIO_READ : 0) | ((pfd.revents & POLLOUT) ? PTYIO_WRITE : 0);
+}
+
+bool ptyio_readable(void) {
+#ifdef __linux__
+  if (uring) {
+    if (filled_count == 0) reap();
+    return filled_count > 0;
+  }
+#endif
+  struct pollfd pfd = {.fd = pty_fd, .events = POLLIN};
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+ssize_t ptyio_read(char* dst, size_t len) {
+#ifdef __linux__
+  if (uring) return uring_read(dst, len);
+#endif
+  return read(pty_fd, dst, len);
+}
+
+bool ptyio_writev(const struct iovec* iov, int niov, void (*done)(ssize_t written)) {
+#ifdef __linux__
+  if (!uring) return false;
+  struct io_uring_sqe sqe = {0};
+  sqe.opcode = IORING_OP_WRITEV;
+  sqe.fd = pty_fd;
+  sqe.addr = (uintptr_t)iov;
+  sqe.len = niov;
+  sqe.user_data = TAG_WRITE;
+  if (!push_sqe(&sqe)) return false;
+  write_done = done;
+  return true;
+#else
+  (void)iov;
+  (void)niov;
+  (void)done;
+  return false;
+#endif
+}
+
+void ptyio_shutdown(void) {
+#ifdef __linux__
+  teardown();
+#endif
+  pty_fd = -1;
+}
@@ -0,0 +1,33 @@
+#ifndef PTYIO_H
+#define PTYIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// PTY master I/O. On Linux an io_uring keeps a read armed on the master at
+// all times, filling buffers from a provided buffer ring, and carries the
+// write queue's writes, so a busy PTY costs one io_uring_enter per loop
+// instead of a poll plus a read per chunk. Without io_uring (other systems,
+// old kernels, disabled by policy) it is plain poll() and read().
+#define PTYIO_READ 1
+#define PTYIO_WRITE 2
+
+void ptyio_init(int fd, bool try_uring);
+bool ptyio_uring_active(void);
+
+// Blocks up to timeout_ms for input, or room to write when want_write.
+// Returns PTYIO_READ / PTYIO_WRITE bits, 0 on timeout.
+int ptyio_wait(int timeout_ms, bool want_write);
+
+bool ptyio_readable(void);                 // input is waiting, never blocks
+ssize_t ptyio_read(char* dst, size_t len);  // read() semantics, -1 with EAGAIN when nothing is waiting
+
+// io_uring only: queues a writev, submitted with the next wait. iov must stay
+// valid until done runs with the bytes written or -errno.
+bool ptyio_writev(const struct iovec* iov, int niov, void (*done)(ssize_t written));
+
+void ptyio_shutdown(void);
+
+#endif
@@ -0,0 +1,326 @@
+#include "raster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define TILE_SIZE 32  // pixels per side of a damage tile
+
+typedef struct {
+  int x, y, w, h;           // unclipped box in pixels
+  uint32_t color;
+  int stride;               // coverage or image row stride, 0 for a solid rect
+  const uint8_t* coverage;  // NULL for a solid rect
+  const uint8_t* image;     // RGBA, scaled from src_* onto the box
+  int src_x, src_y, src_w, src_h;
+} RasterCmd;
+
+static uint32_t* pixels = NULL;
+static int fb_width = 0, fb_height = 0;
+static uint32_t clear_color = 0;
+
+static RasterCmd* cmds = NULL;
+static size_t cmd_count = 0, cmd_cap = 0;
+
+// Hash of the commands touching each tile, this frame and last frame
+static uint64_t* tile_hash = NULL;
+static uint64_t* prev_hash = NULL;
+static uint8_t* tile_dirty = NULL;
+static int tiles_x = 0, tiles_y = 0;
+static int dirty_tiles = 0;
+static bool full_damage = true;
+
+bool raster_begin(int width, int height, uint32_t clear) {
+  cmd_count = 0;
+  if (width <= 0 || height <= 0) return false;
+
+  if (width != fb_width || height != fb_height) {
+    int tx = (width + TILE_SIZE - 1) / TILE_SIZE, ty = (height + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t* grown = realloc(pixels, (size_t)width * height * sizeof(*pixels));
+    if (!grown) return false;
+    pixels = grown;
+
+    free(tile_hash);
+    free(prev_hash);
+    free(tile_dirty);
+    tile_hash = calloc((size_t)tx * ty, sizeof(*tile_hash));
+    prev_hash = calloc((size_t)tx * ty, sizeof(*prev_hash));
+    tile_dirty = calloc((size_t)tx * ty, 1);
+    if (!tile_hash || !prev_hash || !tile_dirty) {
+      fb_width = fb_height = 0;
+      return false;
+    }
+
+    fb_width = width;
+    fb_height = height;
+    tiles_x = tx;
+    tiles_y = ty;
+    full_damage = true;
+  }
+
+  if (clear != clear_color) full_damage = true;
+  clear_color = clear;
+  return true;
+}
+
+static void push_cmd(RasterCmd cmd) {
+  if (cmd.w <= 0 || cmd.h <= 0 || !fb_width) return;
+  if (cmd.x >= fb_width || cmd.y >= fb_height || cmd.x + cmd.w <= 0 || cmd.y + cmd.h <= 0) return;
+
+  if (cmd_count == cmd_cap) {
+    size_t cap = cmd_cap ? cmd_cap * 2 : 4096;
+    RasterCmd* grown = realloc(cmds, cap * sizeof(*cmds));
+    if (!grown) return;
+    cmds = grown;
+    cmd_cap = cap;
+  }
+  cmds[cmd_count++] = cmd;
+}
+
+void raster_rect(int x, int y, int w, int h, uint32_t color) {
+  push_cmd((RasterCmd){.x = x, .y = y, .w = w, .h = h, .color = color});
+}
+
+void raster_glyph(int x, int y, int w, int h, const uint8_t* coverage, int stride, uint32_t color) {
+  push_cmd((RasterCmd){.x = x, .y = y, .w = w, .h = h, .color = color, .stride = stride, .coverage = coverage});
+}
+
+void raster_image(int x, int y, int w, int h, const uint8_t* rgba, int stride, int src_x, int src_y, int src_w,
+                  int src_h, uint32_t serial) {
+  push_cmd((RasterCmd){.x = x, .y = y, .w = w, .h = h, .color = serial, .stride = stride, .image = rgba,
+                       .src_x = src_x, .src_y = src_y, .src_w = src_w, .src_h = src_h});
+}
+
+void raster_invalidate(void) { full_damage = true; }
+
+static uint64_t cmd_hash(const RasterCmd* c) {
+  uint64_t v[7] = {(uint64_t)(uint32_t)c->x << 32 | (uint32_t)c->y, (uint64_t)(uint32_t)c->w << 32 | (uint32_t)c->h,
+                   c->color, (uint64_t)(uintptr_t)c->coverage, (uint64_t)(uint32_t)c->stride,
+                   (uint64_t)(uintptr_t)c->image, (uint64_t)(uint32_t)c->src_x << 32 | (uint32_t)c->src_y};
+  uint64_t h = 1469598103934665603ull;
+  for (int i = 0; i < 7; i++) h = (h ^ v[i]) * 1099511628211ull;
+  return h;
+}
+
+// Tiles overlapped by a command, inclusive
+static void cmd_tiles(const RasterCmd* c, int* tx0, int* ty0, int* tx1, int* ty1) {
+  int x0 = c->x < 0 ? 0 : c->x, y0 = c->y < 0 ? 0 : c->y;
+  int x1 = c->x + c->w > fb_width ? fb_width : c->x + c->w;
+  int y1 = c->y + c->h > fb_height ? fb_height : c->y + c->h;
+  *tx0 = x0 / TILE_SIZE;
+  *ty0 = y0 / TILE_SIZE;
+  *tx1 = (x1 - 1) / TILE_SIZE;
+  *ty1 = (y1 - 1) / TILE_SIZE;
+}
+
+static void fill_span(uint32_t* dst, int n, uint32_t color) {
+  for (int i = 0; i < n; i++) dst[i] = color;
+}
+
+// dst = (color * a + dst * (255 - a)) / 255 per channel, rounded. The vector
+// paths compute exactly the same integers as the scalar tail.
+static inline uint32_t blend_channel(uint32_t s, uint32_t d, uint32_t a) {
+  uint32_t t = s * a + d * (255 - a) + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static void blend_span(uint32_t* dst, const uint8_t* cov, int n, uint32_t color) {
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+  __m128i c255 = _mm_set1_epi16(255), c128 = _mm_set1_epi16(128);
+  for (; i + 4 <= n; i += 4) {
+    uint32_t a4;
+    memcpy(&a4, cov + i, 4);
+    if (a4 == 0) continue;
+    if (a4 == 0xFFFFFFFFu) {
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_set1_epi32((int)color));
+      continue;
+    }
+
+    // each pixel's coverage repeated over its four channels
+    __m128i a = _mm_cvtsi32_si128((int)a4);
+    a = _mm_unpacklo_epi8(a, a);
+    a = _mm_unpacklo_epi16(a, a);
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+
+    __m128i alo = _mm_unpacklo_epi8(a, zero), ahi = _mm_unpackhi_epi8(a, zero);
+    __m128i tlo = _mm_add_epi16(_mm_mullo_epi16(src, alo),
+                                _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(c255, alo)));
+    __m128i thi = _mm_add_epi16(_mm_mullo_epi16(src, ahi),
+                                _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(c255, ahi)));
+    tlo = _mm_add_epi16(tlo, c128);
+    thi = _mm_add_epi16(thi, c128);
+    tlo = _mm_srli_epi16(_mm_add_epi16(tlo, _mm_srli_epi16(tlo, 8)), 8);
+    thi = _mm_srli_epi16(_mm_add_epi16(thi, _mm_srli_epi16(thi, 8)), 8);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(tlo, thi));
+  }
+#elif defined(__ARM_NEON)
+  uint8x8_t src = vreinterpret_u8_u32(vdup_n_u32(color));
+  for (; i + 2 <= n; i += 2) {
+    if (!cov[i] && !cov[i + 1]) continue;
+    uint64_t a2 = cov[i] * 0x01010101ull | (uint64_t)cov[i + 1] * 0x0101010100000000ull;
+    uint8x8_t a = vcreate_u8(a2);
+    uint8x8_t d = vld1_u8((const uint8_t*)(dst + i));
+    uint16x8_t t = vaddq_u16(vmull_u8(src, a), vmull_u8(d, vsub_u8(vdup_n_u8(255), a)));
+    t = vaddq_u16(t, vdupq_n_u16(128));
+    vst1_u8((uint8_t*)(dst + i), vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8));
+  }
+#endif
+
+  for (; i < n; i++) {
+    uint32_t a = cov[i];
+    if (!a) continue;
+    uint32_t d = dst[i];
+    dst[i] = blend_channel(color >> 24, d >> 24, a) << 24 | blend_channel((color >> 16) & 0xFF, (d >> 16) & 0xFF, a) << 16 |
+             blend_channel((color >> 8) & 0xFF, (d >> 8) & 0xFF, a) << 8 | blend_channel(color & 0xFF, d & 0xFF, a);
+  }
+}
+
+// Nearest-neighbour scaled, blended with the image's own alpha
+static void image_span(uint32_t* dst, const RasterCmd* c, int x0, int x1, int y) {
+  const uint8_t* row = c->image + (size_t)(c->src_y + (int64_t)(y - c->y) * c->src_h / c->h) * c->stride;
+  for (int x = x0; x < x1; x++) {
+    const uint8_t* p = row + (size_t)(c->src_x + (int64_t)(x - c->x) * c->src_w / c->w) * 4;
+    uint32_t a = p[3], d = dst[x - x0];
+    if (!a) continue;
+    dst[x - x0] = 0xFF000000u | blend_channel(p[0], (d >> 16) & 0xFF, a) << 16 |
+                  blend_channel(p[1], (d >> 8) & 0xFF, a) << 8 | blend_channel(p[2], d & 0xFF, a);
+  }
+}
+
+// Draws the part of a command inside tile (tx, ty)
+static void draw_in_tile(const RasterCmd* c, int tx, int ty) {
+  int x0 = tx * TILE_SIZE, y0 = ty * TILE_SIZE;
+  int x1 = x0 + TILE_SIZE, y1 = y0 + TILE_SIZE;
+  if (x1 > fb_width) x1 = fb_width;
+  if (y1 > fb_height) y1 = fb_height;
+  if (c->x > x0) x0 = c->x;
+  if (c->y > y0) y0 = c->y;
+  if (c->x + c->w < x1) x1 = c->x + c->w;
+  if (c->y + c->h < y1) y1 = c->y + c->h;
+  if (x0 >= x1 || y0 >= y1) return;
+
+  for (int y = y0; y < y1; y++) {
+    uint32_t* dst = pixels + (size_t)y * fb_width + x0;
+    if (c->image) {
+      image_span(dst, c, x0, x1, y);
+    } else if (c->coverage) {
+      blend_span(dst, c->coverage + (size_t)(y - c->y) * c->stride + (x0 - c->x), x1 - x0, c->color);
+    } else {
+      fill_span(dst, x1 - x0, c->color);
+    }
+  }
+}
+
+bool raster_end(int* y0, int* y1) {
+  size_t ntiles = (size_t)tiles_x * tiles_y;
+  dirty_tiles = 0;
+  if (!fb_width) return false;
+
+  for (size_t t = 0; t < ntiles; t++) tile_hash[t] = clear_color;
+  for (size_t i = 0; i < cmd_count; i++) {
+    uint64_t h = cmd_hash(&cmds[i]);
+    int tx0, ty0, tx1, ty1;
+    cmd_tiles(&cmds[i], &tx0, &ty0, &tx1, &ty1);
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        uint64_t* th = &tile_hash[(size_t)ty * tiles_x + tx];
+        *th = (*th ^ h) * 1099511628211ull;
+      }
+    }
+  }
+
+  int first_row = tiles_y, last_row = -1;
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      size_t t = (size_t)ty * tiles_x + tx;
+      tile_dirty[t] = full_damage || tile_hash[t] != prev_hash[t];
+      if (!tile_dirty[t]) continue;
+      dirty_tiles++;
+      if (ty < first_row) first_row = ty;
+      last_row = ty;
+    }
+  }
+
+  uint64_t* swap = prev_hash;
+  prev_hash = tile_hash;
+  tile_hash = swap;
+  full_damage = false;
+  if (!dirty_tiles) return false;
+
+  for (int ty = first_row; ty <= last_row; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      if (!tile_dirty[(size_t)ty * tiles_x + tx]) continue;
+      draw_in_tile(&(RasterCmd){.x = tx * TILE_SIZE, .y = ty * TILE_SIZE, .w = TILE_SIZE, .h = TILE_SIZE, .color = clear_color},
+                   tx, ty);
+    }
+  }
+
+  for (size_t i = 0; i < cmd_count; i++) {
+    int tx0, ty0, tx1, ty1;
+    cmd_tiles(&cmds[i], &tx0, &ty0, &tx1, &ty1);
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        if (tile_dirty[(size_t)ty * tiles_x + tx]) draw_in_tile(&cmds[i], tx, ty);
+      }
+    }
+  }
+
+  *y0 = first_row * TILE_SIZE;
+  *y1 = (last_row + 1) * TILE_SIZE > fb_height ? fb_height : (last_row + 1) * TILE_SIZE;
+  return true;
+}
+
+const uint32_t* raster_pixels(void) { return pixels; }
+
+int raster_dirty_tiles(void) { return dirty_tiles; }
+
+bool raster_write_ppm(const char* path) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "P6\n%d %d\n255\n", fb_width, fb_height);
+  unsigned char* row = malloc((size_t)fb_width * 3 + 1);
+  for (int y = 0; row && y < fb_height; y++) {
+    const uint32_t* src = pixels + (size_t)y * fb_width;
+    for (int x = 0; x < fb_width; x++) {
+      row[x * 3 + 0] = (src[x] >> 16) & 0xFF;
+      row[x * 3 + 1] = (src[x] >> 8) & 0xFF;
+      row[x * 3 + 2] = src[x] & 0xFF;
+    }
+    fwrite(row, 3, fb_width, f);
+  }
+  free(row);
+
+  bool ok = row && !ferror(f);
+  if (fclose(f) != 0) ok = false;
+  if (!ok) fprintf(stderr, "%s: write failed\n", path);
+  return ok;
+}
+
+void raster_free(void) {
+  free(pixels);
+  free(cmds);
+  free(tile_hash);
+  free(prev_hash);
+  free(tile_dirty);
+  pixels = NULL;
+  cmds = NULL;
+  tile_hash = prev_hash = NULL;
+  tile_dirty = NULL;
+  fb_width = fb_height = 0;
+  cmd_count = cmd_cap = 0;
+  full_damage = true;
+}
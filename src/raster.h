@@ -0,0 +1,28 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// CPU renderer behind the window_draw_* calls. A frame is recorded as a list
+// of rects and glyphs; raster_end() clears and redraws only the tiles whose
+// commands differ from the previous frame's.
+// Colors and pixels are 0xAARRGGBB.
+bool raster_begin(int width, int height, uint32_t clear);
+void raster_rect(int x, int y, int w, int h, uint32_t color);
+// coverage is w x h alpha bytes, rows stride bytes apart; it must stay valid
+// and unchanged for as long as the same pointer is drawn
+void raster_glyph(int x, int y, int w, int h, const uint8_t* coverage, int stride, uint32_t color);
+// Scales the src rect of an RGBA image onto the box. The pixels must stay valid
+// and unchanged while serial is drawn; a new serial marks new pixels.
+void raster_image(int x, int y, int w, int h, const uint8_t* rgba, int stride, int src_x, int src_y, int src_w,
+                  int src_h, uint32_t serial);
+void raster_invalidate(void);  // redraw every tile at the next raster_end()
+// Returns whether any pixel may have changed, and the range of rows [y0, y1) that did
+bool raster_end(int* y0, int* y1);
+const uint32_t* raster_pixels(void);
+int raster_dirty_tiles(void);
+bool raster_write_ppm(const char* path);
+void raster_free(void);
+
+#endif
@@ -0,0 +1,223 @@
+#include "record.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// File layout, native byte order:
+//   RecordHeader, then per event a RecordEntry followed by len payload bytes.
+//   RECORD_OUTPUT payload is the raw PTY bytes, RECORD_RESIZE is two uint16_t (cols, rows).
+#define RECORD_MAGIC "ZREC"
+#define RECORD_VERSION 1
+#define RECORD_OUTPUT 'o'
+#define RECORD_RESIZE 'r'
+
+#define REPLAY_FRAME_NS 16666667ULL  // fast mode advances the clock by one 60 Hz frame per tick
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+} RecordHeader;
+
+typedef struct {
+  uint64_t time_ns;
+  uint32_t len;
+  uint8_t type;
+  uint8_t pad[3];
+} RecordEntry;
+
+static FILE* rec_file = NULL;
+static const char* rec_path = NULL;
+static uint64_t rec_start_ns = 0;
+static bool rec_failed = false;  // a write failed, the rest is dropped
+
+static const unsigned char* rp_data = NULL;
+static size_t rp_size = 0;
+static size_t rp_pos = 0;     // next RecordEntry
+static size_t rp_offset = 0;  // bytes of the current output entry already returned
+static bool rp_fast = false;
+static uint64_t rp_clock_ns = 0;
+static uint64_t rp_start_ns = 0;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record_write(uint8_t type, const void* data, uint32_t len) {
+  if (rec_failed) return;
+  RecordEntry e = {.time_ns = now_ns() - rec_start_ns, .len = len, .type = type};
+  if (fwrite(&e, sizeof(e), 1, rec_file) != 1 || fwrite(data, 1, len, rec_file) != len) rec_failed = true;
+}
+
+bool record_open(const char* path) {
+  rec_file = fopen(path, "wb");
+  if (!rec_file) {
+    perror(path);
+    return false;
+  }
+  setvbuf(rec_file, NULL, _IOFBF, 1 << 20);
+  rec_path = path;
+  rec_failed = false;
+
+  RecordHeader h = {.magic = RECORD_MAGIC, .version = RECORD_VERSION};
+  if (fwrite(&h, sizeof(h), 1, rec_file) != 1) rec_failed = true;
+  rec_start_ns = now_ns();
+  return true;
+}
+
+bool record_active(void) { return rec_file != NULL; }
+
+void record_output(const char* data, size_t len) {
+  if (rec_file) record_write(RECORD_OUTPUT, data, len);
+}
+
+void record_resize(int cols, int rows) {
+  if (!rec_file) return;
+  uint16_t size[2] = {cols, rows};
+  record_write(RECORD_RESIZE, size, sizeof(size));
+}
+
+bool record_close(void) {
+  if (!rec_file) return true;
+  bool ok = !rec_failed;
+  if (fclose(rec_file) != 0) ok = false;
+  rec_file = NULL;
+  if (!ok) fprintf(stderr, "%s: write failed, the recording is incomplete\n", rec_path);
+  return ok;
+}
+
+// Copies out the entry header at pos, false past the end. Payloads have any
+// length, so headers are rarely aligned in the mapping. A resize too short
+// for its size ends the recording like a truncated one.
+static bool replay_entry(size_t pos, RecordEntry* e) {
+  if (pos + sizeof(RecordEntry) > rp_size) return false;
+  memcpy(e, rp_data + pos, sizeof(*e));
+  if (e->type == RECORD_RESIZE && e->len < sizeof(uint16_t[2])) return false;
+  return pos + sizeof(RecordEntry) + e->len <= rp_size;  // false for a truncated recording
+}
+
+bool replay_open(const char* path, bool fast) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(RecordHeader)) {
+    fprintf(stderr, "%s: not a recording\n", path);
+    close(fd);
+    return false;
+  }
+
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    return false;
+  }
+
+  const RecordHeader* h = map;
+  if (memcmp(h->magic, RECORD_MAGIC, 4) != 0 || h->version != RECORD_VERSION) {
+    fprintf(stderr, "%s: unsupported recording format\n", path);
+    munmap(map, st.st_size);
+    return false;
+  }
+  posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+  rp_data = map;
+  rp_size = st.st_size;
+  rp_pos = sizeof(RecordHeader);
+  rp_offset = 0;
+  rp_fast = fast;
+  rp_clock_ns = 0;
+  rp_start_ns = now_ns();
+  return true;
+}
+
+bool replay_active(void) { return rp_data != NULL; }
+
+bool replay_fast(void) { return rp_fast; }
+
+void replay_tick(void) {
+  if (rp_fast) {
+    rp_clock_ns += REPLAY_FRAME_NS;
+  } else {
+    rp_clock_ns = now_ns() - rp_start_ns;
+  }
+}
+
+bool replay_pending(void) {
+  RecordEntry e;
+  return replay_entry(rp_pos, &e) && e.time_ns <= rp_clock_ns;
+}
+
+bool replay_done(void) {
+  RecordEntry e;
+  return rp_data && !replay_entry(rp_pos, &e);
+}
+
+bool replay_take_resize(int* cols, int* rows) {
+  RecordEntry e;
+  if (!replay_entry(rp_pos, &e) || e.type != RECORD_RESIZE || e.time_ns > rp_clock_ns) return false;
+
+  uint16_t size[2];
+  memcpy(size, rp_data + rp_pos + sizeof(e), sizeof(size));
+  *cols = size[0];
+  *rows = size[1];
+  rp_pos += sizeof(e) + e.len;
+  return true;
+}
+
+// Grid size of the first resize event, so output recorded before the first
+// frame is parsed at the size it was produced for
+bool replay_initial_size(int* cols, int* rows) {
+  RecordEntry e;
+  for (size_t pos = sizeof(RecordHeader); replay_entry(pos, &e); pos += sizeof(e) + e.len) {
+    if (e.type == RECORD_RESIZE) {
+      uint16_t size[2];
+      memcpy(size, rp_data + pos + sizeof(e), sizeof(size));
+      *cols = size[0];
+      *rows = size[1];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns bytes of the next due output chunk, 0 if nothing is due or the
+// next event is a resize. Chunks larger than len are returned in pieces.
+int replay_read(char* buf, size_t len) {
+  RecordEntry e;
+  bool found = replay_entry(rp_pos, &e);
+  if (!found || e.type != RECORD_OUTPUT || e.time_ns > rp_clock_ns) {
+    // skip event types this build doesn't know
+    if (found && e.type != RECORD_OUTPUT && e.type != RECORD_RESIZE) rp_pos += sizeof(e) + e.len;
+    return 0;
+  }
+
+  size_t n = e.len - rp_offset;
+  if (n > len) n = len;
+  memcpy(buf, rp_data + rp_pos + sizeof(e) + rp_offset, n);
+  rp_offset += n;
+
+  if (rp_offset == e.len) {
+    rp_pos += sizeof(e) + e.len;
+    rp_offset = 0;
+  }
+  return (int)n;
+}
+
+double replay_elapsed(void) { return (now_ns() - rp_start_ns) / 1e9; }
+
+void replay_close(void) {
+  if (rp_data) munmap((void*)rp_data, rp_size);
+  rp_data = NULL;
+}
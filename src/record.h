@@ -0,0 +1,31 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Session recording: every chunk read from the PTY and every grid resize,
+// stamped with CLOCK_MONOTONIC time since the recording started.
+bool record_open(const char* path);
+bool record_active(void);
+void record_output(const char* data, size_t len);
+void record_resize(int cols, int rows);
+bool record_close(void);  // false, and reported, when a write failed
+
+// Replay feeds a recording back through readfrompty() in place of the PTY.
+// In real-time mode chunks become due as wall time passes; in fast mode the
+// clock advances one frame interval per replay_tick(), so every run sees
+// the same chunks per frame regardless of machine speed.
+bool replay_open(const char* path, bool fast);
+bool replay_active(void);
+bool replay_fast(void);
+void replay_tick(void);
+bool replay_pending(void);
+bool replay_done(void);
+bool replay_take_resize(int* cols, int* rows);
+bool replay_initial_size(int* cols, int* rows);
+int replay_read(char* buf, size_t len);
+double replay_elapsed(void);
+void replay_close(void);
+
+#endif
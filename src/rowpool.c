@@ -0,0 +1,87 @@
+#include "rowpool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROWPOOL_SLAB_BYTES (64 << 10)  // smallest slab, a wider row gets a slab to itself
+
+// Sits right before the cells of every row, cols last, see rowpool_cols()
+typedef struct {
+  uint32_t size_class;
+  int32_t cols;
+} RowHeader;
+
+// Lives in the cells of a free row
+typedef struct FreeRow {
+  struct FreeRow* next;
+} FreeRow;
+
+static size_t cell_bytes = 1;
+static FreeRow** free_lists = NULL;  // by size class
+static int class_count = 0;
+static size_t bytes_in_use = 0;
+static size_t bytes_reserved = 0;
+
+void rowpool_init(size_t cell_size) { cell_bytes = cell_size; }
+
+static size_t class_cols(int size_class) { return (size_t)(size_class + 1) * ROWPOOL_CLASS_COLS; }
+
+static size_t row_bytes(int size_class) { return class_cols(size_class) * cell_bytes; }
+
+// Carves a new slab into free rows of one class. Cells start on a
+// ROWPOOL_ALIGN boundary, each header in the gap before them.
+static bool refill(int size_class) {
+  size_t stride = (sizeof(RowHeader) + row_bytes(size_class) + ROWPOOL_ALIGN - 1) / ROWPOOL_ALIGN * ROWPOOL_ALIGN;
+  size_t count = ROWPOOL_SLAB_BYTES / stride;
+  if (count == 0) count = 1;
+
+  void* slab;
+  if (posix_memalign(&slab, ROWPOOL_ALIGN, ROWPOOL_ALIGN + stride * count) != 0) return false;
+  bytes_reserved += ROWPOOL_ALIGN + stride * count;
+
+  for (size_t i = 0; i < count; i++) {
+    char* cells = (char*)slab + ROWPOOL_ALIGN + i * stride;
+    RowHeader* header = (RowHeader*)cells - 1;
+    header->size_class = size_class;
+    header->cols = (int32_t)class_cols(size_class);
+    FreeRow* row = (FreeRow*)cells;
+    row->next = free_lists[size_class];
+    free_lists[size_class] = row;
+  }
+  return true;
+}
+
+void* rowpool_alloc(int cols) {
+  int size_class = cols > 0 ? (cols - 1) / ROWPOOL_CLASS_COLS : 0;
+
+  if (size_class >= class_count) {
+    FreeRow** grown = realloc(free_lists, sizeof(*free_lists) * (size_class + 1));
+    if (!grown) return NULL;
+    memset(grown + class_count, 0, sizeof(*grown) * (size_class + 1 - class_count));
+    free_lists = grown;
+    class_count = size_class + 1;
+  }
+
+  if (!free_lists[size_class] && !refill(size_class)) return NULL;
+
+  FreeRow* row = free_lists[size_class];
+  free_lists[size_class] = row->next;
+  memset(row, 0, row_bytes(size_class));
+  bytes_in_use += row_bytes(size_class);
+  return row;
+}
+
+void rowpool_free(void* row) {
+  if (!row) return;
+  int size_class = ((RowHeader*)row - 1)->size_class;
+  FreeRow* free_row = row;
+  free_row->next = free_lists[size_class];
+  free_lists[size_class] = free_row;
+  bytes_in_use -= row_bytes(size_class);
+}
+
+size_t rowpool_bytes_in_use(void) { return bytes_in_use; }
+
+size_t rowpool_bytes_reserved(void) { return bytes_reserved; }
@@ -0,0 +1,25 @@
+#ifndef ROWPOOL_H
+#define ROWPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Grid rows carved out of slabs. Capacities are rounded up to a multiple of
+// ROWPOOL_CLASS_COLS and freed rows wait on their size class's free list, so
+// scrolling and resizing recycle rows instead of going back to malloc. Rows
+// start on a cache line.
+#define ROWPOOL_CLASS_COLS 32
+#define ROWPOOL_ALIGN 64
+
+void rowpool_init(size_t cell_size);
+void* rowpool_alloc(int cols);  // zeroed, NULL when out of memory
+void rowpool_free(void* row);
+
+// Capacity, at least what was asked for. Stored just before the cells so it
+// costs a load, the grid asks for it on every cell it writes.
+static inline int rowpool_cols(const void* row) { return ((const int32_t*)row)[-1]; }
+
+size_t rowpool_bytes_in_use(void);
+size_t rowpool_bytes_reserved(void);  // slabs, including free rows
+
+#endif
@@ -0,0 +1,36 @@
+#include "sched.h"
+
+#define SCHED_WEIGHT 0.125  // of the newest sample in the moving averages
+
+static double frame_interval = SCHED_FRAME_MS / 1e3;
+static double parse_cap = SCHED_PARSE_CAP_MS / 1e3;
+static double render_cost = 0.0;
+static double read_cost = 0.0;
+static double last_presented = 0.0;
+static double deadline = 0.0;
+
+void sched_configure(double frame_ms, double parse_cap_ms) {
+  if (frame_ms > 0) frame_interval = frame_ms / 1e3;
+  if (parse_cap_ms > 0) parse_cap = parse_cap_ms / 1e3;
+}
+
+void sched_parse_begin(double now, bool frame_due) {
+  deadline = now + parse_cap;
+  if (!frame_due) return;  // nothing to present, parse a whole slice
+
+  double frame_deadline = last_presented + frame_interval - render_cost;
+  if (frame_deadline < deadline) deadline = frame_deadline;
+  if (deadline < now + SCHED_PARSE_MIN_MS / 1e3) deadline = now + SCHED_PARSE_MIN_MS / 1e3;
+}
+
+double sched_deadline(void) { return deadline; }
+
+bool sched_parse_more(double read_start, double now) {
+  read_cost += (now - read_start - read_cost) * SCHED_WEIGHT;
+  return now + read_cost <= deadline;
+}
+
+void sched_frame_done(double render_seconds, double presented) {
+  render_cost += (render_seconds - render_cost) * SCHED_WEIGHT;
+  last_presented = presented;
+}
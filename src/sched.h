@@ -0,0 +1,24 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+
+// Splits the main loop between parsing PTY output and presenting frames, so
+// a flood can't hold off input handling or the screen. Each round polls
+// window events first, then parses until its slice is spent, then renders.
+// The slice runs out a frame interval after the last frame was presented,
+// less what rendering has been costing, and never exceeds the parse cap. A
+// read that would likely run past it waits for the next round, and a flood
+// read ahead in one go stops parsing at it. Both costs are moving averages.
+// Times are in seconds.
+#define SCHED_FRAME_MS 16.0      // a frame at least this often under load, a little under 60 Hz
+#define SCHED_PARSE_CAP_MS 14.0  // most parsing in one round
+#define SCHED_PARSE_MIN_MS 1.0   // least, however late the frame
+
+void sched_configure(double frame_ms, double parse_cap_ms);
+void sched_parse_begin(double now, bool frame_due);
+double sched_deadline(void);                           // when the current slice is spent
+bool sched_parse_more(double read_start, double now);  // after each read, false once the slice is spent
+void sched_frame_done(double render_seconds, double presented);
+
+#endif
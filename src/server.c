@@ -0,0 +1,295 @@
+#define _GNU_SOURCE  // struct ucred for SO_PEERCRED
+
+#include "server.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "buffer.h"
+
+#define SERVER_MAGIC 0x4D52545Au          // "ZTRM"
+#define SERVER_REQUEST_MAX (1u << 20)     // bytes of strings in one request
+#define SERVER_READ_TIMEOUT_MS 1000       // a client that stalls longer is dropped
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+extern char** environ;
+
+// Followed by the working directory, the arguments and the environment, each
+// string NUL-terminated
+typedef struct {
+  uint32_t magic;
+  uint32_t argc, envc;
+  uint32_t bytes;
+} RequestHeader;
+
+// One allocation: the argv and environ arrays, NULL-terminated, then the strings
+typedef struct {
+  const char* cwd;
+  int argc;
+  char** argv;
+  char** env;
+} Request;
+
+const char* server_default_path(void) {
+  static char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+  const char* runtime = getenv("XDG_RUNTIME_DIR");
+  if (runtime && *runtime) {
+    snprintf(path, sizeof(path), "%s/term.sock", runtime);
+  } else {
+    snprintf(path, sizeof(path), "/tmp/term-%u.sock", (unsigned)getuid());
+  }
+  return path;
+}
+
+static bool make_address(const char* path, struct sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) return false;
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+// The socket path in /tmp is predictable, another user may have bound it
+// first. False when path exists as anything but a socket of ours.
+static bool path_is_ours(const char* path) {
+  struct stat st;
+  if (lstat(path, &st) != 0) return errno == ENOENT;
+  return S_ISSOCK(st.st_mode) && st.st_uid == getuid();
+}
+
+// True when the process at the other end of fd runs as this user
+static bool peer_is_us(int fd) {
+#ifdef __linux__
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != sizeof(cred)) return false;
+  return cred.uid == getuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static int connect_to(const struct sockaddr_un* addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool send_all(int fd, const void* data, size_t len) {
+  const char* p = data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool recv_all(int fd, void* data, size_t len) {
+  char* p = data;
+  while (len > 0) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, SERVER_READ_TIMEOUT_MS);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready <= 0) return false;
+
+    ssize_t n = recv(fd, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static void append_string(Buffer* b, const char* s) { buffer_append(b, s, strlen(s) + 1); }
+
+bool server_request(const char* path, int argc, char** argv) {
+  struct sockaddr_un addr;
+  if (!make_address(path, &addr)) return false;
+  if (!path_is_ours(path)) {
+    fprintf(stderr, "server: %s is not a socket of ours, not using it\n", path);
+    return false;
+  }
+  int fd = connect_to(&addr);
+  if (fd < 0) return false;
+  // the environment goes out below, only to a server of ours
+  if (!peer_is_us(fd)) {
+    fprintf(stderr, "server: %s is served by another user, not using it\n", path);
+    close(fd);
+    return false;
+  }
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "/");
+
+  Buffer strings = {0};
+  RequestHeader header = {.magic = SERVER_MAGIC, .argc = argc};
+  append_string(&strings, cwd);
+  for (int i = 0; i < argc; i++) append_string(&strings, argv[i]);
+  for (char** env = environ; *env; env++, header.envc++) append_string(&strings, *env);
+  header.bytes = strings.len;
+
+  uint32_t pid = 0;
+  bool sent = strings.len <= SERVER_REQUEST_MAX && send_all(fd, &header, sizeof(header)) &&
+              send_all(fd, strings.data, strings.len);
+  bool answered = sent && recv_all(fd, &pid, sizeof(pid));
+  buffer_free(&strings);
+  close(fd);
+
+  if (answered && pid == 0) fprintf(stderr, "server: could not start a terminal\n");
+  return answered && pid != 0;
+}
+
+// Reads and checks one request, NULL when it is malformed or too slow
+static Request* read_request(int fd) {
+  RequestHeader header;
+  if (!recv_all(fd, &header, sizeof(header))) return NULL;
+  // every string takes at least its NUL
+  if (header.magic != SERVER_MAGIC || header.argc < 1 || header.bytes > SERVER_REQUEST_MAX ||
+      header.argc >= header.bytes || header.envc >= header.bytes - header.argc) {
+    return NULL;
+  }
+
+  size_t pointers = (size_t)header.argc + header.envc + 2;
+  Request* req = malloc(sizeof(Request) + pointers * sizeof(char*) + header.bytes);
+  if (!req) return NULL;
+  char** list = (char**)(req + 1);
+  char* strings = (char*)(list + pointers);
+  if (!recv_all(fd, strings, header.bytes) || strings[header.bytes - 1] != '\0') {
+    free(req);
+    return NULL;
+  }
+
+  // Split the strings, there must be exactly as many as the header says
+  char* end = strings + header.bytes;
+  char* s = strings;
+  req->cwd = s;
+  s += strlen(s) + 1;
+  req->argc = header.argc;
+  req->argv = list;
+  req->env = list + header.argc + 1;
+  for (uint32_t i = 0; i < header.argc + header.envc; i++) {
+    if (s >= end) {
+      free(req);
+      return NULL;
+    }
+    char** slot = i < header.argc ? &req->argv[i] : &req->env[i - header.argc];
+    *slot = s;
+    s += strlen(s) + 1;
+  }
+  req->argv[header.argc] = NULL;
+  req->env[header.envc] = NULL;
+  if (s != end) {
+    free(req);
+    return NULL;
+  }
+  return req;
+}
+
+bool server_run(const char* path, int* argc, char*** argv) {
+  struct sockaddr_un addr;
+  if (!make_address(path, &addr)) {
+    fprintf(stderr, "server: socket path too long: %s\n", path);
+    return false;
+  }
+
+  if (!path_is_ours(path)) {
+    fprintf(stderr, "server: %s exists and is not a socket of ours\n", path);
+    return false;
+  }
+
+  // A socket nobody answers on was left behind by a server that died
+  int probe = connect_to(&addr);
+  if (probe >= 0) {
+    close(probe);
+    fprintf(stderr, "server: already running at %s\n", path);
+    return false;
+  }
+  unlink(path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror("socket");
+    return false;
+  }
+  mode_t old_mask = umask(077);
+  int bound = bind(listen_fd, (const struct sockaddr*)&addr, sizeof(addr));
+  umask(old_mask);
+  if (bound != 0 || listen(listen_fd, 16) != 0) {
+    perror(path);
+    close(listen_fd);
+    return false;
+  }
+
+  // Terminals are never waited for, and a client hanging up mustn't kill us
+  struct sigaction no_wait = {.sa_handler = SIG_DFL, .sa_flags = SA_NOCLDWAIT};
+  struct sigaction ignore = {.sa_handler = SIG_IGN};
+  sigemptyset(&no_wait.sa_mask);
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGCHLD, &no_wait, NULL);
+  sigaction(SIGPIPE, &ignore, NULL);
+  fprintf(stderr, "server: listening on %s\n", path);
+
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("accept");
+      close(listen_fd);
+      return false;
+    }
+
+    Request* req = peer_is_us(fd) ? read_request(fd) : NULL;
+    if (!req) {
+      close(fd);
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listen_fd);
+      close(fd);
+      struct sigaction dfl = {.sa_handler = SIG_DFL};
+      sigemptyset(&dfl.sa_mask);
+      sigaction(SIGCHLD, &dfl, NULL);
+      sigaction(SIGPIPE, &dfl, NULL);
+
+      // The terminal outlives the server and belongs to the client's world
+      setsid();
+      if (chdir(req->cwd) != 0) perror(req->cwd);
+      environ = req->env;
+      *argc = req->argc;
+      *argv = req->argv;
+      return true;  // req stays alive as the child's argv and environment
+    }
+    if (pid < 0) perror("fork");
+
+    uint32_t reply = pid > 0 ? (uint32_t)pid : 0;
+    send_all(fd, &reply, sizeof(reply));
+    close(fd);
+    free(req);
+  }
+}
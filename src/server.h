@@ -0,0 +1,20 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+
+// Fork server. `term --server` loads the font and glyph atlas once, then
+// forks an already initialized process for every `term --client` request.
+// Windows started this way share those pages copy-on-write. Each one still
+// opens its own window and GL context, which can't cross a fork.
+const char* server_default_path(void);  // $XDG_RUNTIME_DIR/term.sock, else /tmp/term-UID.sock
+
+// Serves until killed. Returns true only in a forked child, which should go
+// on starting a terminal with *argc and *argv, the client's arguments.
+bool server_run(const char* path, int* argc, char*** argv);
+
+// Asks the server at path to start a terminal with argv, in this process's
+// working directory and environment. False when no server answered.
+bool server_request(const char* path, int argc, char** argv);
+
+#endif
@@ -0,0 +1,173 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout, native byte order:
+//   SnapshotHeader, then per section a SectionHeader followed by len payload
+//   bytes, padded with zeros to a multiple of 8.
+#define SNAPSHOT_MAGIC "ZSNP"
+#define SNAPSHOT_MAX_SECTIONS 32
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t layout;
+  uint32_t pad;
+} SnapshotHeader;
+
+typedef struct {
+  uint32_t type;
+  uint32_t pad;
+  uint64_t len;
+} SectionHeader;
+
+static FILE* out = NULL;
+static char* out_tmp = NULL;
+static const char* out_path = NULL;
+static long section_start = -1;  // offset of the open section's header
+static uint64_t section_len = 0;
+static bool out_failed = false;
+
+static void* map = NULL;
+static size_t map_len = 0;
+
+typedef struct {
+  uint32_t type;
+  const void* data;
+  size_t len;
+} Section;
+
+static Section sections[SNAPSHOT_MAX_SECTIONS];
+static int section_count = 0;
+
+bool snapshot_write_open(const char* path, uint32_t layout) {
+  size_t n = strlen(path) + 5;
+  out_tmp = malloc(n);
+  if (!out_tmp) return false;
+  snprintf(out_tmp, n, "%s.tmp", path);
+
+  out = fopen(out_tmp, "wb");
+  if (!out) {
+    perror(out_tmp);
+    free(out_tmp);
+    out_tmp = NULL;
+    return false;
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  out_path = path;
+  out_failed = false;
+
+  SnapshotHeader h = {.magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .layout = layout};
+  snapshot_write(&h, sizeof(h));
+  return true;
+}
+
+void snapshot_section_begin(uint32_t type) {
+  section_start = ftell(out);
+  section_len = 0;
+  SectionHeader h = {.type = type};
+  if (fwrite(&h, sizeof(h), 1, out) != 1) out_failed = true;
+}
+
+void snapshot_write(const void* data, size_t len) {
+  if (len && fwrite(data, 1, len, out) != len) out_failed = true;
+  section_len += len;
+}
+
+void snapshot_section_end(void) {
+  static const char zeros[8];
+  uint64_t len = section_len;
+  snapshot_write(zeros, (8 - len % 8) % 8);
+
+  // patch the length in now that it is known, without the padding
+  long end = ftell(out);
+  fseek(out, section_start + (long)offsetof(SectionHeader, len), SEEK_SET);
+  if (fwrite(&len, sizeof(len), 1, out) != 1) out_failed = true;
+  fseek(out, end, SEEK_SET);
+  section_start = -1;
+}
+
+bool snapshot_write_close(void) {
+  bool ok = !out_failed && fflush(out) == 0 && fsync(fileno(out)) == 0;
+  if (fclose(out) != 0) ok = false;
+  out = NULL;
+
+  if (ok && rename(out_tmp, out_path) != 0) {
+    perror(out_path);
+    ok = false;
+  }
+  if (!ok) unlink(out_tmp);
+  free(out_tmp);
+  out_tmp = NULL;
+  return ok;
+}
+
+bool snapshot_load(const char* path, uint32_t layout) {
+  snapshot_unload();
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+    fprintf(stderr, "%s: not a snapshot\n", path);
+    close(fd);
+    return false;
+  }
+  map_len = st.st_size;
+  map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    map = NULL;
+    return false;
+  }
+
+  const SnapshotHeader* h = map;
+  if (memcmp(h->magic, SNAPSHOT_MAGIC, 4) != 0 || h->version != SNAPSHOT_VERSION || h->layout != layout) {
+    fprintf(stderr, "%s: not a snapshot from this version\n", path);
+    snapshot_unload();
+    return false;
+  }
+
+  const char* base = map;
+  size_t pos = sizeof(SnapshotHeader);
+  while (pos < map_len) {
+    const SectionHeader* s = (const SectionHeader*)(base + pos);
+    size_t room = map_len - pos - sizeof(*s);
+    if (map_len - pos < sizeof(*s) || s->len > room || section_count == SNAPSHOT_MAX_SECTIONS) {
+      fprintf(stderr, "%s: truncated snapshot\n", path);
+      snapshot_unload();
+      return false;
+    }
+    sections[section_count++] = (Section){.type = s->type, .data = s + 1, .len = s->len};
+    pos += sizeof(*s) + (s->len + 7) / 8 * 8;
+  }
+  return true;
+}
+
+const void* snapshot_section(uint32_t type, size_t* len) {
+  for (int i = 0; i < section_count; i++) {
+    if (sections[i].type == type) {
+      *len = sections[i].len;
+      return sections[i].data;
+    }
+  }
+  *len = 0;
+  return NULL;
+}
+
+void snapshot_unload(void) {
+  if (map) munmap(map, map_len);
+  map = NULL;
+  map_len = 0;
+  section_count = 0;
+}
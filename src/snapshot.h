@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Versioned binary snapshots: a header, then tagged sections whose payloads
+// start 8-byte aligned. Written to a temporary file renamed into place, so a
+// crash mid-write leaves the previous snapshot intact. Loading maps the file
+// and hands out pointers into the mapping, nothing is parsed up front.
+#define SNAPSHOT_VERSION 1
+
+// layout identifies the in-memory formats the sections were written with
+// (the caller's record sizes); a snapshot only loads with the same one.
+bool snapshot_write_open(const char* path, uint32_t layout);
+void snapshot_section_begin(uint32_t type);
+void snapshot_write(const void* data, size_t len);
+void snapshot_section_end(void);
+bool snapshot_write_close(void);  // false if anything failed to write, the old file is kept then
+
+bool snapshot_load(const char* path, uint32_t layout);
+const void* snapshot_section(uint32_t type, size_t* len);  // NULL when the snapshot has none
+void snapshot_unload(void);
+
+#endif
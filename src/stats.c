@@ -0,0 +1,114 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+__thread ParseStats* parse_stats = NULL;
+
+static const char* stats_path = NULL;
+static uint64_t origin_ticks = 0;
+static struct timespec origin_time;
+
+bool stats_open(const char* path) {
+  parse_stats = calloc(1, sizeof(*parse_stats));
+  if (!parse_stats) return false;
+  stats_path = path;
+  clock_gettime(CLOCK_MONOTONIC, &origin_time);
+  origin_ticks = stats_clock();
+  return true;
+}
+
+// Final bytes are whatever ended the parameters, not always printable
+static void write_key(FILE* f, int marker, int c) {
+  fputc('"', f);
+  if (marker) fputc('<' + marker - 1, f);
+  if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') {
+    fputc(c, f);
+  } else {
+    fprintf(f, "\\u%04x", c);
+  }
+  fputc('"', f);
+}
+
+static void write_numbered(FILE* f, const char* name, const uint64_t* counts, int max) {
+  fprintf(f, ",\n  \"%s\": {", name);
+  const char* sep = "";
+  for (int i = 0; i <= max + 1; i++) {
+    if (!counts[i]) continue;
+    if (i <= max) {
+      fprintf(f, "%s\"%d\": %llu", sep, i, (unsigned long long)counts[i]);
+    } else {
+      fprintf(f, "%s\"other\": %llu", sep, (unsigned long long)counts[i]);
+    }
+    sep = ", ";
+  }
+  fputc('}', f);
+}
+
+static void write_stats(FILE* f, const ParseStats* s) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double ns = (now.tv_sec - origin_time.tv_sec) * 1e9 + (now.tv_nsec - origin_time.tv_nsec);
+  double cycles_per_ns = ns > 0 ? (stats_clock() - origin_ticks) / ns : 1.0;
+
+  fprintf(f, "{\n  \"cycles_per_ns\": %.4f,\n  \"reads\": %llu", cycles_per_ns, (unsigned long long)s->reads);
+  fprintf(f, ",\n  \"bytes\": {\"ascii\": %llu, \"utf8\": %llu, \"control\": %llu, \"escape\": %llu, \"skipped\": %llu}",
+          (unsigned long long)s->ascii_bytes, (unsigned long long)s->utf8_bytes, (unsigned long long)s->control_bytes,
+          (unsigned long long)s->escape_bytes, (unsigned long long)s->skipped_bytes);
+  fprintf(f, ",\n  \"sequences\": {\"csi\": %llu, \"osc\": %llu, \"apc\": %llu, \"esc\": %llu}",
+          (unsigned long long)s->csi, (unsigned long long)s->osc, (unsigned long long)s->apc,
+          (unsigned long long)s->esc);
+  fprintf(f, ",\n  \"split\": {\"escape\": %llu, \"utf8\": %llu}", (unsigned long long)s->split_escapes,
+          (unsigned long long)s->split_utf8);
+  fprintf(f, ",\n  \"unknown\": {\"csi\": %llu, \"osc\": %llu, \"apc\": %llu, \"esc\": %llu}",
+          (unsigned long long)s->csi_unknown, (unsigned long long)s->osc_unknown, (unsigned long long)s->apc_unknown,
+          (unsigned long long)s->esc_unknown);
+  fprintf(f, ",\n  \"ignored\": {\"csi\": %llu}", (unsigned long long)s->csi_ignored);
+
+  fprintf(f, ",\n  \"csi\": {");
+  const char* sep = "\n    ";
+  for (int marker = 0; marker < STATS_CSI_PREFIXES; marker++) {
+    for (int c = 0; c < 256; c++) {
+      uint64_t count = s->csi_count[marker][c];
+      if (!count) continue;
+      uint64_t timed = s->csi_timed[marker][c];
+      uint64_t cycles = s->csi_cycles[marker][c];
+      fputs(sep, f);
+      write_key(f, marker, c);
+      // the timed ones stand for all of them
+      fprintf(f, ": {\"count\": %llu, \"timed\": %llu, \"cycles\": %llu, \"ns_each\": %.1f}",
+              (unsigned long long)count, (unsigned long long)timed, (unsigned long long)cycles,
+              timed ? cycles / cycles_per_ns / timed : 0.0);
+      sep = ",\n    ";
+    }
+  }
+  fprintf(f, "\n  }");
+
+  write_numbered(f, "sgr", s->sgr, STATS_SGR_MAX);
+  write_numbered(f, "osc", s->osc_number, STATS_OSC_MAX);
+  fprintf(f, "\n}\n");
+}
+
+bool stats_write(void) {
+  if (!parse_stats) return true;
+
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+  FILE* f = fopen(tmp, "w");
+  if (!f) {
+    perror(tmp);
+    return false;
+  }
+  write_stats(f, parse_stats);
+  if (fclose(f) != 0 || rename(tmp, stats_path) != 0) {
+    perror(stats_path);
+    remove(tmp);
+    return false;
+  }
+  return true;
+}
+
+void stats_close(void) {
+  free(parse_stats);
+  parse_stats = NULL;
+}
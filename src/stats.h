@@ -0,0 +1,91 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// Parser statistics (--stats FILE): bytes by class, escape sequences by kind,
+// CSI sequences and the time spent on them by final byte, SGR parameters,
+// sequences split across reads, and sequences we don't handle. The counters
+// are plain increments into a block owned by the parsing thread, so there
+// are no atomics or shared cache lines; with statistics off parse_stats is
+// NULL and each counting site is one untaken branch. Reading the clock costs
+// about as much as parsing a short CSI, so a random 1 in 16 are timed.
+// stats_write() dumps the calling thread's block as JSON, replacing the file
+// whole.
+#define STATS_SGR_MAX 107  // SGR parameters above this share one counter
+#define STATS_OSC_MAX 255  // likewise for OSC numbers
+#define STATS_SAMPLE_SHIFT 60  // a CSI is timed when the top 4 bits of the sampler are 0
+#define STATS_CSI_PREFIXES 5   // none, then the private markers < = > ?
+
+typedef struct {
+  uint64_t reads;
+  uint64_t ascii_bytes, utf8_bytes, control_bytes, escape_bytes;
+  uint64_t skipped_bytes;  // text jump scroll never put on the grid
+  uint64_t split_escapes, split_utf8;
+  uint64_t esc, esc_unknown;
+  uint64_t osc, osc_unknown, apc, apc_unknown;
+  uint64_t csi, csi_unknown, csi_ignored;
+  uint64_t csi_count[STATS_CSI_PREFIXES][256];  // by private marker and final byte
+  uint64_t csi_timed[STATS_CSI_PREFIXES][256];
+  uint64_t csi_cycles[STATS_CSI_PREFIXES][256];  // of the timed ones
+  uint64_t sampler;
+  uint64_t sgr[STATS_SGR_MAX + 2];
+  uint64_t osc_number[STATS_OSC_MAX + 2];
+} ParseStats;
+
+extern __thread ParseStats* parse_stats;
+
+bool stats_open(const char* path);  // counts on the calling thread from now on
+bool stats_write(void);
+void stats_close(void);
+
+// CPU cycles where there is a cycle counter, timer ticks elsewhere. The dump
+// converts them to nanoseconds against the monotonic clock.
+static inline uint64_t stats_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  uint64_t t;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// A run of text, bytes with the top bit set belong to multibyte (or
+// malformed) sequences. Counted eight at a time.
+static inline void stats_text(const char* s, size_t len) {
+  size_t high = 0, i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    high += __builtin_popcountll(w & 0x8080808080808080ULL);
+  }
+  for (; i < len; i++) high += (unsigned char)s[i] >> 7;
+  parse_stats->ascii_bytes += len - high;
+  parse_stats->utf8_bytes += high;
+}
+
+// Start of a CSI sequence, 0 when this one isn't timed
+static inline uint64_t stats_csi_start(void) {
+  parse_stats->sampler = parse_stats->sampler * 6364136223846793005ULL + 1442695040888963407ULL;
+  return parse_stats->sampler >> STATS_SAMPLE_SHIFT ? 0 : stats_clock();
+}
+
+static inline void stats_csi(char prefix, unsigned char final, uint64_t start) {
+  int marker = prefix ? prefix - '<' + 1 : 0;
+  parse_stats->csi++;
+  parse_stats->csi_count[marker][final]++;
+  if (!start) return;
+  parse_stats->csi_timed[marker][final]++;
+  parse_stats->csi_cycles[marker][final] += stats_clock() - start;
+}
+
+#endif
@@ -1,7 +1,9 @@
 #include <asm-generic/ioctls.h>
+#include <ctype.h>
 #include <limits.h>
 #include <math.h>
-#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,64 +11,369 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/types.h>
 #include <sys/select.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "buffer.h"
+#include "cells.h"
+#include "graphics.h"
+#include "hud.h"
+#include "links.h"
+#include "marks.h"
 #include "platform.h"
+#include "ptyio.h"
+#include "record.h"
+#include "rowpool.h"
+#include "sched.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
+#include "unicode.h"
+#include "utf8.h"
 #include "window.h"
-
-#define MAX_COLS 192
-#define MAX_ROWS 108
+#include "writequeue.h"
+
+#define TERM_NAME "myterm"
+#define TERM_VERSION "0.1.0"                  // reported by XTVERSION as TERM_NAME(TERM_VERSION)
+#define HISTORY_DEFAULT_LINES 10000
+#define OSC_MAX 4096                          // longest OSC string we keep, other than clipboard writes
+#define APC_MAX 8192                          // longest APC string, a graphics chunk plus its keys
+#define OSC52_DEFAULT_LIMIT (1 << 20)         // decoded bytes accepted from an OSC 52 clipboard write
+#define CLIPBOARD_KEEP_BYTES (8 << 20)        // copy buffers larger than this are released after use
+#define HUD_IDLE_REFRESH 0.25                 // seconds between overlay refreshes when nothing else redraws
+#define UNFOCUSED_FPS 10                      // frame rate cap while another window has focus
+#define HIDDEN_POLL_MS 100                    // poll timeout while minimized, output still wakes the loop
+#define TRACE_DEFAULT_EVENTS (1 << 18)        // spans kept by --trace, the newest win
+#define DECODE_BATCH 256                      // codepoints decoded per call before printing
+#define JUMP_SCROLL_READ 4096                 // a read this large with more waiting means a flood
+#define JUMP_SCROLL_MAX (8 << 20)             // bytes read ahead while output floods in
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 // master file descriptor
 static int32_t masterfd;
-
-typedef struct {
-  uint32_t codepoint;
-  uint8_t fg_color;
-  uint8_t bg_color;
-  uint8_t bold;
-} Cell;
+static pid_t child_pid = -1;
+
+// Cell flags
+#define CELL_WIDE 0x1       // first half of a double-width character
+#define CELL_WIDE_CONT 0x2  // second half, holds no codepoint of its own
+
+// A row is one row pool allocation holding its cells as separate arrays of
+// cap entries each: codepoints (or grapheme cluster ids, see CELL_CLUSTER),
+// OSC 8 link ids (0 for none), styles, then flags. Capacities are multiples
+// of ROWPOOL_CLASS_COLS and rows start on a cache line, so every array does
+// too; erasing cells is a fill per array and shifting them a memmove.
+typedef struct Row Row;
+
+#define CELL_BYTES (3 * sizeof(uint32_t) + sizeof(uint8_t))
+#define ROW_CODEPOINTS 0
+#define ROW_LINKS 1
+#define ROW_STYLES 2
+
+// Colors and weight of a cell in one word
+#define STYLE(fg, bg, bold) ((uint32_t)(fg) | (uint32_t)(bg) << 8 | (uint32_t)(bold) << 16)
+#define STYLE_FG(s) ((uint8_t)(s))
+#define STYLE_BOLD(s) ((uint8_t)((s) >> 16))
+#define STYLE_BLANK STYLE(7, 0, 0)
 
 typedef struct {
   char cmd[2];
   int params[16];
   int nparams;
-  char prefix;
+  char prefix;        // private marker: < = > ?
+  char intermediate;  // last of any 0x20-0x2F bytes before the final one
 } CSISequence;
 
 static CSISequence current_csi;
 static uint32_t recent_codepoint = 0;
 
-static Cell screen[MAX_ROWS][MAX_COLS];
+// Screen rows from the row pool, at least term_cols wide. Rows past term_rows
+// are kept after a shrink and come back if the window grows again.
+static Row** screen = NULL;
+static int screen_alloc = 0;
 static uint8_t current_fg_color = 7;
 static uint8_t current_bg_color = 0;
 static uint8_t current_bold = 0;
+static uint32_t current_link = 0;
+
+// DEC private modes
+static bool bracketed_paste = false;
 
 static int term_cols = 128, term_rows = 36;
 static int cursor_x = 0, cursor_y = 0;
-
-// Selection state
+static int last_x = -1, last_y = -1;  // last printed cell, combining marks attach to it
+static int fixed_cols = 0, fixed_rows = 0;  // grid size imposed by a replay, 0 follows the window
+
+// Cells are sized so a grid of target_cols x target_rows fills the window
+#define PADDING_X 0.0f
+#define PADDING_Y 30.0f
+#define CELL_ASPECT 1.9f  // for monospace char width is usually ~2x char_width
+static int target_cols = 120, target_rows = 40;
+
+// Zoom scales the cells and the glyphs together, the grid gets fewer cells
+#define ZOOM_STEP 1.1f
+#define ZOOM_MIN 0.5f
+#define ZOOM_MAX 4.0f
+#define BASELINE_OFFSET 13.0f  // baseline below the top of its cell, at text scale 1
+static float font_zoom = 1.0f;
+static float text_scale = 1.0f;  // font_zoom times the monitor's content scale
+
+// Scrollback ring. Lines are addressed by absolute line number: screen row y is
+// line history_total + y, and history line L lives in slot L % history_cap.
+static Row** history = NULL;  // rows keep the width they had on screen
+static int history_cap = HISTORY_DEFAULT_LINES;
+static int history_count = 0;
+static int64_t history_total = 0;
+static int view_offset = 0;  // rows scrolled back into history
+
+// Content generation of every line, renewed whenever a row changes so results
+// derived from its text (detected links) can be cached. History lines keep the
+// generation they had on screen.
+static uint64_t* screen_gen = NULL;
+static uint64_t* history_gen = NULL;
+static uint64_t gen_counter = 0;
+
+// OSC string being collected across reads
+static Buffer osc_buf;
+static bool in_osc = false;
+static bool in_apc = false;  // collecting an APC (ESC _) string instead, same terminators
+static bool osc_overflow = false;
+static bool csi_discard = false;  // dropping the rest of a CSI too long for buf
+static size_t osc52_limit = OSC52_DEFAULT_LIMIT;
+
+// Selection state, rows are absolute line numbers
 static bool selecting = false;
-static int sel_start_x = 0, sel_start_y = 0;
-static int sel_end_x = 0, sel_end_y = 0;
+static bool redraw_requested = false;
+static int sel_start_x = 0, sel_end_x = 0;
+static int64_t sel_start_y = 0, sel_end_y = 0;
+static Buffer clipboard_buf;
 static float cached_char_width = 18.0f;
 static float cached_char_height = 35.0f;
 static float cached_padding_x = 10.0f;
 static float cached_padding_y = 20.0f;
+static int cells_rendered = 0;  // by the last render_terminal()
+
+// Rendered text of line L sits in row cache slot L % row_cache_slots, valid
+// while its generation and the layout it was drawn with still match
+typedef struct {
+  int64_t line;
+  uint64_t gen;
+  int used_cols;  // up to the last glyph, 0 for a blank row
+} CachedRow;
+
+static bool row_cache_enabled = true;
+static CachedRow* cached_rows = NULL;
+static int row_cache_slots = 0;
+static int row_cache_width = 0;
+static float row_cache_char_width = 0.0f;
+static float row_cache_text_scale = 0.0f;
+
+// Link under the mouse pointer, x0..x1 inclusive on an absolute line
+typedef struct {
+  bool active;
+  int64_t line;
+  uint64_t gen;  // of the line when hit-tested
+  int x0, x1;
+  uint32_t id;  // OSC 8 link, 0 for a detected one
+  uint8_t kind;
+} HoverLink;
+
+static HoverLink hover;
+static double mouse_x = -1, mouse_y = -1;
+
+// Arrays of cells laid out as in a row of capacity cap, which may be a
+// snapshot's copy rather than a pool row
+static inline uint32_t* cell_words(const void* cells, int cap, int array) {
+  return (uint32_t*)cells + (size_t)array * cap;
+}
+
+static inline uint8_t* cell_flags(const void* cells, int cap) { return (uint8_t*)cells + 3 * sizeof(uint32_t) * cap; }
+
+static inline uint32_t* row_words(const Row* row, int array) { return cell_words(row, rowpool_cols(row), array); }
+
+static inline uint8_t* row_flags(const Row* row) { return cell_flags(row, rowpool_cols(row)); }
+
+// Cells [x0, x1) of row become blank with the given style
+static void fill_cells(Row* row, int x0, int x1, uint32_t style) {
+  if (x1 <= x0) return;
+  int cap = rowpool_cols(row);
+  size_t n = x1 - x0;
+  memset(cell_words(row, cap, ROW_CODEPOINTS) + x0, 0, n * sizeof(uint32_t));
+  memset(cell_words(row, cap, ROW_LINKS) + x0, 0, n * sizeof(uint32_t));
+  cells_fill(cell_words(row, cap, ROW_STYLES) + x0, style, n);
+  memset(cell_flags(row, cap) + x0, 0, n);
+}
+
+// Copies n cells from column from of src, a row of capacity src_cap, to
+// column to of dst. The ranges may overlap.
+static void move_cells(Row* dst, int to, const void* src, int src_cap, int from, int n) {
+  if (n <= 0) return;
+  int cap = rowpool_cols(dst);
+  for (int array = ROW_CODEPOINTS; array <= ROW_STYLES; array++) {
+    memmove(cell_words(dst, cap, array) + to, cell_words(src, src_cap, array) + from, n * sizeof(uint32_t));
+  }
+  memmove(cell_flags(dst, cap) + to, cell_flags(src, src_cap) + from, n);
+}
+
+static inline void damage_row(int y) { screen_gen[y] = ++gen_counter; }
+
+static uint64_t line_gen(int64_t line) {
+  if (line >= history_total) return screen_gen[line - history_total];
+  return history_gen[line % history_cap];
+}
+
+static Row* alloc_row(int cols) {
+  Row* row = rowpool_alloc(cols);
+  if (!row) {
+    perror("rowpool_alloc");
+    exit(1);
+  }
+  return row;
+}
+
+// Cleared row for the bottom of the screen, reusing spare if it is wide enough
+static Row* blank_row(Row* spare) {
+  if (spare && rowpool_cols(spare) >= term_cols) {
+    memset(spare, 0, CELL_BYTES * rowpool_cols(spare));
+    return spare;
+  }
+  rowpool_free(spare);
+  return alloc_row(term_cols);
+}
+
+// Columns of a row that are on the grid, history rows may predate a widening
+static int row_cols(const Row* row) {
+  int cols = rowpool_cols(row);
+  return cols < term_cols ? cols : term_cols;
+}
+
+// Takes row as the newest history line. Returns the row it displaced, or row
+// itself without history, for reuse.
+static Row* history_push(Row* row, uint64_t gen) {
+  history_total++;
+  if (history_cap <= 0) return row;
+
+  if (!history) {
+    history = calloc(history_cap, sizeof(*history));
+    history_gen = calloc(history_cap, sizeof(*history_gen));
+    if (!history || !history_gen) {
+      free(history);
+      free(history_gen);
+      history = NULL;
+      history_gen = NULL;
+      history_cap = 0;
+      return row;
+    }
+  }
+
+  size_t slot = (history_total - 1) % history_cap;
+  Row* old = history[slot];
+  history[slot] = row;
+  history_gen[slot] = gen;
+  if (history_count < history_cap) history_count++;
+
+  // keep a scrolled-back view anchored on the same text
+  if (view_offset > 0 && view_offset < history_count) view_offset++;
+  return old;
+}
+
+// Row for an absolute line number, NULL once it has fallen out of history.
+static Row* line_at(int64_t line) {
+  if (line >= history_total) {
+    int64_t y = line - history_total;
+    return y < term_rows ? screen[y] : NULL;
+  }
+  if (line < history_total - history_count) return NULL;
+  return history[line % history_cap];
+}
+
+// Sizes the screen for cols x rows. Rows keep their cells and widened rows
+// gain blank ones on the right.
+static void grid_resize(int cols, int rows) {
+  if (rows > screen_alloc) {
+    Row** rows_grown = realloc(screen, sizeof(*screen) * rows);
+    if (rows_grown) screen = rows_grown;
+    uint64_t* gen_grown = rows_grown ? realloc(screen_gen, sizeof(*screen_gen) * rows) : NULL;
+    if (!gen_grown) {
+      perror("grid_resize");
+      exit(1);
+    }
+    screen_gen = gen_grown;
+    for (int y = screen_alloc; y < rows; y++) {
+      screen[y] = alloc_row(cols);
+      screen_gen[y] = ++gen_counter;
+    }
+    screen_alloc = rows;
+  }
+
+  for (int y = 0; y < rows; y++) {
+    int have = rowpool_cols(screen[y]);
+    if (have >= cols) continue;
+    Row* row = alloc_row(cols);
+    move_cells(row, 0, screen[y], have, 0, have);
+    rowpool_free(screen[y]);
+    screen[y] = row;
+  }
+
+  term_cols = cols;
+  term_rows = rows;
+  // rows past the new height may be narrower than the new width
+  if (cursor_x >= cols) cursor_x = cols - 1;
+  if (cursor_y >= rows) cursor_y = rows - 1;
+  if (last_x >= cols || last_y >= rows) last_x = -1;
+}
+
+static size_t screen_bytes(void) {
+  size_t bytes = (sizeof(*screen) + sizeof(*screen_gen)) * screen_alloc;
+  for (int y = 0; y < screen_alloc; y++) bytes += CELL_BYTES * rowpool_cols(screen[y]);
+  return bytes;
+}
+
+// Moves the top row into history and opens a blank one at the bottom. Only
+// row pointers move, whatever the width.
+static void scroll_off_top(void) {
+  Row* top = screen[0];
+  uint64_t gen = screen_gen[0];
+  memmove(screen, screen + 1, sizeof(*screen) * (term_rows - 1));
+  memmove(screen_gen, screen_gen + 1, sizeof(*screen_gen) * (term_rows - 1));
+  screen[term_rows - 1] = blank_row(history_push(top, gen));
+  damage_row(term_rows - 1);
+}
+
+static void linefeed(void) {
+  cursor_y++;
+  if (cursor_y >= term_rows) {
+    if (--last_y < 0) last_x = -1;
+    scroll_off_top();
+    cursor_y = term_rows - 1;
+  }
+}
+
+static void reverse_rows(int from, int to) {
+  for (to--; from < to; from++, to--) {
+    Row* row = screen[from];
+    screen[from] = screen[to];
+    screen[to] = row;
+    uint64_t gen = screen_gen[from];
+    screen_gen[from] = screen_gen[to];
+    screen_gen[to] = gen;
+  }
+}
 
-static inline void clearcell(Cell* cell) {
-  cell->codepoint = 0;
-  cell->fg_color = 7;
-  cell->bg_color = 0;
-  cell->bold = 0;
+// Rotates rows [top, bottom) up by n, the first n rows wrap around to the end
+static void rotate_rows(int top, int bottom, int n) {
+  reverse_rows(top, top + n);
+  reverse_rows(top + n, bottom);
+  reverse_rows(top, bottom);
 }
 
-static inline Cell* cellat(int x, int y) {
-  if (x < 0 || x >= term_cols || y < 0 || y >= term_rows) return NULL;
-  return &screen[y][x];
+// Clears cells [x0, x1) of screen row y
+static void erase_cells(int y, int x0, int x1) {
+  fill_cells(screen[y], x0, x1, STYLE_BLANK);
+  damage_row(y);
 }
 
 void moveto(int x, int y) {
@@ -80,14 +387,10 @@ void scrollup(int top, int n) {
   int bottom = term_rows;
   n = n > (bottom - top) ? (bottom - top) : n;
 
-  for (int y = top; y < bottom - n; y++) {
-    memcpy(screen[y], screen[y + n], sizeof(Cell) * term_cols);
-  }
+  rotate_rows(top, bottom, n);
 
   for (int y = bottom - n; y < bottom; y++) {
-    for (int x = 0; x < term_cols; x++) {
-      clearcell(&screen[y][x]);
-    }
+    erase_cells(y, 0, term_cols);
   }
 }
 
@@ -97,120 +400,220 @@ void scrolldown(int top, int n) {
   int bottom = term_rows;
   n = n > (bottom - top) ? (bottom - top) : n;
 
-  for (int y = bottom - 1; y >= top + n; y--) {
-    memcpy(screen[y], screen[y - n], sizeof(Cell) * term_cols);
-  }
+  rotate_rows(top, bottom, bottom - top - n);
 
   for (int y = top; y < top + n; y++) {
-    for (int x = 0; x < term_cols; x++) {
-      clearcell(&screen[y][x]);
-    }
+    erase_cells(y, 0, term_cols);
   }
 }
 
 void insertblankchars(int n) {
   if (n <= 0) return;
+  if (n > term_cols - cursor_x) n = term_cols - cursor_x;
 
-  int end = cursor_x + n;
-  if (end > term_cols) end = term_cols;
-
-  for (int x = term_cols - 1; x >= end; x--) {
-    screen[cursor_y][x] = screen[cursor_y][x - 1];
-  }
-
-  for (int x = cursor_x; x < end; x++) {
-    clearcell(&screen[cursor_y][x]);
-  }
+  Row* row = screen[cursor_y];
+  move_cells(row, cursor_x + n, row, rowpool_cols(row), cursor_x, term_cols - cursor_x - n);
+  erase_cells(cursor_y, cursor_x, cursor_x + n);
 }
 
 void deletecells(int n) {
   if (n <= 0) return;
+  if (n > term_cols - cursor_x) n = term_cols - cursor_x;
 
-  for (int x = cursor_x; x < term_cols - n; x++) {
-    screen[cursor_y][x] = screen[cursor_y][x + n];
-  }
+  Row* row = screen[cursor_y];
+  move_cells(row, cursor_x, row, rowpool_cols(row), cursor_x + n, term_cols - cursor_x - n);
+  erase_cells(cursor_y, term_cols - n, term_cols);
+}
 
-  for (int x = term_cols - n; x < term_cols; x++) {
-    clearcell(&screen[cursor_y][x]);
+// CSI ? Pm h / CSI ? Pm l
+static void set_private_modes(bool enable) {
+  for (int p = 0; p < current_csi.nparams; p++) {
+    switch (current_csi.params[p]) {
+      case 2004:
+        bracketed_paste = enable;
+        break;
+    }
   }
 }
 
-static const int8_t utf8_length[256] = {
-    [0x00 ... 0x7F] = 1,  // 0xxxxxxx
-    [0xC0 ... 0xDF] = 2,  // 110xxxxx
-    [0xE0 ... 0xEF] = 3,  // 1110xxxx
-    [0xF0 ... 0xF7] = 4,  // 11110xxx
+static void put_cell(int x, int y, uint32_t codepoint, uint8_t flags) {
+  Row* row = screen[y];
+  int cap = rowpool_cols(row);
+  uint8_t* cell_flag = cell_flags(row, cap);
 
-    [0x80 ... 0xBF] = -1,  // Continuation bytes
-    [0xF8 ... 0xFF] = -1,  // Invalid
-};
+  // Clears the other half of a wide character this one overwrites
+  if ((cell_flag[x] & CELL_WIDE_CONT) && x > 0) fill_cells(row, x - 1, x, STYLE_BLANK);
+  if ((cell_flag[x] & CELL_WIDE) && x + 1 < term_cols) fill_cells(row, x + 1, x + 2, STYLE_BLANK);
 
-// takes a point to a UTF-8 byte sequence and decodes a single Unicode codepoint from it.
-int32_t utf8decode(const char* s, uint32_t* out_cp) {
-  unsigned char c = (unsigned char)s[0];
-  int32_t len = utf8_length[c];
+  cell_words(row, cap, ROW_CODEPOINTS)[x] = codepoint;
+  cell_words(row, cap, ROW_LINKS)[x] = current_link;
+  cell_words(row, cap, ROW_STYLES)[x] = STYLE(current_fg_color, current_bg_color, current_bold);
+  cell_flag[x] = flags;
+  damage_row(y);
+}
 
-  if (len <= 0) return -1;
+// Advances the cursor by the codepoint's wcwidth, so the grid stays in step with
+// what applications compute. Zero-width codepoints join the previous cell's
+// grapheme cluster unless UAX #29 puts a boundary before them.
+static void print_codepoint(uint32_t codepoint) {
+  uint8_t props = unicode_props(codepoint);
+  int width = unicode_width(props);
+
+  if (width == UNICODE_WIDTH_CONTROL) return;
+
+  if (width == 0) {
+    if (last_x < 0) return;
+    uint32_t* base = &row_words(screen[last_y], ROW_CODEPOINTS)[last_x];
+    int prev_gcb = unicode_gcb(unicode_props(cluster_last_codepoint(*base)));
+    if (!unicode_is_break(prev_gcb, unicode_gcb(props))) {
+      *base = cluster_append(*base, codepoint);
+      damage_row(last_y);
+    }
+    return;
+  }
 
-  switch (len) {
-    case 1:
-      *out_cp = c;
-      return 1;
+  // A wide character never straddles the right margin
+  if (width == 2 && cursor_x == term_cols - 1) {
+    put_cell(cursor_x, cursor_y, 0, 0);
+    cursor_x = 0;
+    linefeed();
+  }
 
-    case 2:
-      *out_cp = ((c & 0x1F) << 6) | ((unsigned char)s[1] & 0x3F);
-      return 2;
+  put_cell(cursor_x, cursor_y, codepoint, width == 2 ? CELL_WIDE : 0);
+  if (width == 2) put_cell(cursor_x + 1, cursor_y, 0, CELL_WIDE_CONT);
 
-    case 3:
-      *out_cp = ((c & 0x0F) << 12) | ((unsigned char)s[1] & 0x3F << 6) | ((unsigned char)s[2] & 0x3F);
-      return 3;
+  last_x = cursor_x;
+  last_y = cursor_y;
+  recent_codepoint = codepoint;
 
-    case 4:
-      *out_cp = ((c & 0x07) << 18) | ((unsigned char)s[1] & 0x3F << 12) | ((unsigned char)s[2] & 0x3F << 6) |
-                ((unsigned char)s[3] & 0x3F);
-      return 4;
+  cursor_x += width;
+  if (cursor_x >= term_cols) {  // wrap to next line
+    cursor_x = 0;
+    linefeed();
   }
-
-  return -1;
 }
 
-int utf8encode(uint32_t cp, char* out) {
-  if (cp < 0x80) {
-    out[0] = (char)cp;
-    return 1;
+// A run of printable ASCII: one column each and never joining the previous
+// cluster, so each stretch up to the margin is stored array by array. Only
+// wide characters straddling the stretch's ends need clearing, as put_cell
+// would.
+static size_t print_ascii(const uint32_t* cps, size_t n) {
+  size_t done = 0;
+  while (done < n && cps[done] >= 0x20 && cps[done] < 0x7F) {
+    size_t len = 1;
+    while (done + len < n && len < (size_t)(term_cols - cursor_x) && cps[done + len] >= 0x20 &&
+           cps[done + len] < 0x7F)
+      len++;
+
+    Row* row = screen[cursor_y];
+    int cap = rowpool_cols(row);
+    int x0 = cursor_x, x1 = cursor_x + (int)len;
+    uint8_t* flags = cell_flags(row, cap);
+    if ((flags[x0] & CELL_WIDE_CONT) && x0 > 0) fill_cells(row, x0 - 1, x0, STYLE_BLANK);
+    if ((flags[x1 - 1] & CELL_WIDE) && x1 < term_cols) fill_cells(row, x1, x1 + 1, STYLE_BLANK);
+
+    uint32_t* codepoints = cell_words(row, cap, ROW_CODEPOINTS);
+    for (size_t i = 0; i < len; i++) codepoints[x0 + i] = cps[done + i];
+    cells_fill(cell_words(row, cap, ROW_LINKS) + x0, current_link, len);
+    cells_fill(cell_words(row, cap, ROW_STYLES) + x0, STYLE(current_fg_color, current_bg_color, current_bold), len);
+    memset(flags + x0, 0, len);
+    damage_row(cursor_y);
+
+    last_x = x1 - 1;
+    last_y = cursor_y;
+    recent_codepoint = cps[done + len - 1];
+    done += len;
+
+    cursor_x = x1;
+    if (cursor_x >= term_cols) {  // wrap to next line
+      cursor_x = 0;
+      linefeed();
+    }
   }
+  return done;
+}
 
-  if (cp < 0x800) {
-    out[0] = (char)(0xC0 | (cp >> 6));
-    out[1] = (char)(0x80 | (cp & 0x3F));
-    return 2;
-  }
+// Replies go on the PTY write queue, which the main loop flushes straight
+// after parsing. Programs like vim and tmux otherwise wait out a timeout.
+static void reply(const char* fmt, ...) {
+  char s[64];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(s, sizeof(s), fmt, ap);
+  va_end(ap);
+  if (n > 0) writequeue_push(s, (size_t)n < sizeof(s) ? (size_t)n : sizeof(s) - 1);
+}
 
-  if (cp < 0x10000) {
-    out[0] = (char)(0xE0 | (cp >> 12));
-    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
-    out[2] = (char)(0x80 | (cp & 0x3F));
-    return 3;
+// DECRQM answer: 0 not recognized, 1 set, 2 reset, 3 permanently set
+static int mode_state(bool private, int mode) {
+  if (!private) return 0;
+  switch (mode) {
+    case 7:  // autowrap, always on
+      return 3;
+    case 2004:
+      return bracketed_paste ? 1 : 2;
   }
+  return 0;
+}
 
-  if (cp < 0x10FFFF) {
-    out[0] = (char)(0xF0 | (cp >> 18));
-    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
-    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
-    out[3] = (char)(0x80 | (cp & 0x3F));
-    return 4;
-  }
+// Answers DA1/DA2, DSR, DECRQM and XTVERSION, false when the sequence is none of them
+static bool answer_query(void) {
+  int p0 = current_csi.nparams > 0 ? current_csi.params[0] : 0;
+  char prefix = current_csi.prefix;
+  char intermediate = current_csi.intermediate;
 
-  return -1;
+  switch (current_csi.cmd[0]) {
+    case 'c':  // device attributes: a VT220 with ANSI color, and firmware version 0
+      if (p0 != 0 || intermediate) return false;
+      if (prefix == 0) {
+        reply("\x1b[?62;22c");
+      } else if (prefix == '>') {
+        reply("\x1b[>1;0;0c");
+      } else {
+        return false;
+      }
+      return true;
+
+    case 'n':  // device status report
+      if (intermediate) return false;
+      if (p0 == 5 && prefix == 0) {
+        reply("\x1b[0n");
+      } else if (p0 == 6 && (prefix == 0 || prefix == '?')) {
+        reply("\x1b[%s%d;%dR", prefix ? "?" : "", cursor_y + 1, cursor_x + 1);
+      } else {
+        return false;
+      }
+      return true;
+
+    case 'p':  // CSI ? Ps $ p, request mode
+      if (intermediate != '$' || (prefix != 0 && prefix != '?')) return false;
+      reply("\x1b[%s%d;%d$y", prefix ? "?" : "", p0, mode_state(prefix == '?', p0));
+      return true;
+
+    case 'q':  // CSI > q, terminal name and version
+      if (prefix != '>' || p0 != 0 || intermediate) return false;
+      reply("\x1bP>|" TERM_NAME "(" TERM_VERSION ")\x1b\\");
+      return true;
+  }
+  return false;
 }
 
 void parse_csi(void) {
   uint32_t dp = current_csi.nparams > 0 ? current_csi.params[0] : 1;
 
+  if (answer_query()) return;
+  // Past the queries, only '?' sequences are handled among those with a marker
+  // or intermediates (CSI > 4;1 m is not SGR)
+  if ((current_csi.prefix && current_csi.prefix != '?') || current_csi.intermediate) {
+    if (parse_stats) parse_stats->csi_ignored++;
+    return;
+  }
+
   switch (current_csi.cmd[0]) {
     case 'm': {
       for (int p = 0; p < current_csi.nparams; p++) {
         int param = current_csi.params[p];
+        if (parse_stats) parse_stats->sgr[param >= 0 && param <= STATS_SGR_MAX ? param : STATS_SGR_MAX + 1]++;
         if (param == 0) {
           current_fg_color = 7;
           current_bg_color = 0;
@@ -267,34 +670,27 @@ void parse_csi(void) {
       uint32_t y = current_csi.nparams > 0 ? current_csi.params[0] : 1;
       uint32_t x = current_csi.nparams > 1 ? current_csi.params[1] : 1;
       moveto(x - 1, y - 1);
+      break;
     }
 
     case 'J': {
       int32_t op = current_csi.params[0];
       if (op == 0) {
-        for (int x = cursor_x; x < term_cols; x++) {
-          clearcell(&screen[cursor_y][x]);
-        }
+        erase_cells(cursor_y, cursor_x, term_cols);
         for (int y = cursor_y + 1; y < term_rows; y++) {
-          for (int x = 0; x < term_cols; x++) {
-            clearcell(&screen[y][x]);
-          }
+          erase_cells(y, 0, term_cols);
         }
       } else if (op == 1) {
         for (int y = 0; y < cursor_y; y++) {
-          for (int x = 0; x < term_cols; x++) {
-            clearcell(&screen[y][x]);
-          }
-        }
-        for (int x = 0; x <= cursor_x; x++) {
-          clearcell(&screen[cursor_y][x]);
+          erase_cells(y, 0, term_cols);
         }
+        erase_cells(cursor_y, 0, cursor_x + 1);
       } else if (op == 2) {
         for (int y = 0; y < term_rows; y++) {
-          for (int x = 0; x <= term_cols; x++) {
-            clearcell(&screen[y][x]);
-          }
+          erase_cells(y, 0, term_cols);
         }
+        graphics_delete_lines(history_total, history_total + term_rows - 1);
+        marks_delete_from(history_total);
       }
       break;
     }
@@ -303,19 +699,13 @@ void parse_csi(void) {
       int32_t op = current_csi.params[0];
       if (op == 0) {
         // clear line right of cursor
-        for (int x = cursor_x; x < term_cols; x++) {
-          clearcell(&screen[cursor_y][x]);
-        }
+        erase_cells(cursor_y, cursor_x, term_cols);
       } else if (op == 1) {
         // clear line left
-        for (int x = 0; x <= cursor_x; x++) {
-          clearcell(&screen[cursor_y][x]);
-        }
+        erase_cells(cursor_y, 0, cursor_x + 1);
       } else if (op == 2) {
         // Entire line
-        for (int x = 0; x < term_cols; x++) {
-          clearcell(&screen[cursor_y][x]);
-        }
+        erase_cells(cursor_y, 0, term_cols);
       }
       break;
     }
@@ -334,14 +724,14 @@ void parse_csi(void) {
 
     case 'S':
       if (current_csi.prefix != '?') {
-        scrollup(0, dp);
+        for (uint32_t i = 0; i < dp && i < (uint32_t)term_rows; i++) scroll_off_top();
+      } else if (parse_stats) {
+        parse_stats->csi_ignored++;
       }
       break;
 
     case 'X':
-      for (int x = cursor_x; x < cursor_x + (int)dp && x < term_cols; x++) {
-        clearcell(&screen[cursor_y][x]);
-      }
+      erase_cells(cursor_y, cursor_x, cursor_x + (int)dp < term_cols ? cursor_x + (int)dp : term_cols);
       break;
 
     case '@':
@@ -350,17 +740,7 @@ void parse_csi(void) {
 
     case 'b':
       for (uint32_t i = 0; i < dp && i < SHRT_MAX; i++) {
-        if (recent_codepoint) {
-          screen[cursor_y][cursor_x].codepoint = recent_codepoint;
-          screen[cursor_y][cursor_x].fg_color = current_fg_color;
-          screen[cursor_y][cursor_x].bg_color = current_bg_color;
-          screen[cursor_y][cursor_x].bold = current_bold;
-          cursor_x++;
-          if (cursor_x >= term_cols) {
-            cursor_x = 0;
-            cursor_y++;
-          }
-        }
+        if (recent_codepoint) print_codepoint(recent_codepoint);
       }
       break;
 
@@ -368,27 +748,255 @@ void parse_csi(void) {
       moveto(cursor_x, dp - 1);
       break;
 
-    case 'n':  // device status report
-      // would need to write back to PTY
+    case 'h':
+    case 'l':
+      if (current_csi.prefix == '?') {
+        set_private_modes(current_csi.cmd[0] == 'h');
+      } else if (parse_stats) {
+        parse_stats->csi_ignored++;
+      }
       break;
 
     default:
+      if (parse_stats) parse_stats->csi_unknown++;
       break;
   }
 }
 
+// OSC 52 ; Pc ; Pd - set the clipboard to the base64 payload Pd
+static void osc52(const char* s, size_t len) {
+  const char* data = memchr(s, ';', len);
+  if (!data) return;
+  data++;
+  len -= data - s;
+
+  if (osc52_limit == 0) return;
+  if (osc_overflow) {
+    fprintf(stderr, "OSC 52: clipboard write over %zu bytes ignored\n", osc52_limit);
+    return;
+  }
+  // Never report clipboard contents back to the program
+  if (len == 1 && data[0] == '?') return;
+
+  Buffer text = {0};
+  if (buffer_append_base64(&text, data, len) && text.len <= osc52_limit && buffer_putc(&text, '\0')) {
+    glfwSetClipboardString(window_get_glfw_window(), text.data);
+  }
+  buffer_free(&text);
+}
+
+// OSC 8 ; params ; URI starts a hyperlink, an empty URI ends it
+static void osc8(const char* s, size_t len) {
+  const char* uri = memchr(s, ';', len);
+  if (!uri) return;
+  uri++;
+  current_link = link_intern(uri, len - (uri - s));
+}
+
+// OSC 133 ; A|B|C|D [; status] - prompt, command, output and command end
+// marks from the shell's integration script
+static void osc133(const char* s, size_t len) {
+  if (len == 0) return;
+  int64_t line = history_total + cursor_y;
+
+  switch (s[0]) {
+    case 'A':
+      marks_prompt(line);
+      break;
+    case 'B':  // where the command line starts, nothing to keep
+      break;
+    case 'C':
+      marks_output(line, cursor_x);
+      break;
+    case 'D': {
+      int status = -1;
+      if (len > 2 && s[1] == ';' && s[2] >= '0' && s[2] <= '9') {
+        status = 0;
+        for (size_t i = 2; i < len && s[i] >= '0' && s[i] <= '9' && status < 100000; i++) {
+          status = status * 10 + (s[i] - '0');
+        }
+      }
+      marks_finish(line, cursor_x, status);
+      break;
+    }
+    default:
+      if (parse_stats) parse_stats->osc_unknown++;
+      break;
+  }
+}
+
+static void dispatch_osc(void) {
+  const char* s = osc_buf.data;
+  size_t len = osc_buf.len;
+
+  int ps = 0;
+  size_t i = 0;
+  while (i < len && s[i] >= '0' && s[i] <= '9') ps = ps * 10 + (s[i++] - '0');
+  if (i >= len || s[i] != ';') {
+    if (parse_stats) parse_stats->osc_unknown++;
+    return;
+  }
+  i++;
+  if (parse_stats) parse_stats->osc_number[ps >= 0 && ps <= STATS_OSC_MAX ? ps : STATS_OSC_MAX + 1]++;
+
+  switch (ps) {
+    case 8:
+      osc8(s + i, len - i);
+      break;
+
+    case 52:
+      osc52(s + i, len - i);
+      break;
+
+    case 133:
+      osc133(s + i, len - i);
+      break;
+
+    default:
+      if (parse_stats) parse_stats->osc_unknown++;
+      break;
+  }
+}
+
+// Whether the OSC collected so far plus the next n bytes starts with "52;"
+static bool osc_is_clipboard(const char* s, uint32_t n) {
+  char head[3];
+  size_t have = 0;
+  for (; have < 3 && have < osc_buf.len; have++) head[have] = osc_buf.data[have];
+  for (uint32_t k = 0; have < 3 && k < n; k++) head[have++] = s[k];
+  return have == 3 && memcmp(head, "52;", 3) == 0;
+}
+
+static void osc_append(const char* s, uint32_t n) {
+  if (osc_overflow || n == 0) return;
+
+  // Clipboard writes get their own cap, everything else is short
+  size_t limit = in_apc ? APC_MAX : OSC_MAX;
+  if (!in_apc && osc_is_clipboard(s, n)) limit += (osc52_limit + 2) / 3 * 4;
+
+  if (osc_buf.len + n > limit) {
+    osc_overflow = true;
+    return;
+  }
+  buffer_append(&osc_buf, s, n);
+}
+
+// APC G ... is a kitty graphics command, its reply goes straight back to the program
+static void dispatch_apc(void) {
+  if (osc_overflow) return;
+  if (osc_buf.len < 1 || osc_buf.data[0] != 'G') {
+    if (parse_stats) parse_stats->apc_unknown++;
+    return;
+  }
+
+  GraphicsContext ctx = {.cursor_line = history_total + cursor_y,
+                         .cursor_col = cursor_x,
+                         .screen_line = history_total,
+                         .screen_rows = term_rows,
+                         .cell_width = cached_char_width,
+                         .cell_height = cached_char_height};
+  static Buffer reply;
+  int cols, rows;
+  buffer_clear(&reply);
+  graphics_command(osc_buf.data + 1, osc_buf.len - 1, &ctx, &reply, &cols, &rows);
+  if (reply.len) writequeue_push(reply.data, reply.len);
+
+  for (int i = 0; i < rows; i++) linefeed();
+  cursor_x += cols;
+  if (cursor_x > term_cols - 1) cursor_x = term_cols - 1;
+}
+
+static void dispatch_string(void) {
+  bool apc = in_apc;
+  in_osc = in_apc = false;
+  if (apc) {
+    dispatch_apc();
+  } else {
+    dispatch_osc();
+  }
+}
+
+// Consumes OSC string bytes up to and including the BEL or ST terminator.
+// Returns 0 when only a trailing ESC is left, so the caller waits for more
+// input, or when an escape at the start cancelled the string (in_osc is then
+// cleared and parsing goes on).
+static uint32_t osc_consume(const char* buf, uint32_t buflen) {
+  uint32_t i = 0;
+  while (i < buflen && buf[i] != '\a' && buf[i] != '\x1b') i++;
+  osc_append(buf, i);
+  if (parse_stats) parse_stats->escape_bytes += i;
+
+  if (i == buflen) return i;
+
+  if (buf[i] == '\a') {
+    if (parse_stats) parse_stats->escape_bytes++;
+    dispatch_string();
+    return i + 1;
+  }
+
+  if (i + 1 >= buflen) return i;  // need the byte after ESC
+
+  // ESC \ is ST, any other escape cancels the string and is parsed normally
+  if (buf[i + 1] == '\\') {
+    if (parse_stats) parse_stats->escape_bytes += 2;
+    dispatch_string();
+    return i + 2;
+  }
+  in_osc = in_apc = false;
+  return i;
+}
+
+// Drops the parameter bytes of an over-long CSI up to and including its final
+// byte. An ESC cancels it instead and is parsed normally.
+static uint32_t csi_discard_consume(const char* buf, uint32_t buflen) {
+  uint32_t i = 0;
+  while (i < buflen && buf[i] != '\x1b' && ((unsigned char)buf[i] < 0x40 || buf[i] == 0x7F)) i++;
+  if (i < buflen) {
+    csi_discard = false;
+    if (buf[i] != '\x1b') i++;
+  }
+  if (parse_stats) parse_stats->escape_bytes += i;
+  return i;
+}
+
 int parse_ansii_escape(const char* buf, uint32_t buflen) {
   if (buflen < 2 || buf[0] != '\x1b') return 0;
 
-  if (buf[1] != '[') return 2;  // Unknown escape, skip ESC + next char
+  last_x = -1;
+
+  if (buf[1] == ']' || buf[1] == '_') {
+    in_osc = true;
+    in_apc = buf[1] == '_';
+    osc_overflow = false;
+    buffer_clear(&osc_buf);
+    if (parse_stats) {
+      parse_stats->escape_bytes += 2;
+      if (in_apc) {
+        parse_stats->apc++;
+      } else {
+        parse_stats->osc++;
+      }
+    }
+    return 2;
+  }
+
+  if (buf[1] != '[') {  // Unknown escape, skip ESC + next char
+    if (parse_stats) {
+      parse_stats->escape_bytes += 2;
+      parse_stats->esc++;
+      parse_stats->esc_unknown++;
+    }
+    return 2;
+  }
 
   uint32_t i = 2;
+  uint64_t stats_start = parse_stats ? stats_csi_start() : 0;
 
   memset(&current_csi, 0, sizeof(current_csi));
 
-  // Skip optional '?' (used in private mode sequences like bracketed paste)
-  if (i < buflen && buf[i] == '?') {
-    current_csi.prefix = '?';
+  // Optional private marker, '?' for DEC modes, '>' for secondary DA and XTVERSION
+  if (i < buflen && buf[i] >= '<' && buf[i] <= '?') {
+    current_csi.prefix = buf[i];
     i++;
   }
 
@@ -411,6 +1019,8 @@ int parse_ansii_escape(const char* buf, uint32_t buflen) {
     current_csi.params[current_csi.nparams++] = num;
   }
 
+  while (i < buflen && buf[i] >= 0x20 && buf[i] <= 0x2F) current_csi.intermediate = buf[i++];
+
   if (i >= buflen) return 0;
 
   current_csi.cmd[0] = buf[i];
@@ -418,19 +1028,70 @@ int parse_ansii_escape(const char* buf, uint32_t buflen) {
 
   parse_csi();
 
+  if (parse_stats) {
+    parse_stats->escape_bytes += i + 1;
+    stats_csi(current_csi.prefix, buf[i], stats_start);
+  }
   return i + 1;
 }
 
-// reads byte currently avaliable form the PTY decodes them prints their codepoint to the console
-size_t readfrompty(void) {
-  static char buf[SHRT_MAX];
-  static uint32_t buflen = 0;
+static void collect_row(Row* row) {
+  int cols = rowpool_cols(row);
+  uint32_t* codepoints = row_words(row, ROW_CODEPOINTS);
+  uint32_t* links = row_words(row, ROW_LINKS);
+  for (int x = 0; x < cols; x++) {
+    codepoints[x] = cluster_gc_keep(codepoints[x]);
+    links[x] = link_gc_keep(links[x]);
+  }
+}
 
-  int nbytes = read(masterfd, buf + buflen, sizeof(buf) - buflen);
-  buflen += nbytes;
+// Rebuilds the cluster and link arenas from the ids still on screen or in history
+static void collect_arenas(void) {
+  cluster_gc_begin();
+  link_gc_begin();
+  for (int y = 0; y < screen_alloc; y++) collect_row(screen[y]);
+  for (int i = 0; i < history_count; i++) collect_row(history[(history_total - 1 - i) % history_cap]);
+  current_link = link_gc_keep(current_link);
+  hover.id = link_gc_keep(hover.id);
+  link_gc_end();
+  cluster_gc_end();
+}
+
+// Appends a cell's codepoint or whole grapheme cluster as UTF-8, returns bytes written
+static int encode_cell(uint32_t codepoint, char* out) {
+  const uint32_t* cps;
+  int n = cluster_codepoints(codepoint, &cps);
+  if (!n) return utf8encode(codepoint, out);
+
+  int len = 0;
+  for (int i = 0; i < n; i++) {
+    int k = utf8encode(cps[i], out + len);
+    if (k > 0) len += k;
+  }
+  return len;
+}
 
+// Bytes read but not parsed yet, a sequence split across reads waits here
+static char buf[SHRT_MAX];
+static uint32_t buflen = 0;
+
+// Decodes buf and prints its codepoints to the grid, keeping an incomplete
+// trailing sequence for the next call
+static void parse_input(void) {
   uint32_t iter = 0;
   while (iter < buflen) {
+    if (in_osc) {
+      uint32_t consumed = osc_consume(&buf[iter], buflen - iter);
+      if (consumed == 0 && in_osc) break;
+      iter += consumed;
+      continue;
+    }
+
+    if (csi_discard) {
+      iter += csi_discard_consume(&buf[iter], buflen - iter);
+      continue;
+    }
+
     if (buf[iter] == '\x1b') {
       int consumed = parse_ansii_escape(&buf[iter], buflen - iter);
       if (consumed == 0) break;
@@ -438,80 +1099,568 @@ size_t readfrompty(void) {
       continue;
     }
 
-    uint32_t codepoint;
-    int32_t len = utf8decode(&buf[iter], &codepoint);
-
-    if (len == -1 || len > buflen) break;
+    unsigned char c = (unsigned char)buf[iter];
+    if (c >= 0x20 && c != 0x7F) {
+      // printable text up to the next control byte, decoded in blocks
+      uint32_t cps[DECODE_BATCH];
+      size_t consumed;
+      size_t n = utf8_decode_run(&buf[iter], buflen - iter, cps, DECODE_BATCH, &consumed);
+      if (consumed == 0) break;  // split across reads
+      for (size_t i = 0; i < n;) {
+        size_t ascii = print_ascii(cps + i, n - i);
+        if (ascii) {
+          i += ascii;
+        } else {
+          print_codepoint(cps[i++]);
+        }
+      }
+      if (parse_stats) stats_text(&buf[iter], consumed);
+      iter += consumed;
+      continue;
+    }
 
-    if (codepoint == 10) {
+    if (c == 10) {
       cursor_x = 0;
-      cursor_y++;
-    } else if (codepoint == 8 || codepoint == 127) {
+      linefeed();
+      last_x = -1;
+    } else if (c == 8 || c == 127) {
       // backspace
       if (cursor_x > 0) cursor_x--;
-    } else if (codepoint == 13) {
+      last_x = -1;
+    } else if (c == 13) {
       // return
       cursor_x = 0;
-    } else {
-      screen[cursor_y][cursor_x].codepoint = codepoint;
-      screen[cursor_y][cursor_x].fg_color = current_fg_color;
-      screen[cursor_y][cursor_x].bg_color = current_bg_color;
-      screen[cursor_y][cursor_x].bold = current_bold;
-
-      recent_codepoint = codepoint;
+      last_x = -1;
+    } else if (c == 9) {
+      // tab stops every 8 columns
+      cursor_x = (cursor_x / 8 + 1) * 8;
+      if (cursor_x >= term_cols) cursor_x = term_cols - 1;
+      last_x = -1;
+    }
+    if (parse_stats) parse_stats->control_bytes++;
 
-      cursor_x++;
+    iter++;
+  }
 
-      if (cursor_x >= term_cols) {  // wrap to next line
-        cursor_x = 0;
-        cursor_y++;
-      }
+  // a CSI that fills all of buf can never complete, it's dropped up to its
+  // final byte so input keeps moving
+  if (iter == 0 && buflen == sizeof(buf)) {
+    csi_discard = true;
+    iter = buflen;
+  }
 
-      if (cursor_y >= term_rows) {
-        memmove(screen[0], screen[1], sizeof(Cell) * MAX_COLS * (term_rows - 1));
-        memset(screen[term_rows - 1], 0, sizeof(Cell) * MAX_COLS);
-        cursor_y = term_rows - 1;
-      }
+  if (parse_stats && (iter < buflen || in_osc)) {
+    if (in_osc || buf[iter] == '\x1b') {
+      parse_stats->split_escapes++;
+    } else {
+      parse_stats->split_utf8++;
     }
-
-    iter += len;
   }
-
   if (iter < buflen) {
     memmove(buf, buf + iter, buflen - iter);
   }
   buflen -= iter;
+
+  if (cluster_needs_gc() || link_needs_gc()) collect_arenas();
+}
+
+// Parses bytes that didn't come from the PTY
+static void feed_input(const char* data, size_t len) {
+  while (len > 0) {
+    size_t n = sizeof(buf) - buflen < len ? sizeof(buf) - buflen : len;
+    memcpy(buf + buflen, data, n);
+    buflen += n;
+    data += n;
+    len -= n;
+    parse_input();
+  }
+}
+
+// Jump scroll. A large read with more input right behind it means output is
+// flooding in, so whatever else is already waiting is read ahead. Lines that
+// would scroll out of the history before the next frame are then only scanned
+// for escape sequences: attributes, modes, links and images keep their state,
+// the text is dropped. Reading ahead and parsing stop at the scheduler's
+// deadline, what's left of flood is carried into the next slice.
+static bool jump_scroll_enabled = true;
+static Buffer flood;
+static size_t flood_at = 0;  // flood is parsed up to here
+
+static bool flood_pending(void) { return flood_at < flood.len; }
+
+static int read_input(char* dst, size_t len) {
+  int nbytes = replay_active() ? replay_read(dst, len) : ptyio_read(dst, len);
+  if (nbytes <= 0) return nbytes;
+  record_output(dst, nbytes);
+  hud_count_parsed(nbytes);
+  if (parse_stats) parse_stats->reads++;
   return nbytes;
 }
 
-// TODO: rid this project of this dogshit
-void copy_selection_to_clipboard(GLFWwindow* window) {
-  int min_y = sel_start_y < sel_end_y ? sel_start_y : sel_end_y;
-  int max_y = sel_start_y > sel_end_y ? sel_start_y : sel_end_y;
-  int min_x = sel_start_y < sel_end_y
-                  ? sel_start_x
-                  : (sel_start_y == sel_end_y ? (sel_start_x < sel_end_x ? sel_start_x : sel_end_x) : sel_end_x);
-  int max_x = sel_start_y > sel_end_y
-                  ? sel_start_x
-                  : (sel_start_y == sel_end_y ? (sel_start_x > sel_end_x ? sel_start_x : sel_end_x) : sel_end_x);
+static bool input_waiting(void) { return replay_active() ? replay_pending() : ptyio_readable(); }
+
+// Offset just past the last CSI sequence in data that can move the cursor up
+// the screen or change rows other than the cursor's, 0 when there is none.
+// With enough line feeds after the rest, every row on screen before them ends
+// up scrolled off. Text and CSIs that keep the cursor on its row qualify, and
+// so do the ones parse_csi() ignores.
+static size_t last_mutation(const char* data, size_t len) {
+  const char* end = data + len;
+  size_t last = 0;
+  for (const char* p = memchr(data, '\x1b', len); p; p = memchr(p, '\x1b', end - p)) {
+    p++;
+    if (p == end) break;
+    if (*p != '[') continue;
+
+    p++;
+    char prefix = p < end && *p >= '<' && *p <= '?' ? *p++ : 0;
+    while (p < end && ((*p >= '0' && *p <= '9') || *p == ';')) p++;
+    const char* intermediates = p;
+    while (p < end && *p >= 0x20 && *p <= 0x2F) p++;
+    if (p == end) break;
+
+    bool ignored = (prefix && prefix != '?') || p > intermediates;
+    if (!ignored && (!*p || !strchr("mKXP@G`CaDhln", *p))) last = p + 1 - data;
+  }
+  return last;
+}
+
+// Offset where the lines worth parsing start, 0 when nothing can be skipped.
+// The kept part needs a line feed for each history line plus two screens:
+// one in case the cursor starts at the top, one for the rows left on screen.
+// Only text after the last sequence that could mutate the screen is skipped,
+// *from, and everything before it is parsed as usual.
+static size_t jump_scroll_start(const char* data, size_t len, size_t* from) {
+  int64_t keep = (int64_t)(history_cap > 0 ? history_cap : 0) + 2 * term_rows;
+  size_t at = len;
+  for (; keep > 0; keep--) {
+    while (at > 0 && data[at - 1] != '\n') at--;
+    if (at == 0) return 0;
+    at--;
+  }
+  if (last_mutation(data + at, len - at)) return 0;
+  *from = last_mutation(data, at + 1);
+  return at + 1;
+}
 
-  char buffer[MAX_ROWS * MAX_COLS * 4];
-  int pos = 0;
+// A line scrolled off without being stored. History can't have a gap, so
+// what's left of it is dropped, the kept part refills it.
+static void skip_line(void) {
+  history_total++;
+  history_count = 0;
+  view_offset = 0;
+}
 
-  for (int y = min_y; y <= max_y && y < MAX_ROWS; y++) {
-    int start_x = (y == min_y) ? min_x : 0;
-    int end_x = (y == max_y) ? max_x : term_cols - 1;
+// Moves the cursor over codepoints the way printing them would, wrapping at
+// the right margin
+static void skip_codepoints(const uint32_t* cps, size_t n) {
+  for (size_t i = 0; i < n;) {
+    size_t ascii = 0;
+    while (i + ascii < n && cps[i + ascii] < 0x7F) ascii++;
+    if (ascii) {
+      for (cursor_x += (int)ascii; cursor_x >= term_cols; cursor_x -= term_cols) skip_line();
+      i += ascii;
+      continue;
+    }
 
-    for (int x = start_x; x <= end_x && x < term_cols; x++) {
-      if (screen[y][x].codepoint) {
-        pos += utf8encode(screen[y][x].codepoint, &buffer[pos]);
+    int width = unicode_width(unicode_props(cps[i++]));
+    if (width == 0 || width == UNICODE_WIDTH_CONTROL) continue;
+    if (width == 2 && cursor_x == term_cols - 1) {
+      cursor_x = 0;
+      skip_line();
+    }
+    cursor_x += width;
+    if (cursor_x >= term_cols) {
+      cursor_x = 0;
+      skip_line();
+    }
+  }
+}
+
+// Runs the escape sequences in data through the parser and moves the cursor
+// over the text between them without storing it. Each line feed or wrap
+// counts as a line right away, so marks and images further on land on the
+// line they belong to. Stops early at a sequence cut off by the end of data.
+static size_t skip_text(const char* data, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if (in_osc) {
+      uint32_t consumed = osc_consume(data + i, len - i);
+      if (consumed == 0 && in_osc) break;
+      i += consumed;
+      continue;
+    }
+    if (csi_discard) {
+      i += csi_discard_consume(data + i, len - i);
+      continue;
+    }
+    if (data[i] == '\x1b') {
+      int consumed = parse_ansii_escape(data + i, len - i);
+      if (consumed == 0) break;
+      i += consumed;
+      continue;
+    }
+
+    unsigned char c = (unsigned char)data[i];
+    size_t consumed = 1;
+    if (c >= 0x20 && c != 0x7F) {
+      uint32_t cps[DECODE_BATCH];
+      size_t n = utf8_decode_run(data + i, len - i, cps, DECODE_BATCH, &consumed);
+      if (consumed == 0) break;
+      skip_codepoints(cps, n);
+    } else if (c == 10) {
+      cursor_x = 0;
+      skip_line();
+    } else if (c == 8 || c == 127) {
+      if (cursor_x > 0) cursor_x--;
+    } else if (c == 13) {
+      cursor_x = 0;
+    } else if (c == 9) {
+      cursor_x = (cursor_x / 8 + 1) * 8;
+      if (cursor_x >= term_cols) cursor_x = term_cols - 1;
+    }
+    if (parse_stats) parse_stats->skipped_bytes += consumed;
+    i += consumed;
+  }
+  last_x = -1;
+  return i;
+}
+
+// Parses flood on to end, at least one buffer's worth however late. False
+// when the deadline came first.
+static bool feed_flood(size_t end, double deadline) {
+  for (bool first = true; flood_at < end; first = false) {
+    if (!first && glfwGetTime() >= deadline) return false;
+    size_t n = end - flood_at < sizeof(buf) ? end - flood_at : sizeof(buf);
+    feed_input(flood.data + flood_at, n);
+    flood_at += n;
+  }
+  return true;
+}
+
+// Parses buf and what's left of flood along with everything waiting behind
+// them until deadline, returns the bytes read beyond buf
+static size_t jump_scroll(double deadline) {
+  if (flood_at > 0) {
+    memmove(flood.data, flood.data + flood_at, flood.len - flood_at);
+    flood.len -= flood_at;
+    flood_at = 0;
+  }
+  if (!buffer_append(&flood, buf, buflen)) {
+    parse_input();
+    return 0;
+  }
+  buflen = 0;
+
+  size_t extra = 0;
+  while (flood.len < JUMP_SCROLL_MAX && input_waiting() && glfwGetTime() < deadline) {
+    int n = read_input(buf, sizeof(buf));
+    if (n <= 0 || !buffer_append(&flood, buf, n)) break;
+    extra += n;
+  }
+
+  // Skipped lines still count, the kept ones refill the history ring. A
+  // sequence cut off before the skipped part leaves nothing to skip this time.
+  size_t from = 0, to = jump_scroll_start(flood.data, flood.len, &from);
+  bool on_time = feed_flood(to ? from : 0, deadline);
+  if (to && on_time && buflen == 0) flood_at += skip_text(flood.data + from, to - from);
+  if (on_time) feed_flood(flood.len, deadline);
+
+  // an escape sequence cut off at the end of buf is the tail of what was fed
+  if (flood_pending()) {
+    flood_at -= buflen;
+    buflen = 0;
+  }
+  return extra;
+}
+
+// reads byte currently avaliable form the PTY decodes them prints their codepoint to the console.
+// A flood is parsed until deadline (glfwGetTime() seconds), the rest on later calls.
+size_t readfrompty(double deadline) {
+  uint64_t trace_start = trace_begin();
+  size_t total = 0;
+  if (flood_pending()) {
+    total = jump_scroll(deadline);
+    trace_end_arg("readfrompty", trace_start, "bytes", total);
+    return total;
+  }
+
+  int nbytes = read_input(buf + buflen, sizeof(buf) - buflen);
+  if (nbytes <= 0) return 0;
+  buflen += nbytes;
+
+  total = nbytes;
+  if (jump_scroll_enabled && nbytes >= JUMP_SCROLL_READ && input_waiting()) {
+    total += jump_scroll(deadline);
+  } else {
+    parse_input();
+  }
+  trace_end_arg("readfrompty", trace_start, "bytes", total);
+  return total;
+}
+
+// Selection normalized so (min_x, min_y) comes first, both ends inclusive
+static void selection_bounds(int* min_x, int64_t* min_y, int* max_x, int64_t* max_y) {
+  bool forward = sel_start_y < sel_end_y || (sel_start_y == sel_end_y && sel_start_x <= sel_end_x);
+  *min_x = forward ? sel_start_x : sel_end_x;
+  *min_y = forward ? sel_start_y : sel_end_y;
+  *max_x = forward ? sel_end_x : sel_start_x;
+  *max_y = forward ? sel_end_y : sel_start_y;
+}
+
+// Appends cells [start_x, end_x] of a row as UTF-8, dropping trailing blanks
+static void encode_row(Buffer* out, const Row* row, int start_x, int end_x) {
+  const uint32_t* codepoints = row_words(row, ROW_CODEPOINTS);
+  const uint8_t* flags = row_flags(row);
+  while (end_x >= start_x && !codepoints[end_x]) end_x--;
+  if (end_x < start_x || !buffer_reserve(out, (size_t)(end_x - start_x + 1) * 4)) return;
+
+  char* p = out->data + out->len;
+  for (int x = start_x; x <= end_x; x++) {
+    uint32_t cp = codepoints[x];
+    if (cp < 0x80) {
+      if (!(flags[x] & CELL_WIDE_CONT)) *p++ = cp ? (char)cp : ' ';
+    } else if (cp & CELL_CLUSTER) {
+      // clusters can be longer than the 4 bytes per cell reserved above
+      out->len = p - out->data;
+      if (!buffer_reserve(out, CLUSTER_MAX_CODEPOINTS * 4 + (size_t)(end_x - x + 1) * 4)) return;
+      p = out->data + out->len;
+      p += encode_cell(cp, p);
+    } else {
+      int n = utf8encode(cp, p);
+      if (n > 0) p += n;
+    }
+  }
+  out->len = p - out->data;
+}
+
+// False when there is no selection, so the key can go to the shell instead
+bool copy_selection_to_clipboard(GLFWwindow* window) {
+  if (!selecting) return false;
+
+  int min_x, max_x;
+  int64_t min_y, max_y;
+  selection_bounds(&min_x, &min_y, &max_x, &max_y);
+
+  // Size for the all-ASCII case up front, so even huge copies rarely regrow
+  buffer_clear(&clipboard_buf);
+  if (!buffer_reserve(&clipboard_buf, (size_t)(max_y - min_y + 1) * (term_cols + 1) + 1)) return true;
+
+  for (int64_t y = min_y; y <= max_y; y++) {
+    const Row* row = line_at(y);
+    if (row) {
+      int start_x = (y == min_y) ? min_x : 0;
+      int end_x = (y == max_y) ? max_x : term_cols - 1;
+      int cols = row_cols(row);
+      encode_row(&clipboard_buf, row, start_x, end_x < cols ? end_x : cols - 1);
+    }
+    if (y < max_y) buffer_putc(&clipboard_buf, '\n');
+  }
+
+  if (buffer_putc(&clipboard_buf, '\0')) {
+    glfwSetClipboardString(window, clipboard_buf.data);
+  }
+
+  if (clipboard_buf.cap > CLIPBOARD_KEEP_BYTES) buffer_free(&clipboard_buf);
+  return true;
+}
+
+// Queues the clipboard for the shell. The whole paste is buffered at once and
+// drained on POLLOUT, so large pastes never block rendering.
+void paste_from_clipboard(GLFWwindow* window) {
+  const char* text = glfwGetClipboardString(window);
+  if (!text || !*text) return;
+
+  if (!bracketed_paste) {
+    writequeue_push(text, strlen(text));
+    return;
+  }
+
+  // Drop ESC so the pasted text can't end bracketed paste early
+  writequeue_push("\x1b[200~", 6);
+  for (const char* p = text; *p;) {
+    const char* esc = strchr(p, '\x1b');
+    size_t n = esc ? (size_t)(esc - p) : strlen(p);
+    writequeue_push(p, n);
+    p += n;
+    if (esc) p++;
+  }
+  writequeue_push("\x1b[201~", 6);
+}
+
+// Absolute line number under a window row
+static int64_t grid_to_line(int grid_y) { return history_total - view_offset + grid_y; }
+
+static void cursor_to_grid(double xpos, double ypos, int* grid_x, int* grid_y) {
+  *grid_x = (int)((xpos - cached_padding_x) / cached_char_width);
+  *grid_y = (int)((ypos - cached_padding_y) / cached_char_height);
+
+  if (*grid_x < 0) *grid_x = 0;
+  if (*grid_y < 0) *grid_y = 0;
+  if (*grid_x >= term_cols) *grid_x = term_cols - 1;
+  if (*grid_y >= term_rows) *grid_y = term_rows - 1;
+}
+
+// Finds the link covering column x of an absolute line: an OSC 8 link on the
+// cell, or a URL or file:line reference in the row's text. Detection results
+// are cached by line generation, so a row is only scanned after it changes.
+static bool link_at(int64_t line, int x, HoverLink* out) {
+  static uint32_t* text = NULL;
+  static int text_cap = 0;
+
+  const Row* row = line_at(line);
+  if (!row || x >= row_cols(row)) return false;
+
+  uint64_t gen = line_gen(line);
+  const uint32_t* links = row_words(row, ROW_LINKS);
+  uint32_t id = links[x];
+  if (id) {
+    int x0 = x, x1 = x;
+    while (x0 > 0 && links[x0 - 1] == id) x0--;
+    while (x1 + 1 < row_cols(row) && links[x1 + 1] == id) x1++;
+    *out = (HoverLink){.active = true, .line = line, .gen = gen, .x0 = x0, .x1 = x1, .id = id};
+    return true;
+  }
+
+  const LinkSpan* spans;
+  int n = links_cached(gen, &spans);
+  if (n < 0) {
+    int cols = rowpool_cols(row);
+    if (cols > text_cap) {
+      uint32_t* grown = realloc(text, sizeof(*text) * cols);
+      if (!grown) return false;
+      text = grown;
+      text_cap = cols;
+    }
+    const uint32_t* codepoints = row_words(row, ROW_CODEPOINTS);
+    const uint8_t* flags = row_flags(row);
+    for (int i = 0; i < cols; i++) {
+      const uint32_t* cps;
+      uint32_t cp = codepoints[i];
+      if (cluster_codepoints(cp, &cps)) cp = cps[0];
+      // the right half of a wide character continues its text
+      if ((flags[i] & CELL_WIDE_CONT) && i > 0) cp = text[i - 1];
+      text[i] = cp;
+    }
+    n = links_scan(gen, text, cols, &spans);
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (x < spans[i].x0 || x > spans[i].x1) continue;
+    *out = (HoverLink){
+        .active = true, .line = line, .gen = gen, .x0 = spans[i].x0, .x1 = spans[i].x1, .kind = spans[i].kind};
+    return true;
+  }
+  return false;
+}
+
+// Hit-tests the last pointer position, returns whether the hovered link changed
+static bool update_hover(void) {
+  HoverLink found = {0};
+  if (mouse_x >= 0) {
+    int grid_x, grid_y;
+    cursor_to_grid(mouse_x, mouse_y, &grid_x, &grid_y);
+    link_at(grid_to_line(grid_y), grid_x, &found);
+  }
+
+  bool changed = found.active != hover.active || found.line != hover.line || found.x0 != hover.x0 ||
+                 found.x1 != hover.x1 || found.gen != hover.gen;
+  if (found.active != hover.active) window_set_link_cursor(found.active);
+  hover = found;
+  return changed;
+}
+
+// Drops a trailing ":line" or ":line:col" from a file reference
+static void strip_line_suffix(Buffer* text) {
+  for (int part = 0; part < 2; part++) {
+    size_t i = text->len;
+    while (i > 0 && text->data[i - 1] >= '0' && text->data[i - 1] <= '9') i--;
+    if (i == text->len || i == 0 || text->data[i - 1] != ':') return;
+    text->len = i - 1;
+  }
+}
+
+static void open_hovered_link(void) {
+  const Row* row = line_at(hover.line);
+  if (!row) return;
+
+  Buffer target = {0};
+  if (hover.id) {
+    size_t len;
+    const char* uri = link_uri(hover.id, &len);
+    buffer_append(&target, uri, len);
+  } else if (hover.kind == LINK_FILE) {
+    // paths are relative to the shell, not to us
+    Buffer path = {0};
+    encode_row(&path, row, hover.x0, hover.x1);
+    strip_line_suffix(&path);
+
+    char dir[4096];
+    const char* home = getenv("HOME");
+    if (path.len > 1 && path.data[0] == '~' && path.data[1] == '/' && home) {
+      buffer_append(&target, home, strlen(home));
+      buffer_append(&target, path.data + 1, path.len - 1);
+    } else {
+      if (path.len && path.data[0] != '/' && platform_process_cwd(child_pid, dir, sizeof(dir))) {
+        buffer_append(&target, dir, strlen(dir));
+        buffer_putc(&target, '/');
       }
+      buffer_append(&target, path.data, path.len);
     }
-    if (y < max_y) buffer[pos++] = '\n';
+    buffer_free(&path);
+  } else {
+    encode_row(&target, row, hover.x0, hover.x1);
+  }
+
+  if (target.len && buffer_putc(&target, '\0')) platform_open_link(target.data);
+  buffer_free(&target);
+}
+
+// Selects and copies the output of the command at the top of the view, or the
+// newest one with output when not scrolled back. A command still running
+// gives what it has printed so far.
+static void copy_command_output(void) {
+  int64_t line = view_offset ? history_total - view_offset : history_total + cursor_y;
+  const PromptMark* m = marks_output_at(line);
+  if (!m) return;
+
+  int64_t start = m->output, end = m->end >= 0 ? m->end : history_total + cursor_y;
+  int start_col = m->output_col, end_col = m->end >= 0 ? m->end_col : cursor_x;
+  if (end_col == 0) {  // ended at the start of a line, the output is everything above
+    end--;
+    end_col = term_cols;
+  }
+  if (end < start || (end == start && end_col <= start_col)) return;
+  if (start < history_total - history_count) {
+    start = history_total - history_count;
+    start_col = 0;
   }
-  buffer[pos] = '\0';
 
-  glfwSetClipboardString(window, buffer);
+  selecting = true;
+  sel_start_x = start_col;
+  sel_start_y = start;
+  sel_end_x = end_col - 1;
+  sel_end_y = end;
+  copy_selection_to_clipboard(window_get_glfw_window());
+  redraw_requested = true;
+}
+
+// -1 and +1 scroll the previous or next prompt to the top of the view, past
+// the last one back to the bottom. 0 copies a command's output.
+static void jump_to_mark(int step) {
+  marks_forget_before(history_total - history_count);
+  if (step == 0) {
+    copy_command_output();
+    return;
+  }
+
+  int64_t top = history_total - view_offset;
+  const PromptMark* m = step < 0 ? marks_at(top - 1) : marks_after(top);
+  if (!m && step < 0) return;
+
+  int64_t offset = m && m->prompt < history_total ? history_total - m->prompt : 0;
+  view_offset = offset < history_count ? (int)offset : history_count;
+  redraw_requested = true;
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
@@ -519,18 +1668,25 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     double xpos, ypos;
     glfwGetCursorPos(window, &xpos, &ypos);
 
-    int grid_x = (int)((xpos - cached_padding_x) / cached_char_width);
-    int grid_y = (int)((ypos - cached_padding_y) / cached_char_height);
-
-    if (grid_x < 0) grid_x = 0;
-    if (grid_y < 0) grid_y = 0;
-    if (grid_x >= term_cols) grid_x = term_cols - 1;
-    if (grid_y >= term_rows) grid_y = term_rows - 1;
+    int grid_x, grid_y;
+    cursor_to_grid(xpos, ypos, &grid_x, &grid_y);
+
+    // Ctrl-click (Cmd-click on macOS) opens the link under the pointer
+    if (action == GLFW_PRESS && (mods & (GLFW_MOD_CONTROL | GLFW_MOD_SUPER))) {
+      mouse_x = xpos;
+      mouse_y = ypos;
+      update_hover();
+      if (hover.active) {
+        open_hovered_link();
+        return;
+      }
+    }
 
     if (action == GLFW_PRESS) {
       selecting = true;
       sel_start_x = sel_end_x = grid_x;
-      sel_start_y = sel_end_y = grid_y;
+      sel_start_y = sel_end_y = grid_to_line(grid_y);
+      redraw_requested = true;
     } else if (action == GLFW_RELEASE) {
       // Keep selection but stop dragging
     }
@@ -538,20 +1694,33 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 }
 
 void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
-  if (selecting && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-    int grid_x = (int)((xpos - cached_padding_x) / cached_char_width);
-    int grid_y = (int)((ypos - cached_padding_y) / cached_char_height);
+  mouse_x = xpos;
+  mouse_y = ypos;
+  if (update_hover()) redraw_requested = true;
 
-    if (grid_x < 0) grid_x = 0;
-    if (grid_y < 0) grid_y = 0;
-    if (grid_x >= term_cols) grid_x = term_cols - 1;
-    if (grid_y >= term_rows) grid_y = term_rows - 1;
+  if (selecting && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+    int grid_x, grid_y;
+    cursor_to_grid(xpos, ypos, &grid_x, &grid_y);
 
     sel_end_x = grid_x;
-    sel_end_y = grid_y;
+    sel_end_y = grid_to_line(grid_y);
+    redraw_requested = true;
   }
 }
 
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
+  view_offset += (int)(yoffset * 3);
+  if (view_offset > history_count) view_offset = history_count;
+  if (view_offset < 0) view_offset = 0;
+
+  // Dragging while scrolling extends the selection into history
+  double xpos, ypos;
+  glfwGetCursorPos(window, &xpos, &ypos);
+  cursor_position_callback(window, xpos, ypos);
+
+  redraw_requested = true;
+}
+
 void get_ansi_color(uint8_t color, uint8_t bold, float* r, float* g, float* b) {
   // Basic 16 colors (0-7 normal, 8-15 bright)
   static const float colors[16][3] = {
@@ -581,42 +1750,127 @@ void get_ansi_color(uint8_t color, uint8_t bold, float* r, float* g, float* b) {
   *b = colors[idx][2];
 }
 
+// Returns the columns up to and including the last glyph drawn
+static int draw_row_text(const Row* row, float x0, float baseline, float char_width) {
+  int used = 0;
+  int cols = row_cols(row);
+  const uint32_t* codepoints = row_words(row, ROW_CODEPOINTS);
+  const uint32_t* styles = row_words(row, ROW_STYLES);
+  for (int x = cells_find_nonzero(codepoints, 0, cols); x < cols; x = cells_find_nonzero(codepoints, x + 1, cols)) {
+    uint32_t codepoint = codepoints[x];
+    char str[CLUSTER_MAX_CODEPOINTS * 4 + 1];
+    int len = 1;
+    if (codepoint < 128) {
+      str[0] = (char)codepoint;
+    } else {
+      len = encode_cell(codepoint, str);
+    }
+    str[len > 0 ? len : 0] = '\0';
+
+    float r, g, b;
+    get_ansi_color(STYLE_FG(styles[x]), STYLE_BOLD(styles[x]), &r, &g, &b);
+    window_set_text_color(r, g, b);
+
+    window_draw_text(x0 + x * char_width, baseline, str);
+    cells_rendered++;
+    used = x + 1;
+  }
+  return used;
+}
+
+// Composites the visible rows from the row cache, drawing only those whose
+// text changed since they were cached. Scrolled rows keep their slot, so a
+// scroll redraws just the lines that came in. False when there is no cache.
+static bool draw_rows_cached(int64_t first_line, int window_width, float padding_x, float padding_y, float char_width,
+                             float char_height) {
+  if (!row_cache_enabled) return false;
+
+  int slots = window_row_cache_reserve(term_rows * 2);
+  if (slots < term_rows) return false;
+
+  if (slots != row_cache_slots || window_width != row_cache_width || char_width != row_cache_char_width ||
+      text_scale != row_cache_text_scale) {
+    CachedRow* grown = realloc(cached_rows, sizeof(*cached_rows) * slots);
+    if (!grown) return false;
+    cached_rows = grown;
+    for (int i = 0; i < slots; i++) cached_rows[i] = (CachedRow){.line = -1};
+    row_cache_slots = slots;
+    row_cache_width = window_width;
+    row_cache_char_width = char_width;
+    row_cache_text_scale = text_scale;
+  }
+
+  bool drawing = false;
+  for (int y = 0; y < term_rows; y++) {
+    int64_t line = first_line + y;
+    const Row* row = line_at(line);
+    if (!row) continue;
+
+    CachedRow* cached = &cached_rows[line % slots];
+    uint64_t gen = line_gen(line);
+    if (cached->line == line && cached->gen == gen) continue;
+
+    if (!drawing) window_row_cache_begin();
+    drawing = true;
+    float baseline = window_row_cache_select(line % slots);
+    int used = draw_row_text(row, padding_x, baseline, char_width);
+    *cached = (CachedRow){.line = line, .gen = gen, .used_cols = used};
+  }
+  if (drawing) window_row_cache_end();
+
+  // Glyphs can overhang their cell, one more column covers them
+  for (int y = 0; y < term_rows; y++) {
+    int64_t line = first_line + y;
+    const CachedRow* cached = &cached_rows[line % slots];
+    if (cached->line != line || !cached->used_cols) continue;
+    float width = padding_x + (cached->used_cols + 1) * char_width;
+    window_row_cache_draw(line % slots, padding_y + y * char_height, width);
+  }
+  window_row_cache_flush();
+  return true;
+}
+
 void render_terminal(void) {
   static int last_cols = 0, last_rows = 0;
+  uint64_t trace_start = trace_begin();
+  uint64_t trace_phase = trace_start;
   int window_width, window_height;
   window_get_size(&window_width, &window_height);
 
-  float padding_x = 0.0f;
-  float padding_y = 30.0f;
+  float padding_x = PADDING_X;
+  float padding_y = PADDING_Y;
 
   float avaliable_width = window_width - (padding_x * 2);
   float avaliable_height = window_height - (padding_y * 2);
 
-  const int target_cols = 120;
-  const int target_rows = 40;
-
   float char_width = avaliable_width / target_cols;
   float char_height = avaliable_height / target_rows;
 
-  const float aspect_ratio = 1.9f;  // for monospace char width is usually ~2x char_width
+  const float aspect_ratio = CELL_ASPECT;
 
   if (char_height / char_width > aspect_ratio) {
     char_height = char_width * aspect_ratio;  // too tall
   } else {
     char_width = char_height / aspect_ratio;  // too wide
   }
+  char_width *= font_zoom;
+  char_height *= font_zoom;
 
-  term_cols = (int)(avaliable_width / char_width);
-  term_rows = (int)(avaliable_height / char_height);
+  // Only a scale for the glyphs, the atlas is never rasterized again
+  text_scale = font_zoom * window_get_content_scale();
+  window_set_text_scale(text_scale);
+  float baseline_offset = BASELINE_OFFSET * text_scale;
 
-  if (term_cols > MAX_COLS) term_cols = MAX_COLS;
-  if (term_rows > MAX_ROWS) term_rows = MAX_ROWS;
+  int cols = fixed_cols ? fixed_cols : (int)(avaliable_width / char_width);
+  int rows = fixed_rows ? fixed_rows : (int)(avaliable_height / char_height);
+  grid_resize(cols > 0 ? cols : 1, rows > 0 ? rows : 1);
 
   if (term_cols != last_cols || term_rows != last_rows) {
     struct winsize ws = {
         .ws_row = term_rows, .ws_col = term_cols, .ws_xpixel = window_width, .ws_ypixel = window_height};
 
-    ioctl(masterfd, TIOCSWINSZ, &ws);
+    if (!replay_active()) ioctl(masterfd, TIOCSWINSZ, &ws);
+    record_resize(term_cols, term_rows);
     last_cols = term_cols;
     last_rows = term_rows;
   }
@@ -628,23 +1882,28 @@ void render_terminal(void) {
   cached_padding_y = padding_y;
 
   float cursor_x_px = cursor_x * char_width;
-  float cursor_y_px = (padding_y + -13.0f) + cursor_y * char_height;
-
-  // Calculate selection bounds
-  int min_y = sel_start_y < sel_end_y ? sel_start_y : sel_end_y;
-  int max_y = sel_start_y > sel_end_y ? sel_start_y : sel_end_y;
-  int min_x = sel_start_y < sel_end_y
-                  ? sel_start_x
-                  : (sel_start_y == sel_end_y ? (sel_start_x < sel_end_x ? sel_start_x : sel_end_x) : sel_end_x);
-  int max_x = sel_start_y > sel_end_y
-                  ? sel_start_x
-                  : (sel_start_y == sel_end_y ? (sel_start_x > sel_end_x ? sel_start_x : sel_end_x) : sel_end_x);
+  float cursor_y_px = (padding_y - baseline_offset) + (cursor_y + view_offset) * char_height;
+
+  int64_t first_line = grid_to_line(0);
+  cells_rendered = 0;
+
+  // output may have moved or rewritten the text under a stationary pointer
+  update_hover();
+  trace_end("layout", trace_phase);
 
   // Draw selection highlight
+  trace_phase = trace_begin();
   if (selecting) {
-    for (int y = min_y; y <= max_y && y < term_rows; y++) {
-      int start_x = (y == min_y) ? min_x : 0;
-      int end_x = (y == max_y) ? max_x : term_cols - 1;
+    int min_x, max_x;
+    int64_t min_y, max_y;
+    selection_bounds(&min_x, &min_y, &max_x, &max_y);
+
+    for (int y = 0; y < term_rows; y++) {
+      int64_t line = first_line + y;
+      if (line < min_y || line > max_y) continue;
+
+      int start_x = (line == min_y) ? min_x : 0;
+      int end_x = (line == max_y) ? max_x : term_cols - 1;
 
       for (int x = start_x; x <= end_x && x < term_cols; x++) {
         window_draw_rect(padding_x + x * char_width, padding_y + y * char_height, char_width, char_height, 0.3f, 0.5f,
@@ -652,33 +1911,485 @@ void render_terminal(void) {
       }
     }
   }
+  trace_end("selection", trace_phase);
+
+  // The prompt of a command that failed gets a red edge
+  marks_forget_before(history_total - history_count);
+  for (const PromptMark* m = marks_after(first_line - 1); m && m->prompt < first_line + term_rows;
+       m = marks_after(m->prompt)) {
+    if (m->status > 0) {
+      window_draw_rect(padding_x, padding_y + (m->prompt - first_line) * char_height, 3.0f * text_scale, char_height,
+                       0.9f, 0.2f, 0.2f);
+    }
+  }
 
-  for (int y = 0; y < term_rows; y++) {
-    for (int x = 0; x < term_cols; x++) {
-      Cell cell = screen[y][x];
-      if (!cell.codepoint) continue;
+  // Images share the pass with the text, negative z goes under it
+  trace_phase = trace_begin();
+  float cell_top = padding_y - baseline_offset;
+  graphics_forget_before(history_total - history_count);
+  graphics_draw(first_line, term_rows, padding_x, cell_top, char_width, char_height, true);
+  trace_end("images", trace_phase);
+
+  trace_phase = trace_begin();
+  if (!draw_rows_cached(first_line, window_width, padding_x, padding_y, char_width, char_height)) {
+    for (int y = 0; y < term_rows; y++) {
+      const Row* row = line_at(first_line + y);
+      if (row) draw_row_text(row, padding_x, padding_y + y * char_height, char_width);
+    }
+  }
+  trace_end_arg("glyphs", trace_phase, "cells", cells_rendered);
+
+  trace_phase = trace_begin();
+  graphics_draw(first_line, term_rows, padding_x, cell_top, char_width, char_height, false);
+  graphics_end_frame();
+  trace_end("images", trace_phase);
+
+  trace_phase = trace_begin();
+  int hover_y = (int)(hover.line - first_line);
+  if (hover.active && hover_y >= 0 && hover_y < term_rows) {
+    const Row* row = line_at(hover.line);
+    uint32_t style = row_words(row, ROW_STYLES)[hover.x0];
+    int x1 = hover.x1 < row_cols(row) ? hover.x1 : row_cols(row) - 1;
+    float r, g, b;
+    get_ansi_color(STYLE_FG(style), STYLE_BOLD(style), &r, &g, &b);
+    window_draw_rect(padding_x + hover.x0 * char_width, padding_y + hover_y * char_height + 4.0f * text_scale,
+                     (x1 - hover.x0 + 1) * char_width, 1.5f, r, g, b);
+  }
 
-      char str[5] = {0};
-      if (cell.codepoint < 128) {
-        str[0] = (char)cell.codepoint;
-      } else {
-        utf8encode(cell.codepoint, str);
-      }
+  if (cursor_y + view_offset < term_rows) {
+    window_draw_rect(cursor_x_px, cursor_y_px, char_width, char_height, 0.8f, 0.8f, 0.8f);
+  }
+  trace_end("rects", trace_phase);
 
-      float r, g, b;
-      get_ansi_color(cell.fg_color, cell.bold, &r, &g, &b);
-      window_set_text_color(r, g, b);
+  trace_end("render_terminal", trace_start);
+}
+
+// Snapshot sections. Rows run from the oldest history line to the bottom of
+// the screen, each a uint32_t width followed by its cells; gens are in the
+// same order.
+#define SNAPSHOT_STATE 'S'
+#define SNAPSHOT_ROWS 'R'
+#define SNAPSHOT_GENS 'G'
+#define SNAPSHOT_CLUSTERS 'C'
+#define SNAPSHOT_LINKS 'L'
+#define SNAPSHOT_OSC 'O'    // string being collected
+#define SNAPSHOT_INPUT 'I'  // bytes read but not parsed yet
+#define SNAPSHOT_MAX_COLS (1 << 16)
+
+// Everything but the rows and arenas
+typedef struct {
+  int32_t cols, rows;
+  int32_t cursor_x, cursor_y, last_x, last_y;
+  int32_t history_count;
+  int32_t pad;
+  int64_t history_total;
+  uint64_t gen_counter;
+  uint32_t recent_codepoint, link;
+  uint8_t fg, bg, bold, bracketed_paste;
+  uint8_t in_osc, in_apc, osc_overflow, csi_discard;
+  CSISequence csi;
+} SavedState;
+
+#define SNAPSHOT_LAYOUT ((uint32_t)CELL_BYTES | (uint32_t)sizeof(SavedState) << 16)
+
+static const char* snapshot_path = NULL;
+static volatile sig_atomic_t snapshot_requested = 0;
+
+static void snapshot_handler(int sig) {
+  (void)sig;
+  snapshot_requested = 1;
+}
 
-      window_draw_text(padding_x + x * char_width, padding_y + y * char_height, str);
+// A row's whole allocation, its arrays laid out for its capacity
+static void save_row(const Row* row) {
+  uint32_t cols = rowpool_cols(row);
+  snapshot_write(&cols, sizeof(cols));
+  snapshot_write(row, CELL_BYTES * cols);
+}
+
+static bool save_snapshot(const char* path) {
+  if (!snapshot_write_open(path, SNAPSHOT_LAYOUT)) return false;
+
+  SavedState st = {.cols = term_cols, .rows = term_rows, .cursor_x = cursor_x, .cursor_y = cursor_y,
+                   .last_x = last_x, .last_y = last_y, .history_count = history_count,
+                   .history_total = history_total, .gen_counter = gen_counter,
+                   .recent_codepoint = recent_codepoint, .link = current_link, .fg = current_fg_color,
+                   .bg = current_bg_color, .bold = current_bold, .bracketed_paste = bracketed_paste,
+                   .in_osc = in_osc, .in_apc = in_apc, .osc_overflow = osc_overflow,
+                   .csi_discard = csi_discard, .csi = current_csi};
+  snapshot_section_begin(SNAPSHOT_STATE);
+  snapshot_write(&st, sizeof(st));
+  snapshot_section_end();
+
+  int64_t first = history_total - history_count;
+  snapshot_section_begin(SNAPSHOT_ROWS);
+  for (int64_t line = first; line < history_total + term_rows; line++) save_row(line_at(line));
+  snapshot_section_end();
+
+  snapshot_section_begin(SNAPSHOT_GENS);
+  for (int64_t line = first; line < history_total + term_rows; line++) {
+    uint64_t gen = line_gen(line);
+    snapshot_write(&gen, sizeof(gen));
+  }
+  snapshot_section_end();
+
+  size_t len;
+  const uint32_t* clusters = cluster_arena(&len);
+  snapshot_section_begin(SNAPSHOT_CLUSTERS);
+  snapshot_write(clusters, len * sizeof(*clusters));
+  snapshot_section_end();
+
+  const char* links = link_arena(&len);
+  snapshot_section_begin(SNAPSHOT_LINKS);
+  snapshot_write(links, len);
+  snapshot_section_end();
+
+  snapshot_section_begin(SNAPSHOT_OSC);
+  snapshot_write(osc_buf.data, osc_buf.len);
+  snapshot_section_end();
+
+  snapshot_section_begin(SNAPSHOT_INPUT);
+  snapshot_write(buf, buflen);
+  snapshot_section_end();
+
+  return snapshot_write_close();
+}
+
+// Next row record in [*p, end), NULL if it runs past the end
+static const char* next_saved_row(const char** p, const char* end, int* cols) {
+  uint32_t n;
+  if (end - *p < (ptrdiff_t)sizeof(n)) return NULL;
+  memcpy(&n, *p, sizeof(n));
+  if (n == 0 || n > SNAPSHOT_MAX_COLS || (size_t)(end - *p - sizeof(n)) < n * CELL_BYTES) return NULL;
+  const char* cells = *p + sizeof(n);
+  *p += sizeof(n) + n * CELL_BYTES;
+  *cols = n;
+  return cells;
+}
+
+// True when every cluster and link id in a saved row is in the restored arenas
+static bool saved_row_ids_valid(const char* cells, int cols) {
+  for (int x = 0; x < cols; x++) {
+    uint32_t cp, link;
+    memcpy(&cp, cells + ((size_t)ROW_CODEPOINTS * cols + x) * sizeof(uint32_t), sizeof(cp));
+    memcpy(&link, cells + ((size_t)ROW_LINKS * cols + x) * sizeof(uint32_t), sizeof(link));
+    if (!cluster_id_valid(cp) || !link_id_valid(link)) return false;
+  }
+  return true;
+}
+
+// At least width wide, blank past the saved cells
+static Row* copy_saved_row(const char* cells, int cols, int width) {
+  Row* row = alloc_row(cols > width ? cols : width);
+  move_cells(row, 0, cells, cols, 0, cols);
+  return row;
+}
+
+// Replaces the grid, history and parser state with a snapshot. Rows are
+// copied straight out of the mapped file; nothing is re-parsed.
+static bool restore_snapshot(const char* path) {
+  if (!snapshot_load(path, SNAPSHOT_LAYOUT)) return false;
+
+  size_t state_len, rows_len, gens_len, clusters_len, links_len, osc_len, input_len;
+  const SavedState* st = snapshot_section(SNAPSHOT_STATE, &state_len);
+  const char* rows = snapshot_section(SNAPSHOT_ROWS, &rows_len);
+  const uint64_t* gens = snapshot_section(SNAPSHOT_GENS, &gens_len);
+  const uint32_t* clusters = snapshot_section(SNAPSHOT_CLUSTERS, &clusters_len);
+  const char* links = snapshot_section(SNAPSHOT_LINKS, &links_len);
+  const char* osc = snapshot_section(SNAPSHOT_OSC, &osc_len);
+  const char* input = snapshot_section(SNAPSHOT_INPUT, &input_len);
+
+  bool valid = st && state_len == sizeof(*st) && rows && gens && clusters && links && osc && input;
+  size_t lines = valid ? (size_t)st->history_count + st->rows : 0;
+  valid = valid && gens_len == lines * sizeof(uint64_t) && st->cols > 0 && st->cols <= SNAPSHOT_MAX_COLS &&
+          st->rows > 0 && st->rows <= SNAPSHOT_MAX_COLS && st->history_count >= 0 &&
+          st->history_total >= st->history_count && st->cursor_x >= 0 && st->cursor_x < st->cols &&
+          st->cursor_y >= 0 && st->cursor_y < st->rows &&
+          (st->last_x < 0 || (st->last_x < st->cols && st->last_y >= 0 && st->last_y < st->rows)) &&
+          st->csi.nparams >= 0 && st->csi.nparams <= 16 && input_len <= sizeof(buf);
+
+  // Every row must be there, with ids the saved arenas hold, before anything
+  // else is replaced. The arenas are put back when a check fails.
+  bool clusters_restored = valid && cluster_arena_restore(clusters, clusters_len / sizeof(*clusters));
+  bool links_restored = clusters_restored && link_arena_restore(links, links_len);
+  valid = links_restored && link_id_valid(st->link);
+  const char* p = rows;
+  const char* end = rows + rows_len;
+  for (size_t i = 0; valid && i < lines; i++) {
+    int cols;
+    const char* cells = next_saved_row(&p, end, &cols);
+    valid = cells && saved_row_ids_valid(cells, cols);
+  }
+  if (clusters_restored) cluster_arena_restore_end(valid);
+  if (links_restored) link_arena_restore_end(valid);
+  if (!valid) {
+    fprintf(stderr, "%s: damaged snapshot\n", path);
+    snapshot_unload();
+    return false;
+  }
+
+  // History keeps the newest lines that fit
+  for (int i = 0; i < history_count; i++) {
+    size_t slot = (history_total - 1 - i) % history_cap;
+    rowpool_free(history[slot]);
+    history[slot] = NULL;
+  }
+  history_count = 0;
+  history_total = st->history_total - st->history_count;
+  p = rows;
+  for (int i = 0; i < st->history_count; i++) {
+    int cols;
+    const char* cells = next_saved_row(&p, end, &cols);
+    if (st->history_count - i > history_cap) {
+      history_total++;
+      continue;
     }
+    Row* evicted = history_push(copy_saved_row(cells, cols, cols), gens[i]);
+    if (evicted) rowpool_free(evicted);
+  }
+
+  grid_resize(st->cols, st->rows);
+  for (int y = 0; y < st->rows; y++) {
+    int cols;
+    const char* cells = next_saved_row(&p, end, &cols);
+    rowpool_free(screen[y]);
+    screen[y] = copy_saved_row(cells, cols, st->cols);
+    screen_gen[y] = gens[st->history_count + y];
   }
 
-  window_draw_rect(cursor_x_px, cursor_y_px, char_width, char_height, 0.8f, 0.8f, 0.8f);
+  cursor_x = st->cursor_x;
+  cursor_y = st->cursor_y;
+  last_x = st->last_x;
+  last_y = st->last_y;
+  gen_counter = st->gen_counter;
+  recent_codepoint = st->recent_codepoint;
+  current_link = st->link;
+  current_fg_color = st->fg;
+  current_bg_color = st->bg;
+  current_bold = st->bold;
+  bracketed_paste = st->bracketed_paste;
+  current_csi = st->csi;
+  in_osc = st->in_osc;
+  in_apc = st->in_apc;
+  osc_overflow = st->osc_overflow;
+  csi_discard = st->csi_discard;
+  buffer_clear(&osc_buf);
+  if (osc_len) buffer_append(&osc_buf, osc, osc_len);
+  if (input_len) memcpy(buf, input, input_len);
+  buflen = input_len;
+  view_offset = 0;
+  target_cols = st->cols;
+  target_rows = st->rows;
+
+  snapshot_unload();
+  return true;
+}
+
+// Benchmark hooks, see bench.c. Cells keep roughly the default window's size
+// whatever the grid, so bigger grids cost more pixels as well as more cells.
+#define BENCH_CELL_HEIGHT 17.0f
+
+static bool bench_reset(int cols, int rows) {
+  int width = (int)(cols * BENCH_CELL_HEIGHT / CELL_ASPECT + PADDING_X * 2 + 1.0f);
+  int height = (int)(rows * BENCH_CELL_HEIGHT + PADDING_Y * 2);
+  if (!window_resize(width, height)) return false;
+
+  target_cols = fixed_cols = cols;
+  target_rows = fixed_rows = rows;
+  grid_resize(cols, rows);
+  selecting = false;
+  view_offset = 0;
+  marks_delete_from(0);
+  static const char clear[] = "\x1b[0m\x1b[2J\x1b[H";
+  feed_input(clear, sizeof(clear) - 1);
+  return true;
+}
+
+static void bench_select_all(bool on) {
+  selecting = on;
+  sel_start_x = 0;
+  sel_start_y = grid_to_line(0);
+  sel_end_x = term_cols - 1;
+  sel_end_y = grid_to_line(term_rows - 1);
 }
 
-int main(void) {
+static void bench_render(void) {
+  window_clear(0.05f, 0.05f, 0.06f);
+  render_terminal();
+}
+
+static volatile sig_atomic_t quit_requested = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+static void quit_handler(int sig) {
+  (void)sig;
+  quit_requested = 1;
+}
+
+static void stats_handler(int sig) {
+  (void)sig;
+  stats_requested = 1;
+}
+
+static void hud_toggle_redraw(void) {
+  hud_toggle();
+  redraw_requested = true;
+}
+
+static float clamp_zoom(float z) {
+  if (!(z >= ZOOM_MIN)) return ZOOM_MIN;  // NaN too
+  return z > ZOOM_MAX ? ZOOM_MAX : z;
+}
+
+static void zoom(int step) {
+  font_zoom = clamp_zoom(step ? font_zoom * (step > 0 ? ZOOM_STEP : 1.0f / ZOOM_STEP) : 1.0f);
+  redraw_requested = true;
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "       %s --server [SOCKET]            preload the font and fork a terminal per client\n"
+          "       %s --client [SOCKET] [options]  open a terminal from the server, or here when none runs\n"
+          "  --history LINES        scrollback length (default %d)\n"
+          "  --osc52-limit BYTES    largest OSC 52 clipboard write accepted, 0 disables (default %d)\n"
+          "  --record FILE          record PTY output and resizes to FILE\n"
+          "  --replay FILE          replay a recording instead of starting a shell\n"
+          "  --replay-fast          replay one recorded frame per rendered frame, then exit\n"
+          "  --hud                  start with the performance overlay shown (F12 toggles)\n"
+          "  --trace FILE           write main loop phases to FILE in Chrome trace format\n"
+          "  --stats FILE           count bytes and escape sequences by kind, written to FILE as JSON\n"
+          "                         at exit and on SIGUSR2\n"
+          "  --snapshot FILE        save the grid, history and parser state to FILE at exit and on SIGUSR1\n"
+          "  --restore FILE         start from a snapshot instead of a blank screen\n"
+          "  --no-row-cache         draw every row's glyphs each frame instead of compositing cached rows\n"
+          "  --no-io-uring          read and write the PTY with poll() instead of an io_uring\n"
+          "  --no-jump-scroll       put every line of an output flood on the grid, even ones nobody can see\n"
+          "  --frame-interval MS    present a frame at least this often while output floods in (default %g)\n"
+          "  --parse-cap MS         most time spent parsing output between frames (default %g)\n"
+          "  --font FILE            draw with FILE, before the built-in fonts; repeat for a fallback chain\n"
+          "  --sdf                  rasterize glyphs once as distance fields, sharp at every zoom (Ctrl +/-/0)\n"
+          "  --zoom SCALE           start zoomed, 1 is 100%%\n"
+          "  --software             render on the CPU and present one texture per frame\n"
+          "  --offscreen FILE       render on the CPU without a window, write the last frame to FILE (PPM)\n"
+          "  --bench [FRAMES]       render synthetic screens with headless OpenGL and report per-frame costs\n"
+          "                         (default %d frames each)\n",
+          prog, prog, prog, HISTORY_DEFAULT_LINES, OSC52_DEFAULT_LIMIT, SCHED_FRAME_MS, SCHED_PARSE_CAP_MS,
+          BENCH_DEFAULT_FRAMES);
+}
+
+int main(int argc, char** argv) {
+  const char* record_path = NULL;
+  const char* replay_path = NULL;
+  const char* trace_path = NULL;
+  const char* stats_path = NULL;
+  const char* offscreen_path = NULL;
+  const char* restore_path = NULL;
+  bool replay_fast_mode = false;
+  bool io_uring_enabled = true;
+  int bench_frames = 0;
+
+  // Both come first. The server only returns in a child forked for a client,
+  // which goes on to parse that client's options; the client drops its own.
+  bool server = argc >= 2 && strcmp(argv[1], "--server") == 0;
+  if (server || (argc >= 2 && strcmp(argv[1], "--client") == 0)) {
+    const char* socket_path = server_default_path();
+    int skip = 2;
+    if (argc >= 3 && argv[2][0] != '-') socket_path = argv[skip++];
+
+    if (server) {
+      if (argc > skip) {
+        usage(argv[0]);
+        return 1;
+      }
+      if (!window_preload_font() || !server_run(socket_path, &argc, &argv)) return 1;
+    } else {
+      argv[skip - 1] = argv[0];
+      argc -= skip - 1;
+      argv += skip - 1;
+      if (server_request(socket_path, argc, argv)) return 0;
+      fprintf(stderr, "no server at %s, starting here\n", socket_path);
+    }
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+      history_cap = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--osc52-limit") == 0 && i + 1 < argc) {
+      osc52_limit = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay-fast") == 0) {
+      replay_fast_mode = true;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+      stats_path = argv[++i];
+    } else if (strcmp(argv[i], "--hud") == 0) {
+      hud_toggle();
+    } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+      snapshot_path = argv[++i];
+    } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      restore_path = argv[++i];
+    } else if (strcmp(argv[i], "--no-row-cache") == 0) {
+      row_cache_enabled = false;
+    } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+      io_uring_enabled = false;
+    } else if (strcmp(argv[i], "--no-jump-scroll") == 0) {
+      jump_scroll_enabled = false;
+    } else if (strcmp(argv[i], "--frame-interval") == 0 && i + 1 < argc) {
+      sched_configure(strtod(argv[++i], NULL), 0);
+    } else if (strcmp(argv[i], "--parse-cap") == 0 && i + 1 < argc) {
+      sched_configure(0, strtod(argv[++i], NULL));
+    } else if (strcmp(argv[i], "--font") == 0 && i + 1 < argc) {
+      window_add_font(argv[++i]);
+    } else if (strcmp(argv[i], "--sdf") == 0) {
+      window_set_sdf_atlas(true);
+    } else if (strcmp(argv[i], "--zoom") == 0 && i + 1 < argc) {
+      font_zoom = clamp_zoom(strtof(argv[++i], NULL));
+    } else if (strcmp(argv[i], "--software") == 0) {
+      window_set_backend(RENDER_SOFTWARE);
+    } else if (strcmp(argv[i], "--offscreen") == 0 && i + 1 < argc) {
+      offscreen_path = argv[++i];
+      window_set_backend(RENDER_OFFSCREEN);
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      bench_frames = BENCH_DEFAULT_FRAMES;
+      if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) bench_frames = atoi(argv[++i]);
+      if (bench_frames < 1) bench_frames = BENCH_DEFAULT_FRAMES;
+      window_set_backend(RENDER_HEADLESS);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  rowpool_init(CELL_BYTES);
+  grid_resize(term_cols, term_rows);
+  if (restore_path && !restore_snapshot(restore_path)) return 1;
+
+  // No shell, no window: synthetic screens straight into the parser and renderer
+  if (bench_frames) {
+    masterfd = -1;  // grid resizes have no PTY to reach
+    if (!window_init("myterm bench", 1280, 720)) {
+      fprintf(stderr, "Failed to init headless OpenGL\n");
+      return 1;
+    }
+    const BenchHooks hooks = {bench_reset, feed_input, bench_select_all, bench_render};
+    bool ok = bench_run(&hooks, bench_frames);
+    window_shutdown();
+    return ok ? 0 : 1;
+  }
+
+  if (replay_path) {
+    if (!replay_open(replay_path, replay_fast_mode)) return 1;
+    replay_initial_size(&fixed_cols, &fixed_rows);
+    masterfd = -1;
+  }
+
   // forkpty() = openpty + fork() parent gets master file descriptor
-  if (forkpty(&masterfd, NULL, NULL, NULL) == 0) {
+  if (!replay_path && (child_pid = forkpty(&masterfd, NULL, NULL, NULL)) == 0) {
     // child replaces itself with zsh
     setenv("TERM", "xterm-256color", 1);
     setenv("COLORTERM", "truecolor", 1);
@@ -686,47 +2397,172 @@ int main(void) {
     perror("execlp");
     exit(1);
   }
+  // Opened after the fork so the child never inherits the stdio buffer
+  if (record_path && !record_open(record_path)) return 1;
+  if (trace_path && !trace_open(trace_path, TRACE_DEFAULT_EVENTS)) return 1;
+  if (stats_path && !stats_open(stats_path)) return 1;
+
   set_pty_fd(masterfd);
+  writequeue_init(masterfd);
+  ptyio_init(masterfd, io_uring_enabled);
 
   if (!window_init("myterm", 1280, 720)) {
     fprintf(stderr, "Failed to init window\n");
     return 1;
   }
 
+  // Shut down through the main loop so recordings are flushed
+  struct sigaction sa = {.sa_handler = quit_handler};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  struct sigaction snapshot_sa = {.sa_handler = snapshot_handler};
+  sigemptyset(&snapshot_sa.sa_mask);
+  if (snapshot_path) sigaction(SIGUSR1, &snapshot_sa, NULL);
+  struct sigaction stats_sa = {.sa_handler = stats_handler};
+  sigemptyset(&stats_sa.sa_mask);
+  if (stats_path) sigaction(SIGUSR2, &stats_sa, NULL);
+
+  // Measure parse and render, not vsync
+  if (replay_fast_mode) window_set_vsync(false);
+
   GLFWwindow* window = window_get_glfw_window();
   glfwSetMouseButtonCallback(window, mouse_button_callback);
   glfwSetCursorPosCallback(window, cursor_position_callback);
+  glfwSetScrollCallback(window, scroll_callback);
   set_copy_handler(copy_selection_to_clipboard);
-
-  struct pollfd fds[1];
-  fds[0].fd = masterfd;
-  fds[0].events = POLLIN;
+  set_paste_handler(paste_from_clipboard);
+  set_hud_handler(hud_toggle_redraw);
+  set_zoom_handler(zoom);
+  set_mark_handler(jump_to_mark);
 
   bool running = true;
   bool dirty = true;
   int frame_count = 0;
+  bool replay_reported = false;
+  double last_frame = 0.0;
+  uint64_t replay_bytes = 0;
+
+  WindowVisibility last_visibility = WINDOW_FOCUSED;
 
   while (running) {
-    int ret = poll(fds, 1, 2);  // 2ms 144hz
+    // Hidden windows only parse, output must keep flowing so the child never
+    // blocks on a full PTY. Coming back draws everything missed in one frame.
+    // A fast replay is a measurement and renders regardless.
+    WindowVisibility visibility = replay_fast_mode ? WINDOW_FOCUSED : window_visibility();
+    if (visibility != last_visibility && last_visibility == WINDOW_HIDDEN) dirty = true;
+    last_visibility = visibility;
+    double frame_wait = visibility == WINDOW_UNFOCUSED ? last_frame + 1.0 / UNFOCUSED_FPS - glfwGetTime() : 0.0;
+    bool frame_due = visibility != WINDOW_HIDDEN && frame_wait <= 0.0;
+
+    int timeout = replay_fast_mode ? 0 : 2;  // 2ms 144hz
+    if (visibility == WINDOW_HIDDEN) timeout = HIDDEN_POLL_MS;
+    if (dirty && frame_wait > 0.0) timeout = (int)(frame_wait * 1e3) + 1;
+    if (flood_pending()) timeout = 0;  // read ahead already, only events to pick up
+
+    uint64_t trace_poll = trace_begin();
+    int ready = ptyio_wait(timeout, writequeue_pending());
+    trace_end("poll", trace_poll);
+
+    // Input before output: what was typed (Ctrl+C above all) goes out before
+    // more of the program's output is parsed, in one writev
+    uint64_t trace_events = trace_begin();
+    glfwPollEvents();
+    trace_end("glfwPollEvents", trace_events);
+    writequeue_flush();
+
+    if (replay_active()) {
+      replay_tick();
+      for (;;) {
+        int cols, rows;
+        if (replay_take_resize(&cols, &rows)) {
+          fixed_cols = cols;
+          fixed_rows = rows;
+          dirty = true;
+          continue;
+        }
+        if (!replay_pending()) break;
+        size_t n = readfrompty(HUGE_VAL);
+        if (n == 0) break;
+        replay_bytes += n;
+        dirty = true;
+      }
+
+      if (replay_done() && !replay_reported) {
+        double secs = replay_elapsed();
+        fprintf(stderr, "replay: %llu bytes, %d frames in %.3f s (%.1f MB/s, %.1f fps)\n",
+                (unsigned long long)replay_bytes, frame_count, secs, replay_bytes / secs / 1e6, frame_count / secs);
+        replay_reported = true;
+        if (replay_fast_mode) running = false;
+      }
+    }
 
-    if (ret > 0 && (fds[0].revents & POLLIN)) {
-      do {
-        readfrompty();
+    // Parse until the round's slice runs out, the rest waits for the next one
+    if ((ready & PTYIO_READ) || flood_pending()) {
+      sched_parse_begin(glfwGetTime(), frame_due);
+      for (;;) {
+        double read_start = glfwGetTime();
+        readfrompty(sched_deadline());
         dirty = true;
-      } while (poll(fds, 1, 0) > 0 && (fds[0].revents & POLLIN));
+        if (!sched_parse_more(read_start, glfwGetTime()) || !(ptyio_readable() || flood_pending())) break;
+      }
+      // answers to queries in what was just parsed, rather than after the frame
+      if (writequeue_pending()) writequeue_flush();
+    }
+
+    if (redraw_requested) {
+      redraw_requested = false;
+      dirty = true;
     }
 
-    if (dirty) {
+    if (dirty && frame_due) {
+      double frame_start = glfwGetTime();
       window_clear(0.05f, 0.05f, 0.06f);
       render_terminal();
+      int draw_calls = window_take_draw_calls();
+      size_t grid_bytes = screen_bytes();
+      hud_draw(grid_bytes, rowpool_bytes_in_use() - grid_bytes + (history ? (size_t)history_cap * sizeof(*history) : 0));
+      window_take_draw_calls();  // the overlay's own draws aren't counted
+
+      double swap_start = glfwGetTime();
+      uint64_t trace_swap = trace_begin();
       window_swap();  // blocks until VSync
+      trace_end("window_swap", trace_swap);
+      double swap_end = glfwGetTime();
+      hud_frame((swap_start - frame_start) * 1e3, (swap_end - swap_start) * 1e3, cells_rendered, draw_calls);
+
+      sched_frame_done(swap_start - frame_start, swap_end);
+      last_frame = swap_end;
       dirty = false;
+      frame_count++;
     }
 
-    glfwPollEvents();
-    if (window_should_close()) running = false;
+    // keep the overlay's numbers live while idle, without rendering flat out
+    if (hud_visible() && glfwGetTime() - last_frame > HUD_IDLE_REFRESH) dirty = true;
+
+    if (window_should_close() || quit_requested) running = false;
+
+    if (snapshot_requested) {
+      snapshot_requested = 0;
+      if (!save_snapshot(snapshot_path)) fprintf(stderr, "snapshot: could not write %s\n", snapshot_path);
+    }
+
+    if (stats_requested) {
+      stats_requested = 0;
+      stats_write();
+    }
   }
 
+  if (snapshot_path && !save_snapshot(snapshot_path)) fprintf(stderr, "snapshot: could not write %s\n", snapshot_path);
+
+  ptyio_shutdown();
+  record_close();
+  replay_close();
+  trace_close();
+  stats_write();
+  stats_close();
+  bool saved = !offscreen_path || window_save_frame(offscreen_path);
   window_shutdown();
-  return 0;
+  return saved ? 0 : 1;
 }
@@ -0,0 +1,84 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  const char* name;
+  const char* arg_name;  // NULL when the span has no argument
+  int64_t arg;
+  uint64_t start_ns;
+  uint64_t dur_ns;
+} TraceEvent;
+
+static FILE* trace_file = NULL;
+static TraceEvent* events = NULL;
+static size_t capacity = 0;
+static uint64_t next_event = 0;  // total spans recorded, the ring keeps the newest
+static uint64_t origin_ns = 0;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool trace_open(const char* path, size_t max_events) {
+  trace_file = fopen(path, "w");
+  if (!trace_file) {
+    perror(path);
+    return false;
+  }
+
+  events = calloc(max_events, sizeof(*events));
+  if (!events) {
+    fclose(trace_file);
+    trace_file = NULL;
+    return false;
+  }
+
+  capacity = max_events;
+  origin_ns = now_ns();
+  return true;
+}
+
+uint64_t trace_begin(void) { return events ? now_ns() : 0; }
+
+void trace_end_arg(const char* name, uint64_t start, const char* arg_name, int64_t arg) {
+  if (!start) return;
+
+  uint64_t end = now_ns();
+  uint64_t slot = __atomic_fetch_add(&next_event, 1, __ATOMIC_RELAXED) % capacity;
+  events[slot] = (TraceEvent){name, arg_name, arg, start, end - start};
+}
+
+void trace_end(const char* name, uint64_t start) { trace_end_arg(name, start, NULL, 0); }
+
+void trace_close(void) {
+  if (!trace_file) return;
+
+  uint64_t total = next_event;
+  uint64_t first = total > capacity ? total - capacity : 0;
+  int pid = getpid();
+
+  fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (uint64_t i = first; i < total; i++) {
+    const TraceEvent* e = &events[i % capacity];
+    if (e->start_ns < origin_ns) continue;
+
+    fprintf(trace_file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f",
+            i == first ? "" : ",\n", e->name, pid, (e->start_ns - origin_ns) / 1e3, e->dur_ns / 1e3);
+    if (e->arg_name) fprintf(trace_file, ",\"args\":{\"%s\":%lld}", e->arg_name, (long long)e->arg);
+    fputc('}', trace_file);
+  }
+  fprintf(trace_file, "\n]}\n");
+
+  if (first > 0) fprintf(stderr, "trace: ring full, kept the last %zu of %llu spans\n", capacity, (unsigned long long)total);
+
+  fclose(trace_file);
+  trace_file = NULL;
+  free(events);
+  events = NULL;
+}
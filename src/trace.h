@@ -0,0 +1,18 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Chrome Trace Event Format export of main loop phases (--trace FILE).
+// Spans go into a preallocated ring, claimed with an atomic increment, and
+// are only formatted as JSON by trace_close(). With tracing off,
+// trace_begin() returns 0 and trace_end() returns straight away.
+bool trace_open(const char* path, size_t max_events);
+uint64_t trace_begin(void);
+void trace_end(const char* name, uint64_t start);
+void trace_end_arg(const char* name, uint64_t start, const char* arg_name, int64_t arg);
+void trace_close(void);
+
+#endif
@@ -0,0 +1,226 @@
+#include "unicode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "unicode_table.h"
+
+#define CLUSTER_GC_MIN (1 << 18)  // arena words before collection is considered
+
+uint8_t unicode_props(uint32_t cp) {
+  if (cp > 0x10FFFF) return 1 | GCB_OTHER << UNICODE_GCB_SHIFT;
+  return unicode_stage2[unicode_stage1[cp >> 8]][cp & 0xFF];
+}
+
+// Pairwise rules GB3-GB9b. GB11 and GB12/13 need more context than a pair and
+// only matter for sequences of wide codepoints, which each get a cell anyway.
+bool unicode_is_break(int prev, int next) {
+  if (prev == GCB_CR && next == GCB_LF) return false;
+  if (prev == GCB_CR || prev == GCB_LF || prev == GCB_CONTROL) return true;
+  if (next == GCB_CR || next == GCB_LF || next == GCB_CONTROL) return true;
+  if (prev == GCB_L && (next == GCB_L || next == GCB_V || next == GCB_LV || next == GCB_LVT)) return false;
+  if ((prev == GCB_LV || prev == GCB_V) && (next == GCB_V || next == GCB_T)) return false;
+  if ((prev == GCB_LVT || prev == GCB_T) && next == GCB_T) return false;
+  if (next == GCB_EXTEND || next == GCB_ZWJ || next == GCB_SPACING_MARK) return false;
+  if (prev == GCB_PREPEND) return false;
+  return true;
+}
+
+// Arena entries are [n, cp0, ..., cp(n-1)], a cluster id is its offset
+static uint32_t* arena = NULL;
+static size_t arena_len = 0, arena_cap = 0;
+static size_t arena_live = 0;  // arena_len after the last collection
+
+// Open-addressed intern table of arena offsets + 1, 0 marks a free slot
+static uint32_t* slots = NULL;
+static size_t slot_count = 0, slot_used = 0;
+
+static uint32_t* old_arena = NULL;  // arena being collected from
+
+static uint32_t hash_codepoints(const uint32_t* cps, int n) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < n; i++) h = (h ^ cps[i]) * 16777619u;
+  return h;
+}
+
+static bool slots_grow(void) {
+  size_t count = slot_count ? slot_count * 2 : 1024;
+  uint32_t* grown = calloc(count, sizeof(*grown));
+  if (!grown) return false;
+
+  for (size_t i = 0; i < slot_count; i++) {
+    if (!slots[i]) continue;
+    const uint32_t* entry = &arena[slots[i] - 1];
+    size_t k = hash_codepoints(entry + 1, entry[0]) & (count - 1);
+    while (grown[k]) k = (k + 1) & (count - 1);
+    grown[k] = slots[i];
+  }
+
+  free(slots);
+  slots = grown;
+  slot_count = count;
+  return true;
+}
+
+static uint32_t cluster_intern(const uint32_t* cps, int n) {
+  if (slot_used * 2 >= slot_count && !slots_grow()) return cps[0];
+
+  uint32_t h = hash_codepoints(cps, n);
+  size_t k = h & (slot_count - 1);
+  for (; slots[k]; k = (k + 1) & (slot_count - 1)) {
+    const uint32_t* entry = &arena[slots[k] - 1];
+    if (entry[0] == (uint32_t)n && memcmp(entry + 1, cps, n * sizeof(uint32_t)) == 0) {
+      return CELL_CLUSTER | (slots[k] - 1);
+    }
+  }
+
+  if (arena_cap - arena_len < (size_t)n + 1) {
+    size_t cap = arena_cap ? arena_cap * 2 : 4096;
+    uint32_t* grown = realloc(arena, cap * sizeof(*arena));
+    if (!grown) return cps[0];
+    arena = grown;
+    arena_cap = cap;
+  }
+
+  uint32_t offset = arena_len;
+  arena[arena_len++] = n;
+  memcpy(&arena[arena_len], cps, n * sizeof(uint32_t));
+  arena_len += n;
+
+  slots[k] = offset + 1;
+  slot_used++;
+  return CELL_CLUSTER | offset;
+}
+
+int cluster_codepoints(uint32_t cell_cp, const uint32_t** cps) {
+  if (!(cell_cp & CELL_CLUSTER)) return 0;
+  const uint32_t* entry = &arena[cell_cp & ~CELL_CLUSTER];
+  *cps = entry + 1;
+  return entry[0];
+}
+
+uint32_t cluster_last_codepoint(uint32_t cell_cp) {
+  const uint32_t* cps;
+  int n = cluster_codepoints(cell_cp, &cps);
+  return n ? cps[n - 1] : cell_cp;
+}
+
+// Returns the cell value for cell_cp with cp appended to its cluster
+uint32_t cluster_append(uint32_t cell_cp, uint32_t cp) {
+  uint32_t cps[CLUSTER_MAX_CODEPOINTS];
+  const uint32_t* existing;
+  int n = cluster_codepoints(cell_cp, &existing);
+
+  if (n) {
+    if (n >= CLUSTER_MAX_CODEPOINTS) return cell_cp;  // stacked marks beyond this are dropped
+    memcpy(cps, existing, n * sizeof(uint32_t));
+  } else {
+    cps[n++] = cell_cp;
+  }
+  cps[n++] = cp;
+
+  return cluster_intern(cps, n);
+}
+
+bool cluster_needs_gc(void) { return arena_len > CLUSTER_GC_MIN && arena_len > arena_live * 2; }
+
+void cluster_gc_begin(void) {
+  old_arena = arena;
+  arena = NULL;
+  arena_len = arena_cap = 0;
+  memset(slots, 0, slot_count * sizeof(*slots));
+  slot_used = 0;
+}
+
+uint32_t cluster_gc_keep(uint32_t cell_cp) {
+  if (!(cell_cp & CELL_CLUSTER)) return cell_cp;
+  const uint32_t* entry = &old_arena[cell_cp & ~CELL_CLUSTER];
+  return cluster_intern(entry + 1, entry[0]);
+}
+
+void cluster_gc_end(void) {
+  free(old_arena);
+  old_arena = NULL;
+  arena_live = arena_len;
+}
+
+const uint32_t* cluster_arena(size_t* len) {
+  *len = arena_len;
+  return arena;
+}
+
+// The arena and table a restore replaced, kept until cluster_arena_restore_end()
+static uint32_t* prev_arena = NULL;
+static uint32_t* prev_slots = NULL;
+static size_t prev_len = 0, prev_cap = 0, prev_live = 0, prev_slot_count = 0, prev_slot_used = 0;
+
+bool cluster_arena_restore(const uint32_t* words, size_t len) {
+  size_t entries = 0;
+  for (size_t i = 0; i < len; i += words[i] + 1, entries++) {
+    if (words[i] == 0 || words[i] > CLUSTER_MAX_CODEPOINTS || words[i] >= len - i) return false;
+  }
+
+  size_t count = 1024;
+  while (entries * 2 >= count) count *= 2;
+  uint32_t* copy = malloc((len ? len : 1) * sizeof(*copy));
+  uint32_t* table = calloc(count, sizeof(*table));
+  if (!copy || !table) {
+    free(copy);
+    free(table);
+    return false;
+  }
+  memcpy(copy, words, len * sizeof(*copy));
+
+  // Same offsets, so the ids in saved cells still hold
+  for (size_t i = 0; i < len; i += copy[i] + 1) {
+    size_t k = hash_codepoints(copy + i + 1, copy[i]) & (count - 1);
+    while (table[k]) k = (k + 1) & (count - 1);
+    table[k] = i + 1;
+  }
+
+  prev_arena = arena;
+  prev_len = arena_len;
+  prev_cap = arena_cap;
+  prev_live = arena_live;
+  prev_slots = slots;
+  prev_slot_count = slot_count;
+  prev_slot_used = slot_used;
+  arena = copy;
+  arena_len = arena_cap = arena_live = len;
+  slots = table;
+  slot_count = count;
+  slot_used = entries;
+  return true;
+}
+
+bool cluster_id_valid(uint32_t cell_cp) {
+  if (!(cell_cp & CELL_CLUSTER)) return true;
+  size_t at = cell_cp & ~CELL_CLUSTER;
+  if (at >= arena_len || arena[at] == 0 || arena[at] >= arena_len - at) return false;
+
+  // only the start of an entry is an id, and every start is in the table
+  size_t k = hash_codepoints(arena + at + 1, arena[at]) & (slot_count - 1);
+  for (; slots[k]; k = (k + 1) & (slot_count - 1)) {
+    if (slots[k] == at + 1) return true;
+  }
+  return false;
+}
+
+void cluster_arena_restore_end(bool keep) {
+  if (keep) {
+    free(prev_arena);
+    free(prev_slots);
+  } else {
+    free(arena);
+    free(slots);
+    arena = prev_arena;
+    arena_len = prev_len;
+    arena_cap = prev_cap;
+    arena_live = prev_live;
+    slots = prev_slots;
+    slot_count = prev_slot_count;
+    slot_used = prev_slot_used;
+  }
+  prev_arena = NULL;
+  prev_slots = NULL;
+}
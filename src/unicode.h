@@ -0,0 +1,63 @@
+#ifndef UNICODE_H
+#define UNICODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-codepoint properties from the generated tables in unicode_table.h:
+// bits 0-1 hold the display width, bits 2-5 the grapheme cluster break class.
+#define UNICODE_WIDTH_MASK 0x3
+#define UNICODE_WIDTH_CONTROL 3  // not printable, occupies no cell
+#define UNICODE_GCB_SHIFT 2
+
+// Grapheme_Cluster_Break values (UAX #29)
+enum {
+  GCB_OTHER,
+  GCB_CR,
+  GCB_LF,
+  GCB_CONTROL,
+  GCB_EXTEND,
+  GCB_ZWJ,
+  GCB_REGIONAL_INDICATOR,
+  GCB_PREPEND,
+  GCB_SPACING_MARK,
+  GCB_L,
+  GCB_V,
+  GCB_T,
+  GCB_LV,
+  GCB_LVT,
+  GCB_EXTENDED_PICTOGRAPHIC,
+};
+
+uint8_t unicode_props(uint32_t cp);
+
+static inline int unicode_width(uint8_t props) { return props & UNICODE_WIDTH_MASK; }
+
+static inline int unicode_gcb(uint8_t props) { return props >> UNICODE_GCB_SHIFT; }
+
+bool unicode_is_break(int prev_gcb, int next_gcb);
+
+// Cells hold either a single codepoint or, with CELL_CLUSTER set, the id of
+// a multi-codepoint grapheme cluster interned in a shared arena. The arena
+// only grows; cluster_gc_* rebuilds it from the ids still referenced.
+#define CELL_CLUSTER 0x80000000u
+#define CLUSTER_MAX_CODEPOINTS 32
+
+uint32_t cluster_append(uint32_t cell_cp, uint32_t cp);
+int cluster_codepoints(uint32_t cell_cp, const uint32_t** cps);
+uint32_t cluster_last_codepoint(uint32_t cell_cp);
+bool cluster_needs_gc(void);
+void cluster_gc_begin(void);
+uint32_t cluster_gc_keep(uint32_t cell_cp);
+void cluster_gc_end(void);
+
+// The arena as is, for snapshots; restoring it keeps every id valid. A
+// restore takes effect at once, cluster_id_valid() checks ids against it, and
+// cluster_arena_restore_end() keeps it or puts the previous arena back.
+const uint32_t* cluster_arena(size_t* len);  // in words
+bool cluster_arena_restore(const uint32_t* words, size_t len);
+bool cluster_id_valid(uint32_t cell_cp);
+void cluster_arena_restore_end(bool keep);
+
+#endif
@@ -0,0 +1,283 @@
+#include "utf8.h"
+
+#include <stdbool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define UTF8_SIMD 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UTF8_SIMD 1
+#endif
+
+static inline bool is_control(unsigned char c) { return c < 0x20 || c == 0x7F; }
+
+int utf8_decode_scalar(const char* s, size_t len, uint32_t* out_cp) {
+  const unsigned char* u = (const unsigned char*)s;
+  unsigned char c = u[0];
+
+  if (c < 0x80) {
+    *out_cp = c;
+    return 1;
+  }
+
+  // Valid range of the second byte depends on the lead (no overlongs,
+  // surrogates or codepoints above U+10FFFF), later bytes are 80..BF
+  int n;
+  uint32_t cp;
+  unsigned char lo = 0x80, hi = 0xBF;
+  if (c >= 0xC2 && c <= 0xDF) {
+    n = 2;
+    cp = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    n = 3;
+    cp = c & 0x0F;
+    if (c == 0xE0) lo = 0xA0;
+    if (c == 0xED) hi = 0x9F;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    n = 4;
+    cp = c & 0x07;
+    if (c == 0xF0) lo = 0x90;
+    if (c == 0xF4) hi = 0x8F;
+  } else {
+    *out_cp = UTF8_REPLACEMENT;
+    return 1;
+  }
+
+  for (int i = 1; i < n; i++) {
+    if ((size_t)i >= len) return 0;
+    unsigned char b = u[i];
+    if (b < lo || b > hi) {
+      *out_cp = UTF8_REPLACEMENT;
+      return i;
+    }
+    lo = 0x80;
+    hi = 0xBF;
+    cp = (cp << 6) | (b & 0x3F);
+  }
+
+  *out_cp = cp;
+  return n;
+}
+
+size_t utf8_decode_run_scalar(const char* src, size_t len, uint32_t* dst, size_t dst_cap, size_t* consumed) {
+  size_t i = 0, n = 0;
+  while (i < len && n < dst_cap && !is_control(src[i])) {
+    int k = utf8_decode_scalar(src + i, len - i, &dst[n]);
+    if (k == 0) break;
+    i += k;
+    n++;
+  }
+  *consumed = i;
+  return n;
+}
+
+#ifdef UTF8_SIMD
+
+// The kernel below is written once against these few operations on 16 x u8
+// and 8 x u16 vectors. Byte masks are 0x00/0xFF per lane.
+#if defined(__SSE2__)
+typedef __m128i v8;
+typedef __m128i v16;
+
+static inline v8 v8_load(const char* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline v8 v8_splat(uint8_t x) { return _mm_set1_epi8((char)x); }
+static inline v8 v8_and(v8 a, v8 b) { return _mm_and_si128(a, b); }
+static inline v8 v8_or(v8 a, v8 b) { return _mm_or_si128(a, b); }
+static inline v8 v8_eq(v8 a, v8 b) { return _mm_cmpeq_epi8(a, b); }
+static inline v8 v8_ge(v8 a, v8 b) { return _mm_cmpeq_epi8(_mm_max_epu8(a, b), a); }
+static inline v8 v8_prev1(v8 v) { return _mm_slli_si128(v, 1); }
+static inline v8 v8_prev2(v8 v) { return _mm_slli_si128(v, 2); }
+static inline unsigned v8_mask(v8 m) { return (unsigned)_mm_movemask_epi8(m); }
+
+static inline v16 v16_lo(v8 v) { return _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+static inline v16 v16_hi(v8 v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+static inline v16 v16_mask_lo(v8 m) { return _mm_unpacklo_epi8(m, m); }
+static inline v16 v16_mask_hi(v8 m) { return _mm_unpackhi_epi8(m, m); }
+static inline v16 v16_splat(uint16_t x) { return _mm_set1_epi16((short)x); }
+static inline v16 v16_and(v16 a, v16 b) { return _mm_and_si128(a, b); }
+static inline v16 v16_or(v16 a, v16 b) { return _mm_or_si128(a, b); }
+static inline v16 v16_eq(v16 a, v16 b) { return _mm_cmpeq_epi16(a, b); }
+static inline v16 v16_select(v16 m, v16 a, v16 b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+static inline bool v16_any(v16 m) { return _mm_movemask_epi8(m) != 0; }
+static inline void v16_store(uint16_t* p, v16 v) { _mm_storeu_si128((__m128i*)p, v); }
+#define v16_shl(v, n) _mm_slli_epi16(v, n)
+
+static inline void v8_store_u32(uint32_t* dst, v8 v) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+  _mm_storeu_si128((__m128i*)dst + 0, _mm_unpacklo_epi16(lo, zero));
+  _mm_storeu_si128((__m128i*)dst + 1, _mm_unpackhi_epi16(lo, zero));
+  _mm_storeu_si128((__m128i*)dst + 2, _mm_unpacklo_epi16(hi, zero));
+  _mm_storeu_si128((__m128i*)dst + 3, _mm_unpackhi_epi16(hi, zero));
+}
+#else
+typedef uint8x16_t v8;
+typedef uint16x8_t v16;
+
+static inline v8 v8_load(const char* p) { return vld1q_u8((const uint8_t*)p); }
+static inline v8 v8_splat(uint8_t x) { return vdupq_n_u8(x); }
+static inline v8 v8_and(v8 a, v8 b) { return vandq_u8(a, b); }
+static inline v8 v8_or(v8 a, v8 b) { return vorrq_u8(a, b); }
+static inline v8 v8_eq(v8 a, v8 b) { return vceqq_u8(a, b); }
+static inline v8 v8_ge(v8 a, v8 b) { return vcgeq_u8(a, b); }
+static inline v8 v8_prev1(v8 v) { return vextq_u8(vdupq_n_u8(0), v, 15); }
+static inline v8 v8_prev2(v8 v) { return vextq_u8(vdupq_n_u8(0), v, 14); }
+static inline unsigned v8_mask(v8 m) {
+  static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t t = vandq_u8(m, vld1q_u8(bits));
+  return vaddv_u8(vget_low_u8(t)) | (unsigned)vaddv_u8(vget_high_u8(t)) << 8;
+}
+
+static inline v16 v16_lo(v8 v) { return vmovl_u8(vget_low_u8(v)); }
+static inline v16 v16_hi(v8 v) { return vmovl_u8(vget_high_u8(v)); }
+static inline v16 v16_mask_lo(v8 m) { return vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(vget_low_u8(m)))); }
+static inline v16 v16_mask_hi(v8 m) { return vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(vget_high_u8(m)))); }
+static inline v16 v16_splat(uint16_t x) { return vdupq_n_u16(x); }
+static inline v16 v16_and(v16 a, v16 b) { return vandq_u16(a, b); }
+static inline v16 v16_or(v16 a, v16 b) { return vorrq_u16(a, b); }
+static inline v16 v16_eq(v16 a, v16 b) { return vceqq_u16(a, b); }
+static inline v16 v16_select(v16 m, v16 a, v16 b) { return vbslq_u16(m, a, b); }
+static inline bool v16_any(v16 m) { return vmaxvq_u16(m) != 0; }
+static inline void v16_store(uint16_t* p, v16 v) { vst1q_u16(p, v); }
+#define v16_shl(v, n) vshlq_n_u16(v, n)
+
+static inline void v8_store_u32(uint32_t* dst, v8 v) {
+  uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+  vst1q_u32(dst + 0, vmovl_u16(vget_low_u16(lo)));
+  vst1q_u32(dst + 4, vmovl_u16(vget_high_u16(lo)));
+  vst1q_u32(dst + 8, vmovl_u16(vget_low_u16(hi)));
+  vst1q_u32(dst + 12, vmovl_u16(vget_high_u16(hi)));
+}
+#endif
+
+// Computes, for every byte of one 8-lane half that ends a 1-3 byte sequence,
+// the codepoint it completes. Sets *bad for overlongs and surrogates.
+static inline v16 decode_half(v16 b, v16 p1, v16 p2, v16 end2, v16 end3, bool* bad) {
+  v16 low6 = v16_splat(0x3F);
+  v16 val2 = v16_or(v16_shl(v16_and(p1, v16_splat(0x1F)), 6), v16_and(b, low6));
+  v16 val3 = v16_or(v16_or(v16_shl(v16_and(p2, v16_splat(0x0F)), 12), v16_shl(v16_and(p1, low6), 6)), v16_and(b, low6));
+
+  // 2-byte values must be >= 0x80, 3-byte values >= 0x800 and not D800..DFFF
+  v16 zero = v16_splat(0);
+  v16 overlong2 = v16_and(end2, v16_eq(v16_and(val2, v16_splat(0x780)), zero));
+  v16 top3 = v16_and(val3, v16_splat(0xF800));
+  v16 invalid3 = v16_and(end3, v16_or(v16_eq(top3, zero), v16_eq(top3, v16_splat(0xD800))));
+  if (v16_any(v16_or(overlong2, invalid3))) *bad = true;
+
+  return v16_select(end3, val3, v16_select(end2, val2, b));
+}
+
+// Decodes one 16 byte window starting on a sequence boundary. Returns the
+// bytes consumed (only whole sequences), or 0 if the window needs the scalar
+// path: a control byte, a 4-byte sequence or malformed input.
+static inline size_t decode_window(const char* src, uint32_t* dst, size_t* ncp) {
+  v8 v = v8_load(src);
+
+  v8 high = v8_ge(v, v8_splat(0x80));
+  v8 control = v8_or(v8_eq(v8_ge(v, v8_splat(0x20)), v8_splat(0)), v8_eq(v, v8_splat(0x7F)));
+  if (v8_mask(control)) return 0;
+
+  if (!v8_mask(high)) {
+    v8_store_u32(dst, v);
+    *ncp = 16;
+    return 16;
+  }
+
+  if (v8_mask(v8_ge(v, v8_splat(0xF0)))) return 0;
+
+  v8 cont = v8_eq(v8_and(v, v8_splat(0xC0)), v8_splat(0x80));
+  v8 lead2 = v8_eq(v8_and(v, v8_splat(0xE0)), v8_splat(0xC0));
+  v8 lead3 = v8_eq(v8_and(v, v8_splat(0xF0)), v8_splat(0xE0));
+
+  // Continuation bytes must be exactly where the leads say
+  v8 end2 = v8_prev1(lead2);
+  v8 end3 = v8_prev2(lead3);
+  v8 expected = v8_or(v8_or(end2, v8_prev1(lead3)), end3);
+  if (v8_mask(cont) != v8_mask(expected)) return 0;
+
+  v8 p1 = v8_prev1(v), p2 = v8_prev2(v);
+  bool bad = false;
+  uint16_t vals[16];
+  v16_store(vals, decode_half(v16_lo(v), v16_lo(p1), v16_lo(p2), v16_mask_lo(end2), v16_mask_lo(end3), &bad));
+  v16_store(vals + 8, decode_half(v16_hi(v), v16_hi(p1), v16_hi(p2), v16_mask_hi(end2), v16_mask_hi(end3), &bad));
+  if (bad) return 0;
+
+  // Emit the codepoint at each sequence end, leaving a trailing partial
+  // sequence for the next window
+  unsigned ends = v8_mask(v8_or(v8_or(v8_eq(high, v8_splat(0)), end2), end3));
+  if (!ends) return 0;
+
+  size_t n = 0;
+  size_t used = 32 - __builtin_clz(ends);
+  while (ends) {
+    dst[n++] = vals[__builtin_ctz(ends)];
+    ends &= ends - 1;
+  }
+  *ncp = n;
+  return used;
+}
+
+size_t utf8_decode_run(const char* src, size_t len, uint32_t* dst, size_t dst_cap, size_t* consumed) {
+  size_t i = 0, n = 0;
+
+  while (i < len && n < dst_cap) {
+    if (i + 16 <= len && n + 16 <= dst_cap) {
+      size_t ncp;
+      size_t used = decode_window(src + i, dst + n, &ncp);
+      if (used) {
+        i += used;
+        n += ncp;
+        continue;
+      }
+    }
+
+    // Control byte, 4-byte or malformed sequence, or the tail: one codepoint at a time
+    if (is_control(src[i])) break;
+    int k = utf8_decode_scalar(src + i, len - i, &dst[n]);
+    if (k == 0) break;
+    i += k;
+    n++;
+  }
+
+  *consumed = i;
+  return n;
+}
+
+#else
+
+size_t utf8_decode_run(const char* src, size_t len, uint32_t* dst, size_t dst_cap, size_t* consumed) {
+  return utf8_decode_run_scalar(src, len, dst, dst_cap, consumed);
+}
+
+#endif
+
+int utf8encode(uint32_t cp, char* out) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  }
+
+  if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+
+  if (cp < 0x10000) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+
+  if (cp <= 0x10FFFF) {
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+  }
+
+  return -1;
+}
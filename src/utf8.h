@@ -0,0 +1,25 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UTF8_REPLACEMENT 0xFFFD
+
+// Decodes one codepoint from s, replacing malformed input with U+FFFD one
+// maximal subpart at a time. Returns bytes consumed, or 0 if s ends inside
+// a sequence that may still turn out valid.
+int utf8_decode_scalar(const char* s, size_t len, uint32_t* out_cp);
+
+// Decodes text up to the first C0 control or DEL byte, the end of input, or
+// a sequence cut off by the end of input. Writes at most dst_cap codepoints
+// (dst_cap must be at least 16) and returns how many; *consumed is set to
+// the bytes used. Uses a vector kernel where available, otherwise the
+// scalar decoder, and both produce identical output (make check compares
+// them).
+size_t utf8_decode_run(const char* src, size_t len, uint32_t* dst, size_t dst_cap, size_t* consumed);
+size_t utf8_decode_run_scalar(const char* src, size_t len, uint32_t* dst, size_t dst_cap, size_t* consumed);
+
+int utf8encode(uint32_t cp, char* out);
+
+#endif
@@ -11,6 +11,10 @@
  *   - Vertex Array Objects (VAO)
  *   - Vertex Buffer Objects (VBO)
  *   - Programmable pipeline
+ *
+ * The software backends draw through raster.c instead and either present the
+ * CPU framebuffer as one texture or keep it offscreen. The headless backend
+ * issues the same draw calls as RENDER_GL into a framebuffer object.
  */
 
 #include "window.h"
@@ -23,7 +27,12 @@
 #include <unistd.h>
 
 #include "platform.h"
+#include "fonts.h"
+#include "raster.h"
+#include "utf8.h"
+#include "writequeue.h"
 #include FT_FREETYPE_H
+#include FT_MODULE_H
 
 // Character info for texture atlas
 typedef struct {
@@ -31,26 +40,128 @@ typedef struct {
   float width, height;         // size in pixels
   float bearing_x, bearing_y;  // offset from baseline
   float advance;               // horizontal advance
+  int atlas_x, atlas_y;        // top-left of the bitmap in atlas_pixels
+  int atlas_w, atlas_h;        // its size there, width and height are in 14px font units
 } Character;
 
 static GLFWwindow* g_window = NULL;
 static int g_pty_fd = -1;
 static FT_Library ft;
 static FT_Face face;
-static void (*g_copy_handler)(GLFWwindow*) = NULL;
+static bool (*g_copy_handler)(GLFWwindow*) = NULL;
+static void (*g_paste_handler)(GLFWwindow*) = NULL;
+static void (*g_hud_handler)(void) = NULL;
+static void (*g_zoom_handler)(int step) = NULL;
+static void (*g_mark_handler)(int step) = NULL;
 
 static GLuint text_vao, text_vbo;
 static GLuint text_shader_program;
 static GLuint text_texture;
 static GLuint rect_vao, rect_vbo;
 static GLuint rect_shader_program;
+static GLuint image_shader_program;
+
+static RenderBackend backend = RENDER_GL;
+static uint32_t text_color = 0xFFFFFFFF;  // software backends
+static unsigned char* atlas_pixels = NULL;
+
+// Software backend presentation: the framebuffer as one texture on one quad
+static GLuint present_vao, present_vbo;
+static GLuint present_shader_program;
+static GLuint present_texture;
+static int present_width = 0, present_height = 0;
+
+// Headless backend target
+static GLuint headless_fbo, headless_rbo;
+
+// Row cache: slots of one texture stacked bottom to top, see window_row_cache_reserve()
+static GLuint row_cache_fbo, row_cache_texture;
+static GLuint row_cache_vao, row_cache_vbo;
+static int row_cache_width = 0, row_cache_slots = 0;
+static int text_ascent = 0, text_descent = 0;  // pixels the glyphs reach above and below the baseline at scale 1
+static int row_cache_slot_px = 0;              // slot height the texture was allocated with
+static GLint row_cache_saved_viewport[4];
+static float* row_cache_quads = NULL;
+static int row_cache_queued = 0, row_cache_queue_cap = 0;
+static GLuint gpu_timer;
+
+// The SDF atlas is rasterized once at SDF_PIXEL_SIZE and drawn at any scale;
+// its glyph metrics are kept in FONT_PIXEL_SIZE units like the coverage atlas's
+#define FONT_PIXEL_SIZE 14
+#define SDF_PIXEL_SIZE 32
+#define SDF_SPREAD 4  // atlas pixels of distance on either side of an outline
+
+// ASCII is rasterized up front into the first 128 entries, everything else
+// when first drawn, from the first font in the chain that has it
+#define MAX_GLYPHS 4096
+#define GLYPH_SLOTS 8192        // codepoint hash, kept at most half full
+#define ATLAS_MAX_HEIGHT 4096  // the atlas doubles up to this as glyphs are added
+
+static Character characters[MAX_GLYPHS];
+static int glyph_count = 128;
+static uint32_t glyph_keys[GLYPH_SLOTS];    // codepoints, 0 for a free slot
+static uint16_t glyph_values[GLYPH_SLOTS];  // index into characters, 0 when no font has the codepoint
+static int glyph_slots_used = 0;
+static int pen_x = 0, pen_y = 0, pen_row_height = 0;  // where the next glyph goes in the atlas
+static FT_Face sized_face = NULL;                     // the face last given the atlas's pixel size
+static bool sdf_atlas = false;
+static bool atlas_is_sdf = false;  // what atlas_pixels currently holds
+static float text_scale = 1.0f;
+
+// CPU backends draw from coverage resampled to text_scale. Glyphs are packed
+// one after another in pixels, each width bytes a row. Two sets cover a
+// zoomed terminal under the unzoomed overlay within one frame.
+typedef struct {
+  size_t offset;
+  int width, height;
+} ScaledGlyph;
+
+// Frames record pointers into the pixels and draw at the end, so a buffer
+// outgrown mid-frame is kept until the set is reused for another scale
+#define RETIRED_MAX 32
 
-static Character characters[128];
+typedef struct {
+  float scale;  // 0 for an empty set
+  unsigned char* pixels;
+  size_t used, cap;
+  unsigned char* retired[RETIRED_MAX];
+  int retired_count;
+  int count;  // glyphs resampled so far, new ones are added as they show up
+  unsigned last_used;
+  ScaledGlyph glyphs[MAX_GLYPHS];
+} ScaledGlyphs;
+
+static ScaledGlyphs scaled_sets[2];
+static unsigned scaled_uses = 0;
 static int atlas_width = 512;
 static int atlas_height = 512;
+static unsigned char* retired_atlases[RETIRED_MAX];  // outgrown, still drawn from until the next rebuild
+static int retired_atlas_count = 0;
+static int atlas_glyphs = 0;
+static int atlas_used_height = 0;
+
+static int draw_calls = 0;  // since the last window_take_draw_calls()
+
+// GLFW reports neither occlusion nor a window on another workspace, only these
+static bool window_iconified = false;
+static bool window_focused = true;
 
 static void error_callback(int error, const char* desc) { fprintf(stderr, "GLFW Error (%d): %s\n", error, desc); }
 
+static bool draws_on_cpu(void) { return backend == RENDER_SOFTWARE || backend == RENDER_OFFSCREEN; }
+
+// Pixel coordinates with the origin at the top left
+// DEPRECATED: glOrtho() - we compute the matrix ourselves instead
+// Equivalent to: glOrtho(0, fb_width, fb_height, 0, -1, 1)
+static void set_projection(GLuint program, int fb_width, int fb_height) {
+  float projection[16] = {
+      2.0f / fb_width, 0.0f, 0.0f, 0.0f, 0.0f, -2.0f / fb_height, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f,
+      -1.0f,           1.0f, 0.0f, 1.0f};
+  glUseProgram(program);
+  glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, projection);
+  glUseProgram(0);
+}
+
 // Compile a shader and check for errors
 static GLuint compile_shader(GLenum type, const char* source) {
   GLuint shader = glCreateShader(type);
@@ -91,64 +202,282 @@ static GLuint create_shader_program(const char* vertex_src, const char* fragment
   return program;
 }
 
-// Create texture atlas with all ASCII characters
-static bool create_texture_atlas(void) {
+static int ceil_px(float v) {
+  int i = (int)v;
+  return i < v ? i + 1 : i;
+}
+
+static void size_face(FT_Face f) {
+  if (f == sized_face) return;
+  FT_Set_Pixel_Sizes(f, 0, sdf_atlas ? SDF_PIXEL_SIZE : FONT_PIXEL_SIZE);
+  sized_face = f;
+}
+
+// The GL copy follows atlas_pixels once it exists. Glyphs can be added while
+// text is being drawn, so whatever texture was bound stays bound.
+static void upload_atlas_rows(int y, int h, bool resized) {
+  if (!text_texture || h <= 0) return;
+  GLint bound;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+  glBindTexture(GL_TEXTURE_2D, text_texture);
+  if (resized) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, atlas_width, atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas_pixels);
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, atlas_width, h, GL_RED, GL_UNSIGNED_BYTE, atlas_pixels + y * atlas_width);
+  }
+  glBindTexture(GL_TEXTURE_2D, bound);
+}
+
+// Doubles the atlas height until height rows fit, existing glyphs keep their pixels
+static bool grow_atlas(int height) {
+  int grown = atlas_height;
+  while (grown < height) grown *= 2;
+  if (grown > ATLAS_MAX_HEIGHT || retired_atlas_count == RETIRED_MAX) return false;
+
+  unsigned char* pixels = calloc((size_t)atlas_width * grown, 1);
+  if (!pixels) return false;
+  memcpy(pixels, atlas_pixels, (size_t)atlas_width * atlas_height);
+  retired_atlases[retired_atlas_count++] = atlas_pixels;
+  atlas_pixels = pixels;
+  atlas_height = grown;
+  for (int i = 0; i < glyph_count; i++) {
+    characters[i].ty0 = (float)characters[i].atlas_y / atlas_height;
+    characters[i].ty1 = (float)(characters[i].atlas_y + characters[i].atlas_h) / atlas_height;
+  }
+  upload_atlas_rows(0, atlas_height, true);
+  return true;
+}
+
+// Rasterizes one glyph of face into the next free spot of the atlas. With
+// sdf_atlas the bitmap is a distance field instead of coverage.
+static bool place_glyph(FT_Face f, uint32_t c, Character* ch) {
+  bool failed = sdf_atlas ? FT_Load_Char(f, c, FT_LOAD_DEFAULT) || FT_Render_Glyph(f->glyph, FT_RENDER_MODE_SDF)
+                          : FT_Load_Char(f, c, FT_LOAD_RENDER);
+  if (failed) return false;
+
+  FT_GlyphSlot g = f->glyph;
+  float unit = sdf_atlas ? (float)FONT_PIXEL_SIZE / SDF_PIXEL_SIZE : 1.0f;  // atlas pixel in metric units
+
+  // Move to next row if needed
+  if (pen_x + g->bitmap.width >= (unsigned)atlas_width) {
+    pen_x = 0;
+    pen_y += pen_row_height;
+    pen_row_height = 0;
+  }
+  if (pen_y + (int)g->bitmap.rows > atlas_height && !grow_atlas(pen_y + g->bitmap.rows)) return false;
+
+  // Copy glyph bitmap into atlas
+  for (unsigned int row = 0; row < g->bitmap.rows; row++) {
+    for (unsigned int col = 0; col < g->bitmap.width; col++) {
+      int x = pen_x + col;
+      int y = pen_y + row;
+      if (x < atlas_width && y < atlas_height) {
+        atlas_pixels[y * atlas_width + x] = g->bitmap.buffer[row * g->bitmap.pitch + col];
+      }
+    }
+  }
+
+  // Store character info
+  ch->tx0 = (float)pen_x / atlas_width;
+  ch->ty0 = (float)pen_y / atlas_height;
+  ch->tx1 = (float)(pen_x + g->bitmap.width) / atlas_width;
+  ch->ty1 = (float)(pen_y + g->bitmap.rows) / atlas_height;
+  ch->width = g->bitmap.width * unit;
+  ch->height = g->bitmap.rows * unit;
+  ch->bearing_x = g->bitmap_left * unit;
+  ch->bearing_y = g->bitmap_top * unit;
+  ch->advance = sdf_atlas ? g->advance.x / 64.0f * unit : g->advance.x >> 6;
+  ch->atlas_x = pen_x;
+  ch->atlas_y = pen_y;
+  ch->atlas_w = g->bitmap.width;
+  ch->atlas_h = g->bitmap.rows;
+  upload_atlas_rows(pen_y, g->bitmap.rows, false);
+
+  pen_x += g->bitmap.width + 1;  // +1 for padding
+  pen_row_height = ((int)g->bitmap.rows > pen_row_height) ? (int)g->bitmap.rows : pen_row_height;
+  atlas_used_height = pen_y + pen_row_height;
+  atlas_glyphs++;
+  return true;
+}
+
+// Rasterizes the ASCII glyphs into atlas_pixels, which every backend keeps,
+// and forgets every glyph added since
+static bool build_glyph_atlas(void) {
   // Create a buffer to hold the atlas
   unsigned char* atlas_buffer = calloc(atlas_width * atlas_height, 1);
   if (!atlas_buffer) {
     fprintf(stderr, "Failed to allocate atlas buffer\n");
     return false;
   }
-
-  int pen_x = 0, pen_y = 0;
-  int row_height = 0;
-
-  // Render all ASCII characters into the atlas
+  free(atlas_pixels);
+  atlas_pixels = atlas_buffer;
+  while (retired_atlas_count > 0) free(retired_atlases[--retired_atlas_count]);
+
+  pen_x = pen_y = pen_row_height = 0;
+  text_ascent = text_descent = 0;
+  atlas_glyphs = 0;
+  atlas_used_height = 0;
+  glyph_count = 128;
+  memset(glyph_keys, 0, sizeof(glyph_keys));
+  glyph_slots_used = 0;
+  sized_face = NULL;
+  size_face(face);
+
+  // Row heights come from ASCII alone, taller fallback glyphs may be clipped
   for (int c = 32; c < 128; c++) {
-    if (FT_Load_Char(face, c, FT_LOAD_RENDER)) {
+    if (!place_glyph(face, c, &characters[c])) {
       fprintf(stderr, "Failed to load character %c\n", c);
       continue;
     }
+    int ascent = ceil_px(characters[c].bearing_y);
+    int descent = ceil_px(characters[c].height - characters[c].bearing_y);
+    if (ascent > text_ascent) text_ascent = ascent;
+    if (descent > text_descent) text_descent = descent;
+  }
+  atlas_is_sdf = sdf_atlas;
+  for (int i = 0; i < 2; i++) scaled_sets[i].scale = 0.0f;
+  return true;
+}
+
+static int load_glyph(uint32_t c) {
+  if (glyph_count == MAX_GLYPHS) return 0;
+  FT_Face f = fonts_face_for(c);
+  if (!f) return 0;
+  size_face(f);
+  if (!place_glyph(f, c, &characters[glyph_count])) return 0;
+  return glyph_count++;
+}
+
+// Index into characters, 0 when there is nothing to draw. A codepoint is
+// looked up in the fonts once, misses are remembered like hits.
+static int glyph_for(uint32_t c) {
+  if (c < 128) return c;
+  uint32_t i = (c * 2654435761u) & (GLYPH_SLOTS - 1);
+  for (; glyph_keys[i]; i = (i + 1) & (GLYPH_SLOTS - 1)) {
+    if (glyph_keys[i] == c) return glyph_values[i];
+  }
 
-    FT_GlyphSlot g = face->glyph;
+  int index = load_glyph(c);
+  if (glyph_slots_used < GLYPH_SLOTS / 2) {
+    glyph_keys[i] = c;
+    glyph_values[i] = index;
+    glyph_slots_used++;
+  }
+  return index;
+}
 
-    // Move to next row if needed
-    if (pen_x + g->bitmap.width >= atlas_width) {
-      pen_x = 0;
-      pen_y += row_height;
-      row_height = 0;
+// Next codepoint of text, ASCII without the decoder
+static uint32_t next_codepoint(const char** p) {
+  unsigned char c = **p;
+  if (c < 0x80) {
+    (*p)++;
+    return c;
+  }
+  uint32_t cp;
+  size_t len = strlen(*p);
+  int n = utf8_decode_scalar(*p, len, &cp);
+  if (n <= 0) {
+    *p += len;  // cut off inside a sequence
+    return 0;
+  }
+  *p += n;
+  return cp;
+}
+
+// Bilinear sample of the atlas, x and y in atlas pixels
+static float sample_atlas(const Character* ch, float x, float y) {
+  int w = ch->atlas_w, h = ch->atlas_h;
+  if (x < 0.0f) x = 0.0f;
+  if (y < 0.0f) y = 0.0f;
+  if (x > w - 1) x = w - 1;
+  if (y > h - 1) y = h - 1;
+  int x0 = (int)x, y0 = (int)y;
+  int x1 = x0 + 1 < w ? x0 + 1 : x0, y1 = y0 + 1 < h ? y0 + 1 : y0;
+  float fx = x - x0, fy = y - y0;
+  const unsigned char* p = atlas_pixels + ch->atlas_y * atlas_width + ch->atlas_x;
+  float top = p[y0 * atlas_width + x0] * (1.0f - fx) + p[y0 * atlas_width + x1] * fx;
+  float bottom = p[y1 * atlas_width + x0] * (1.0f - fx) + p[y1 * atlas_width + x1] * fx;
+  return (top * (1.0f - fy) + bottom * fy) / 255.0f;
+}
+
+// Resamples the glyphs the set doesn't have yet. Distance fields are
+// thresholded with about a pixel of antialiasing, coverage is filtered.
+static bool scale_new_glyphs(ScaledGlyphs* set) {
+  size_t used = set->used;
+  for (int c = set->count; c < glyph_count; c++) {
+    ScaledGlyph* sg = &set->glyphs[c];
+    sg->width = c < 32 ? 0 : ceil_px(characters[c].width * text_scale);
+    sg->height = c < 32 ? 0 : ceil_px(characters[c].height * text_scale);
+    sg->offset = used;
+    used += (size_t)sg->width * sg->height;
+  }
+  if (used > set->cap || !set->pixels) {
+    size_t cap = set->cap ? set->cap : 4096;
+    while (cap < used) cap *= 2;
+    unsigned char* pixels = set->retired_count < RETIRED_MAX ? malloc(cap) : NULL;
+    if (!pixels) return false;
+    if (set->pixels) {
+      memcpy(pixels, set->pixels, set->used);
+      set->retired[set->retired_count++] = set->pixels;
     }
+    set->pixels = pixels;
+    set->cap = cap;
+  }
 
-    // Copy glyph bitmap into atlas
-    for (unsigned int row = 0; row < g->bitmap.rows; row++) {
-      for (unsigned int col = 0; col < g->bitmap.width; col++) {
-        int x = pen_x + col;
-        int y = pen_y + row;
-        if (x < atlas_width && y < atlas_height) {
-          atlas_buffer[y * atlas_width + x] = g->bitmap.buffer[row * g->bitmap.width + col];
+  float unit = atlas_is_sdf ? (float)FONT_PIXEL_SIZE / SDF_PIXEL_SIZE : 1.0f;
+  float step = 1.0f / (text_scale * unit);                         // atlas pixels per output pixel
+  float smoothing = 0.7f * step * 128.0f / (SDF_SPREAD * 255.0f);  // field change across that
+  for (int c = set->count; c < glyph_count; c++) {
+    const Character* ch = &characters[c];
+    const ScaledGlyph* sg = &set->glyphs[c];
+    for (int y = 0; y < sg->height; y++) {
+      for (int x = 0; x < sg->width; x++) {
+        float v = sample_atlas(ch, (x + 0.5f) * step - 0.5f, (y + 0.5f) * step - 0.5f);
+        if (atlas_is_sdf) {
+          float t = (v - 0.5f + smoothing) / (2.0f * smoothing);
+          t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+          v = t * t * (3.0f - 2.0f * t);
         }
+        set->pixels[sg->offset + (size_t)y * sg->width + x] = (unsigned char)(v * 255.0f + 0.5f);
       }
     }
+  }
+  set->used = used;
+  set->count = glyph_count;
+  return true;
+}
 
-    // Store character info
-    characters[c].tx0 = (float)pen_x / atlas_width;
-    characters[c].ty0 = (float)pen_y / atlas_height;
-    characters[c].tx1 = (float)(pen_x + g->bitmap.width) / atlas_width;
-    characters[c].ty1 = (float)(pen_y + g->bitmap.rows) / atlas_height;
-    characters[c].width = g->bitmap.width;
-    characters[c].height = g->bitmap.rows;
-    characters[c].bearing_x = g->bitmap_left;
-    characters[c].bearing_y = g->bitmap_top;
-    characters[c].advance = g->advance.x >> 6;
-
-    pen_x += g->bitmap.width + 1;  // +1 for padding
-    row_height = (g->bitmap.rows > row_height) ? g->bitmap.rows : row_height;
+// Glyphs resampled to text_scale for the CPU backends, reusing the least
+// recently used set for a new scale
+static const ScaledGlyphs* scale_glyphs(void) {
+  ScaledGlyphs* set = NULL;
+  for (int i = 0; i < 2 && !set; i++) {
+    if (scaled_sets[i].scale == text_scale) set = &scaled_sets[i];
   }
+  if (!set) {
+    set = scaled_sets[0].last_used <= scaled_sets[1].last_used ? &scaled_sets[0] : &scaled_sets[1];
+    set->scale = 0.0f;
+    set->count = 0;
+    set->used = 0;
+    while (set->retired_count > 0) free(set->retired[--set->retired_count]);
+    // The new pixels may sit where last frame's glyphs did, which the damage
+    // tracking would take for unchanged
+    raster_invalidate();
+  }
+  if (set->count < glyph_count && !scale_new_glyphs(set)) {
+    set->scale = 0.0f;
+    return NULL;
+  }
+  set->scale = text_scale;
+  set->last_used = ++scaled_uses;
+  return set;
+}
 
-  // Create OpenGL texture
+// The GL backends sample a copy of atlas_pixels, the software ones the bitmap itself
+static void upload_glyph_atlas(void) {
   glGenTextures(1, &text_texture);
   glBindTexture(GL_TEXTURE_2D, text_texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, atlas_width, atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas_buffer);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, atlas_width, atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas_pixels);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -156,22 +485,65 @@ static bool create_texture_atlas(void) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
   glBindTexture(GL_TEXTURE_2D, 0);
-  free(atlas_buffer);
-
-  return true;
 }
 
 void set_pty_fd(int fd) { g_pty_fd = fd; }
 
-void set_copy_handler(void (*handler)(GLFWwindow*)) { g_copy_handler = handler; }
+void set_copy_handler(bool (*handler)(GLFWwindow*)) { g_copy_handler = handler; }
+
+void set_paste_handler(void (*handler)(GLFWwindow*)) { g_paste_handler = handler; }
+
+void set_hud_handler(void (*handler)(void)) { g_hud_handler = handler; }
+
+void set_zoom_handler(void (*handler)(int step)) { g_zoom_handler = handler; }
+
+void set_mark_handler(void (*handler)(int step)) { g_mark_handler = handler; }
+
+// Queued rather than written directly, see writequeue.c
+static void pty_write(const char* data, size_t len) { writequeue_push(data, len); }
 
 void key_callback(GLFWwindow* g_window, int key, int scancode, int action, int mods) {
   if (action != GLFW_PRESS && action != GLFW_REPEAT) return;
 
-  // Handle Cmd+C / Ctrl+C for copy (Super on Mac, Control elsewhere)
+  // Cmd+C / Ctrl+C copies the selection (Super on Mac, Control elsewhere),
+  // without one Ctrl+C goes to the shell as usual
   if (key == GLFW_KEY_C && (mods & (GLFW_MOD_SUPER | GLFW_MOD_CONTROL))) {
-    if (g_copy_handler) {
-      g_copy_handler(g_window);
+    if (g_copy_handler && g_copy_handler(g_window)) return;
+  }
+
+  // Cmd+V / Ctrl+Shift+V for paste
+  if (key == GLFW_KEY_V && ((mods & GLFW_MOD_SUPER) || ((mods & GLFW_MOD_CONTROL) && (mods & GLFW_MOD_SHIFT)))) {
+    if (g_paste_handler) {
+      g_paste_handler(g_window);
+      return;
+    }
+  }
+
+  if (key == GLFW_KEY_F12 && g_hud_handler) {
+    g_hud_handler();
+    return;
+  }
+
+  // Cmd or Ctrl+Shift with Up/Down jumps between prompts, with O copies a command's output
+  if (((mods & GLFW_MOD_SUPER) || ((mods & GLFW_MOD_CONTROL) && (mods & GLFW_MOD_SHIFT))) && g_mark_handler) {
+    if (key == GLFW_KEY_UP || key == GLFW_KEY_DOWN || key == GLFW_KEY_O) {
+      g_mark_handler(key == GLFW_KEY_UP ? -1 : key == GLFW_KEY_DOWN ? 1 : 0);
+      return;
+    }
+  }
+
+  // Ctrl/Cmd with + - 0 zooms in, out and back
+  if ((mods & (GLFW_MOD_SUPER | GLFW_MOD_CONTROL)) && g_zoom_handler) {
+    if (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD) {
+      g_zoom_handler(1);
+      return;
+    }
+    if (key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT) {
+      g_zoom_handler(-1);
+      return;
+    }
+    if (key == GLFW_KEY_0 || key == GLFW_KEY_KP_0) {
+      g_zoom_handler(0);
       return;
     }
   }
@@ -180,35 +552,35 @@ void key_callback(GLFWwindow* g_window, int key, int scancode, int action, int m
 
   switch (key) {
     case GLFW_KEY_ENTER:
-      write(g_pty_fd, "\n", 1);
+      pty_write("\n", 1);
       break;
     case GLFW_KEY_BACKSPACE:
-      write(g_pty_fd, "\x7f", 1);  // DEL character
+      pty_write("\x7f", 1);  // DEL character
       break;
     case GLFW_KEY_TAB:
-      write(g_pty_fd, "\t", 1);
+      pty_write("\t", 1);
       break;
     case GLFW_KEY_ESCAPE:
-      write(g_pty_fd, "\x1b", 1);  // ESC character
+      pty_write("\x1b", 1);  // ESC character
       break;
     case GLFW_KEY_UP:
-      write(g_pty_fd, "\x1b[A", 3);  // ANSI escape sequence for up arrow
+      pty_write("\x1b[A", 3);  // ANSI escape sequence for up arrow
       break;
     case GLFW_KEY_DOWN:
-      write(g_pty_fd, "\x1b[B", 3);
+      pty_write("\x1b[B", 3);
       break;
     case GLFW_KEY_RIGHT:
-      write(g_pty_fd, "\x1b[C", 3);
+      pty_write("\x1b[C", 3);
       break;
     case GLFW_KEY_LEFT:
-      write(g_pty_fd, "\x1b[D", 3);
+      pty_write("\x1b[D", 3);
       break;
     // Ctrl key combinations
     case GLFW_KEY_C:
-      if (mods & GLFW_MOD_CONTROL) write(g_pty_fd, "\x03", 1);  // Ctrl+C
+      if (mods & GLFW_MOD_CONTROL) pty_write("\x03", 1);  // Ctrl+C
       break;
     case GLFW_KEY_D:
-      if (mods & GLFW_MOD_CONTROL) write(g_pty_fd, "\x04", 1);  // Ctrl+D
+      if (mods & GLFW_MOD_CONTROL) pty_write("\x04", 1);  // Ctrl+D
       break;
   }
 }
@@ -217,30 +589,10 @@ void char_callback(GLFWwindow* g_window, uint32_t codepoint) {
   if (g_pty_fd < 0) return;
 
   char buf[4];
-  int len = 0;
-
-  // TODO pass this to utf8encode function once we refactor
-  if (codepoint < 0x80) {
-    buf[0] = (char)codepoint;
-    len = 1;
-  } else if (codepoint < 0x800) {
-    buf[0] = 0xC0 | (codepoint >> 6);
-    buf[1] = 0x80 | (codepoint & 0x3F);
-    len = 2;
-  } else if (codepoint < 0x10000) {
-    buf[0] = 0xE0 | (codepoint >> 12);
-    buf[1] = 0x80 | ((codepoint >> 6) & 0x3F);
-    buf[2] = 0x80 | (codepoint & 0x3F);
-    len = 3;
-  } else {
-    buf[0] = 0xF0 | (codepoint >> 18);
-    buf[1] = 0x80 | ((codepoint >> 12) & 0x3F);
-    buf[2] = 0x80 | ((codepoint >> 6) & 0x3F);
-    buf[3] = 0x80 | (codepoint & 0x3F);
-    len = 4;
-  }
+  int len = utf8encode(codepoint, buf);
+  if (len < 0) return;
 
-  write(g_pty_fd, buf, len);
+  pty_write(buf, len);
 }
 
 static bool init_rect_rendering(int fb_width, int fb_height) {
@@ -263,15 +615,7 @@ static bool init_rect_rendering(int fb_width, int fb_height) {
   rect_shader_program = create_shader_program(rect_vertex_src, rect_fragment_src);
 
   // Set up projection matrix (same as text rendering)
-  // DEPRECATED: glOrtho() - we compute the matrix ourselves instead
-  glUseProgram(rect_shader_program);
-  GLint projection_loc = glGetUniformLocation(rect_shader_program, "projection");
-
-  float projection[16] = {
-      2.0f / fb_width, 0.0f, 0.0f, 0.0f, 0.0f, -2.0f / fb_height, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f,
-      -1.0f,           1.0f, 0.0f, 1.0f};
-  glUniformMatrix4fv(projection_loc, 1, GL_FALSE, projection);
-  glUseProgram(0);
+  set_projection(rect_shader_program, fb_width, fb_height);
 
   // Create VAO and VBO
   glGenVertexArrays(1, &rect_vao);
@@ -291,9 +635,161 @@ static bool init_rect_rendering(int fb_width, int fb_height) {
   return true;
 }
 
+static int round_px(float v) { return (int)(v < 0.0f ? v - 0.5f : v + 0.5f); }
+
+static uint32_t pack_color(float r, float g, float b) {
+  float c[3] = {r, g, b};
+  uint32_t out = 0xFF000000u;
+  for (int i = 0; i < 3; i++) {
+    float v = c[i] < 0.0f ? 0.0f : (c[i] > 1.0f ? 1.0f : c[i]);
+    out |= (uint32_t)(v * 255.0f + 0.5f) << (16 - 8 * i);
+  }
+  return out;
+}
+
+static bool init_present(void) {
+  const char* vertex_src =
+      "#version 330 core\n"
+      "layout (location = 0) in vec4 vertex;\n"
+      "out vec2 TexCoords;\n"
+      "void main() {\n"
+      "    gl_Position = vec4(vertex.xy, 0.0, 1.0);\n"
+      "    TexCoords = vertex.zw;\n"
+      "}\n";
+
+  const char* fragment_src =
+      "#version 330 core\n"
+      "in vec2 TexCoords;\n"
+      "out vec4 color;\n"
+      "uniform sampler2D frame;\n"
+      "void main() {\n"
+      "    color = texture(frame, TexCoords);\n"
+      "}\n";
+
+  present_shader_program = create_shader_program(vertex_src, fragment_src);
+
+  // Framebuffer row 0 is the top of the window
+  float quad[6][4] = {
+      {-1.0f, 1.0f, 0.0f, 0.0f}, {-1.0f, -1.0f, 0.0f, 1.0f}, {1.0f, -1.0f, 1.0f, 1.0f},
+      {-1.0f, 1.0f, 0.0f, 0.0f}, {1.0f, -1.0f, 1.0f, 1.0f},  {1.0f, 1.0f, 1.0f, 0.0f},
+  };
+
+  glGenVertexArrays(1, &present_vao);
+  glGenBuffers(1, &present_vbo);
+  glBindVertexArray(present_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, present_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+
+  glGenTextures(1, &present_texture);
+  glBindTexture(GL_TEXTURE_2D, present_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  return true;
+}
+
+// Uploads the rows that changed, then draws the whole frame as one quad
+static void present_software(bool changed, int y0, int y1) {
+  int fb_width, fb_height;
+  glfwGetFramebufferSize(g_window, &fb_width, &fb_height);
+
+  glBindTexture(GL_TEXTURE_2D, present_texture);
+  if (fb_width != present_width || fb_height != present_height) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, fb_width, fb_height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    present_width = fb_width;
+    present_height = fb_height;
+    y0 = 0;
+    y1 = fb_height;
+    changed = true;
+  }
+  if (changed) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, fb_width, y1 - y0, GL_BGRA, GL_UNSIGNED_BYTE,
+                    raster_pixels() + (size_t)y0 * fb_width);
+  }
+
+  glViewport(0, 0, fb_width, fb_height);
+  glUseProgram(present_shader_program);
+  glBindVertexArray(present_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  draw_calls++;
+
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+}
+
+void window_set_backend(RenderBackend b) { backend = b; }
+
+static void iconify_callback(GLFWwindow* window, int iconified) {
+  (void)window;
+  window_iconified = iconified;
+}
+
+static void focus_callback(GLFWwindow* window, int focused) {
+  (void)window;
+  window_focused = focused;
+}
+
+static void install_callbacks(void) {
+  glfwSetCharCallback(g_window, char_callback);
+  glfwSetKeyCallback(g_window, key_callback);
+  glfwSetWindowIconifyCallback(g_window, iconify_callback);
+  glfwSetWindowFocusCallback(g_window, focus_callback);
+  window_iconified = glfwGetWindowAttrib(g_window, GLFW_ICONIFIED);
+  window_focused = glfwGetWindowAttrib(g_window, GLFW_FOCUSED);
+}
+
+static bool load_font(void) {
+  if (FT_Init_FreeType(&ft)) {
+    fprintf(stderr, "Could not init FreetType\n");
+    return false;
+  }
+
+  if (!fonts_open(ft)) return false;
+  face = fonts_primary();
+
+  FT_Int spread = SDF_SPREAD;
+  FT_Property_Set(ft, "sdf", "spread", &spread);
+  return true;
+}
+
+// A process forked from the server may ask for the other kind of atlas, only
+// the glyphs are rasterized again then
+bool window_preload_font(void) {
+  if (atlas_pixels && atlas_is_sdf == sdf_atlas) return true;
+  if (!face && !load_font()) return false;
+  return build_glyph_atlas();
+}
+
+void window_add_font(const char* path) { fonts_add(path); }
+
+void window_set_sdf_atlas(bool enable) { sdf_atlas = enable; }
+
+void window_set_text_scale(float scale) {
+  if (scale > 0.0f) text_scale = scale;
+}
+
+float window_get_content_scale(void) {
+  if (!g_window || backend == RENDER_OFFSCREEN || backend == RENDER_HEADLESS) return 1.0f;
+  float x, y;
+  glfwGetWindowContentScale(g_window, &x, &y);
+  return x > 0.0f ? x : 1.0f;
+}
+
 bool window_init(const char* title, int width, int height) {
   glfwSetErrorCallback(error_callback);
 
+  // Offscreen and headless need no display at all
+  bool displayless = backend == RENDER_OFFSCREEN || backend == RENDER_HEADLESS;
+  if (displayless) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+
   if (!glfwInit()) {
     fprintf(stderr, "Failed to init GLFW\n");
     return false;
@@ -315,6 +811,7 @@ bool window_init(const char* title, int width, int height) {
   // Wayland compatibility: ensure window is visible
   glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
   glfwWindowHint(GLFW_FOCUSED, GLFW_TRUE);
+  if (displayless) glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
   g_window = glfwCreateWindow(width, height, title, NULL, NULL);
   if (!g_window) {
@@ -326,48 +823,55 @@ bool window_init(const char* title, int width, int height) {
   // Explicitly show window (important for Wayland)
   glfwShowWindow(g_window);
 
-  glfwMakeContextCurrent(g_window);
-  glfwSwapInterval(1);  // 1 enable vsync 0 disable vsync
-
-  if (!platform_init_gl()) {
-    return false;
-  }
-
   int fb_width, fb_height;
   glfwGetFramebufferSize(g_window, &fb_width, &fb_height);
-  glViewport(0, 0, fb_width, fb_height);
 
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  if (backend == RENDER_HEADLESS) {
+    // the GLFW window only carries the size, EGL provides the context
+    if (!platform_create_headless_gl() || !platform_init_gl()) {
+      return false;
+    }
 
-  if (FT_Init_FreeType(&ft)) {
-    fprintf(stderr, "Could not init FreetType\n");
-    return false;
+    glGenFramebuffers(1, &headless_fbo);
+    glGenRenderbuffers(1, &headless_rbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, fb_width, fb_height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_rbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      fprintf(stderr, "Headless framebuffer incomplete\n");
+      return false;
+    }
   }
 
-  // Platform-specific monospace font paths
-  // TODO: Make font path configurable instead of hardcoding
-  const char** font_paths = platform_get_font_paths();
+  if (backend == RENDER_GL || backend == RENDER_SOFTWARE) {
+    glfwMakeContextCurrent(g_window);
+    glfwSwapInterval(1);  // 1 enable vsync 0 disable vsync
 
-  bool font_loaded = false;
-  for (int i = 0; font_paths[i] != NULL; i++) {
-    if (FT_New_Face(ft, font_paths[i], 0, &face) == 0) {
-      font_loaded = true;
-      break;
+    if (!platform_init_gl()) {
+      return false;
     }
   }
 
-  if (!font_loaded) {
-    fprintf(stderr, "Could not open any font\n");
-    return false;
+  if (backend != RENDER_OFFSCREEN) {
+    glViewport(0, 0, fb_width, fb_height);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   }
-  FT_Set_Pixel_Sizes(face, 0, 14);
 
-  // Create texture atlas
-  if (!create_texture_atlas()) {
+  if (!window_preload_font()) {
     return false;
   }
 
+  if (draws_on_cpu()) {
+    if (backend == RENDER_SOFTWARE && !init_present()) return false;
+    install_callbacks();
+    return true;
+  }
+
+  upload_glyph_atlas();
+
   // Create shader program
   const char* vertex_shader_src =
       "#version 330 core\n"
@@ -390,20 +894,39 @@ bool window_init(const char* title, int width, int height) {
       "    color = vec4(textColor, 1.0) * sampled;\n"
       "}\n";
 
-  text_shader_program = create_shader_program(vertex_shader_src, fragment_shader_src);
+  // The outline is where the field crosses 0.5, antialiased over about a
+  // pixel at whatever size the quad is drawn
+  const char* sdf_fragment_src =
+      "#version 330 core\n"
+      "in vec2 TexCoords;\n"
+      "out vec4 color;\n"
+      "uniform sampler2D text;\n"
+      "uniform vec3 textColor;\n"
+      "void main() {\n"
+      "    float dist = texture(text, TexCoords).r;\n"
+      "    float smoothing = 0.7 * fwidth(dist);\n"
+      "    float alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, dist);\n"
+      "    color = vec4(textColor, alpha);\n"
+      "}\n";
 
-  // Set up projection matrix
-  glUseProgram(text_shader_program);
-  GLint projection_loc = glGetUniformLocation(text_shader_program, "projection");
+  text_shader_program =
+      create_shader_program(vertex_shader_src, atlas_is_sdf ? sdf_fragment_src : fragment_shader_src);
 
-  // Create orthographic projection matrix manually
-  // DEPRECATED: glOrtho() - we compute the matrix ourselves instead
-  // Equivalent to: glOrtho(0, fb_width, fb_height, 0, -1, 1)
-  float projection[16] = {
-      2.0f / fb_width, 0.0f, 0.0f, 0.0f, 0.0f, -2.0f / fb_height, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f,
-      -1.0f,           1.0f, 0.0f, 1.0f};
-  glUniformMatrix4fv(projection_loc, 1, GL_FALSE, projection);
-  glUseProgram(0);
+  // Images share the text quads, colour comes from the texture
+  const char* image_fragment_src =
+      "#version 330 core\n"
+      "in vec2 TexCoords;\n"
+      "out vec4 color;\n"
+      "uniform sampler2D image;\n"
+      "void main() {\n"
+      "    color = texture(image, TexCoords);\n"
+      "}\n";
+
+  image_shader_program = create_shader_program(vertex_shader_src, image_fragment_src);
+
+  // Set up projection matrix
+  set_projection(text_shader_program, fb_width, fb_height);
+  set_projection(image_shader_program, fb_width, fb_height);
 
   // Set up VAO and VBO for dynamic rendering
   glGenVertexArrays(1, &text_vao);
@@ -422,13 +945,18 @@ bool window_init(const char* title, int width, int height) {
   if (!init_rect_rendering(fb_width, fb_height)) {
     return false;
   }
-  glfwSetCharCallback(g_window, char_callback);
-  glfwSetKeyCallback(g_window, key_callback);
+  install_callbacks();
 
   return true;
 }
 
 void window_draw_rect(float x, float y, float w, float h, float r, float g, float b) {
+  if (draws_on_cpu()) {
+    int x0 = round_px(x), y0 = round_px(y);
+    raster_rect(x0, y0, round_px(x + w) - x0, round_px(y + h) - y0, pack_color(r, g, b));
+    return;
+  }
+
   glUseProgram(rect_shader_program);
 
   // Set the color uniform
@@ -455,6 +983,7 @@ void window_draw_rect(float x, float y, float w, float h, float r, float g, floa
 
   // Draw the 6 vertices as triangles
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  draw_calls++;
 
   // Cleanup
   glBindVertexArray(0);
@@ -462,48 +991,193 @@ void window_draw_rect(float x, float y, float w, float h, float r, float g, floa
 }
 
 void window_clear(float r, float g, float b) {
+  if (draws_on_cpu()) {
+    int fb_width, fb_height;
+    glfwGetFramebufferSize(g_window, &fb_width, &fb_height);
+    raster_begin(fb_width, fb_height, pack_color(r, g, b));
+    return;
+  }
+
   glClearColor(r, g, b, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT);
 }
 
-void window_swap(void) { glfwSwapBuffers(g_window); }
+void window_swap(void) {
+  if (backend == RENDER_GL) {
+    glfwSwapBuffers(g_window);
+    return;
+  }
+  if (backend == RENDER_HEADLESS) {
+    glFlush();  // nothing to present
+    return;
+  }
+
+  int y0 = 0, y1 = 0;
+  bool changed = raster_end(&y0, &y1);
+  if (backend == RENDER_SOFTWARE) {
+    present_software(changed, y0, y1);
+    glfwSwapBuffers(g_window);
+  }
+}
+
+bool window_save_frame(const char* path) { return draws_on_cpu() && raster_write_ppm(path); }
+
+void window_set_vsync(bool enable) {
+  if (backend == RENDER_GL || backend == RENDER_SOFTWARE) glfwSwapInterval(enable ? 1 : 0);
+}
+
+// Reallocates the headless target, windowed backends follow the window instead
+bool window_resize(int width, int height) {
+  if (backend != RENDER_HEADLESS) return false;
+
+  glfwSetWindowSize(g_window, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, headless_rbo);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glViewport(0, 0, width, height);
+  set_projection(text_shader_program, width, height);
+  set_projection(rect_shader_program, width, height);
+  set_projection(image_shader_program, width, height);
+  return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// GL_TIME_ELAPSED queries are core in 3.3, only one can be open at a time
+void window_gpu_timer_begin(void) {
+  if (!gpu_timer) glGenQueries(1, &gpu_timer);
+  glBeginQuery(GL_TIME_ELAPSED, gpu_timer);
+}
+
+double window_gpu_timer_end(void) {
+  glEndQuery(GL_TIME_ELAPSED);
+  GLuint64 ns = 0;
+  glGetQueryObjectui64v(gpu_timer, GL_QUERY_RESULT, &ns);
+  return ns / 1e6;
+}
 
 void window_poll(void) { glfwPollEvents(); }
 
 bool window_should_close(void) { return glfwWindowShouldClose(g_window); }
 
+// The displayless backends are always looked at, their frames are the output
+WindowVisibility window_visibility(void) {
+  if (backend == RENDER_OFFSCREEN || backend == RENDER_HEADLESS) return WINDOW_FOCUSED;
+  if (window_iconified || !glfwGetWindowAttrib(g_window, GLFW_VISIBLE)) return WINDOW_HIDDEN;
+  return window_focused ? WINDOW_FOCUSED : WINDOW_UNFOCUSED;
+}
+
 void window_get_size(int* window_width, int* window_height) {
   glfwGetFramebufferSize(g_window, window_width, window_height);
 }
 
 GLFWwindow* window_get_glfw_window(void) { return g_window; }
 
+int window_take_draw_calls(void) {
+  int n = draw_calls;
+  draw_calls = 0;
+  return n;
+}
+
+void window_get_atlas_usage(int* glyphs, int* used_px, int* total_px) {
+  *glyphs = atlas_glyphs;
+  *used_px = atlas_used_height * atlas_width;
+  *total_px = atlas_height * atlas_width;
+}
+
+// Hand pointer while hovering a link, the default arrow otherwise
+void window_set_link_cursor(bool link) {
+  static GLFWcursor* hand = NULL;
+  if (link && !hand) hand = glfwCreateStandardCursor(GLFW_HAND_CURSOR);
+  glfwSetCursor(g_window, link ? hand : NULL);
+}
+
 void window_shutdown(void) {
   // Clean up OpenGL resources
-  glDeleteVertexArrays(1, &text_vao);
-  glDeleteBuffers(1, &text_vbo);
-  glDeleteProgram(text_shader_program);
-  glDeleteVertexArrays(1, &rect_vao);
-  glDeleteBuffers(1, &rect_vbo);
-  glDeleteProgram(rect_shader_program);
-  glDeleteTextures(1, &text_texture);
+  if (!draws_on_cpu()) {
+    glDeleteVertexArrays(1, &text_vao);
+    glDeleteBuffers(1, &text_vbo);
+    glDeleteProgram(text_shader_program);
+    glDeleteVertexArrays(1, &rect_vao);
+    glDeleteBuffers(1, &rect_vbo);
+    glDeleteProgram(rect_shader_program);
+    glDeleteProgram(image_shader_program);
+    glDeleteTextures(1, &text_texture);
+    text_texture = 0;
+    if (row_cache_fbo) {
+      glDeleteFramebuffers(1, &row_cache_fbo);
+      glDeleteTextures(1, &row_cache_texture);
+      glDeleteVertexArrays(1, &row_cache_vao);
+      glDeleteBuffers(1, &row_cache_vbo);
+    }
+    if (gpu_timer) glDeleteQueries(1, &gpu_timer);
+    if (backend == RENDER_HEADLESS) {
+      glDeleteFramebuffers(1, &headless_fbo);
+      glDeleteRenderbuffers(1, &headless_rbo);
+    }
+  } else if (backend == RENDER_SOFTWARE) {
+    glDeleteVertexArrays(1, &present_vao);
+    glDeleteBuffers(1, &present_vbo);
+    glDeleteProgram(present_shader_program);
+    glDeleteTextures(1, &present_texture);
+  }
+  raster_free();
+  free(atlas_pixels);
+  while (retired_atlas_count > 0) free(retired_atlases[--retired_atlas_count]);
+  for (int i = 0; i < 2; i++) {
+    free(scaled_sets[i].pixels);
+    while (scaled_sets[i].retired_count > 0) free(scaled_sets[i].retired[--scaled_sets[i].retired_count]);
+  }
+  free(row_cache_quads);
 
   // Clean up FreeType
-  FT_Done_Face(face);
+  fonts_close();
   FT_Done_FreeType(ft);
 
   if (g_window) glfwDestroyWindow(g_window);
+  if (backend == RENDER_HEADLESS) platform_destroy_headless_gl();
   glfwTerminate();
 }
 
 void window_set_text_color(float r, float g, float b) {
+  if (draws_on_cpu()) {
+    text_color = pack_color(r, g, b);
+    return;
+  }
+
   glUseProgram(text_shader_program);
   GLint text_color_loc = glGetUniformLocation(text_shader_program, "textColor");
   glUniform3f(text_color_loc, r, g, b);
   glUseProgram(0);
 }
 
+// Glyphs land on whole pixels so the software output is exact and repeatable
+static void raster_text(float x, float y, const char* text) {
+  bool scaling = atlas_is_sdf || text_scale != 1.0f;
+  for (const char* p = text; *p;) {
+    int c = glyph_for(next_codepoint(&p));
+    if (c < 32) continue;
+
+    const Character* ch = &characters[c];
+    int gx = round_px(x + ch->bearing_x * text_scale);
+    int gy = round_px(y - ch->bearing_y * text_scale);
+    if (scaling) {
+      // after glyph_for(), which may have added the glyph
+      const ScaledGlyphs* scaled = scale_glyphs();
+      if (!scaled) return;
+      const ScaledGlyph* sg = &scaled->glyphs[c];
+      raster_glyph(gx, gy, sg->width, sg->height, scaled->pixels + sg->offset, sg->width, text_color);
+    } else {
+      raster_glyph(gx, gy, (int)ch->width, (int)ch->height, atlas_pixels + ch->atlas_y * atlas_width + ch->atlas_x,
+                   atlas_width, text_color);
+    }
+    x += ch->advance * text_scale;
+  }
+}
+
 void window_draw_text(float x, float y, const char* text) {
+  if (draws_on_cpu()) {
+    raster_text(x, y, text);
+    return;
+  }
+
   // Use the shader program
   glUseProgram(text_shader_program);
 
@@ -515,17 +1189,17 @@ void window_draw_text(float x, float y, const char* text) {
   glBindVertexArray(text_vao);
 
   // Iterate through all characters
-  for (const char* p = text; *p; p++) {
-    unsigned char c = *p;
-    if (c < 32 || c >= 128) continue;
+  for (const char* p = text; *p;) {
+    int c = glyph_for(next_codepoint(&p));
+    if (c < 32) continue;
 
     Character ch = characters[c];
 
-    float xpos = x + ch.bearing_x;
-    float ypos = y - ch.bearing_y;
+    float xpos = x + ch.bearing_x * text_scale;
+    float ypos = y - ch.bearing_y * text_scale;
 
-    float w = ch.width;
-    float h = ch.height;
+    float w = ch.width * text_scale;
+    float h = ch.height * text_scale;
 
     // Update VBO for each character (6 vertices = 2 triangles)
     // Swap ty0/ty1 to flip glyphs right-side up
@@ -545,9 +1219,10 @@ void window_draw_text(float x, float y, const char* text) {
 
     // Render quad
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    draw_calls++;
 
     // Advance cursor for next glyph
-    x += ch.advance;
+    x += ch.advance * text_scale;
   }
 
   // Unbind everything
@@ -555,3 +1230,175 @@ void window_draw_text(float x, float y, const char* text) {
   glBindTexture(GL_TEXTURE_2D, 0);
   glUseProgram(0);
 }
+
+uint32_t window_image_upload(const uint8_t* rgba, int width, int height) {
+  if (draws_on_cpu()) return 0;
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return texture;
+}
+
+void window_image_free(uint32_t texture) {
+  GLuint t = texture;
+  if (t) glDeleteTextures(1, &t);
+}
+
+void window_draw_image(const WindowImage* image, int src_x, int src_y, int src_w, int src_h, float x, float y, float w,
+                       float h) {
+  if (draws_on_cpu()) {
+    raster_image(round_px(x), round_px(y), round_px(w), round_px(h), image->rgba, image->width * 4, src_x, src_y, src_w,
+                 src_h, image->serial);
+    return;
+  }
+
+  float u0 = (float)src_x / image->width, v0 = (float)src_y / image->height;
+  float u1 = (float)(src_x + src_w) / image->width, v1 = (float)(src_y + src_h) / image->height;
+  float vertices[6][4] = {
+      {x, y + h, u0, v1}, {x, y, u0, v0},     {x + w, y, u1, v0},
+      {x, y + h, u0, v1}, {x + w, y, u1, v0}, {x + w, y + h, u1, v1},
+  };
+
+  glUseProgram(image_shader_program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, image->texture);
+  glBindVertexArray(text_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  draw_calls++;
+
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+}
+
+static int row_cache_ascent(void) { return ceil_px(text_ascent * text_scale); }
+
+static int row_cache_slot_height(void) { return row_cache_ascent() + ceil_px(text_descent * text_scale) + 1; }
+
+// The framebuffer everything else draws into
+static void bind_target(void) { glBindFramebuffer(GL_FRAMEBUFFER, backend == RENDER_HEADLESS ? headless_fbo : 0); }
+
+int window_row_cache_reserve(int slots) {
+  if (draws_on_cpu() || slots < 1) return 0;
+
+  GLint viewport[4], max_size;
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  int width = viewport[2];
+  int slot_height = row_cache_slot_height();
+  if (slots > max_size / slot_height) slots = max_size / slot_height;
+  if (width > max_size || slots < 1) return 0;
+  if (width == row_cache_width && slot_height == row_cache_slot_px && slots <= row_cache_slots) return row_cache_slots;
+
+  if (!row_cache_fbo) {
+    glGenFramebuffers(1, &row_cache_fbo);
+    glGenTextures(1, &row_cache_texture);
+    glGenVertexArrays(1, &row_cache_vao);
+    glGenBuffers(1, &row_cache_vbo);
+    glBindVertexArray(row_cache_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, row_cache_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+  }
+
+  // Slots are composited 1:1, so sampling never needs to filter
+  glBindTexture(GL_TEXTURE_2D, row_cache_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, slots * slot_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, row_cache_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, row_cache_texture, 0);
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  bind_target();
+
+  row_cache_width = complete ? width : 0;
+  row_cache_slots = complete ? slots : 0;
+  row_cache_slot_px = slot_height;
+  return row_cache_slots;
+}
+
+void window_row_cache_begin(void) {
+  glGetIntegerv(GL_VIEWPORT, row_cache_saved_viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, row_cache_fbo);
+  set_projection(text_shader_program, row_cache_width, row_cache_slot_height());
+  glEnable(GL_SCISSOR_TEST);
+
+  // Slots hold premultiplied colour, so compositing one matches drawing its glyphs directly
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+float window_row_cache_select(int slot) {
+  int slot_height = row_cache_slot_height();
+  glViewport(0, slot * slot_height, row_cache_width, slot_height);
+  glScissor(0, slot * slot_height, row_cache_width, slot_height);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  return (float)row_cache_ascent();
+}
+
+void window_row_cache_end(void) {
+  GLint* v = row_cache_saved_viewport;
+  glDisable(GL_SCISSOR_TEST);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  bind_target();
+  glViewport(v[0], v[1], v[2], v[3]);
+  set_projection(text_shader_program, v[2], v[3]);
+}
+
+void window_row_cache_draw(int slot, float baseline_y, float width) {
+  if (row_cache_queued == row_cache_queue_cap) {
+    int cap = row_cache_queue_cap ? row_cache_queue_cap * 2 : 64;
+    float* grown = realloc(row_cache_quads, sizeof(float) * 24 * cap);
+    if (!grown) return;
+    row_cache_quads = grown;
+    row_cache_queue_cap = cap;
+  }
+
+  // Whole pixels keep the texels 1:1, the baseline moves by at most half a pixel
+  int slot_height = row_cache_slot_height();
+  float w = (int)width < row_cache_width ? (int)width : row_cache_width, h = slot_height;
+  float x = 0.0f, y = (float)((int)(baseline_y + 0.5f) - row_cache_ascent());
+  float texture_height = (float)row_cache_slots * slot_height;
+  float top = (slot + 1) * slot_height / texture_height, bottom = slot * slot_height / texture_height;
+  float right = w / row_cache_width;
+  float quad[6][4] = {
+      {x, y + h, 0.0f, bottom}, {x, y, 0.0f, top},      {x + w, y, right, top},
+      {x, y + h, 0.0f, bottom}, {x + w, y, right, top}, {x + w, y + h, right, bottom},
+  };
+  memcpy(row_cache_quads + 24 * row_cache_queued++, quad, sizeof(quad));
+}
+
+void window_row_cache_flush(void) {
+  if (!row_cache_queued) return;
+
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glUseProgram(image_shader_program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, row_cache_texture);
+  glBindVertexArray(row_cache_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, row_cache_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 24 * row_cache_queued, row_cache_quads, GL_STREAM_DRAW);
+  glDrawArrays(GL_TRIANGLES, 0, 6 * row_cache_queued);
+  draw_calls++;
+  row_cache_queued = 0;
+
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
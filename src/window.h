@@ -2,21 +2,82 @@
 #define WINDOW_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct GLFWwindow GLFWwindow;
 
+typedef enum {
+  RENDER_GL,         // OpenGL draw calls
+  RENDER_SOFTWARE,   // CPU framebuffer presented as one texture
+  RENDER_OFFSCREEN,  // CPU framebuffer without a display, see window_save_frame()
+  RENDER_HEADLESS,   // OpenGL draw calls into a framebuffer object, no display needed
+} RenderBackend;
+
+void window_set_backend(RenderBackend backend);  // before window_init()
+bool window_preload_font(void);  // FreeType and the glyph atlas only, window_init() does it otherwise
+void window_add_font(const char* path);  // before window_init(), tried in order ahead of the platform's fonts
+// Signed distance field atlas: rasterized once, sharp at any text scale. Set
+// before window_preload_font()/window_init().
+void window_set_sdf_atlas(bool enable);
+void window_set_text_scale(float scale);  // glyph size relative to the 14px font
+float window_get_content_scale(void);     // the monitor's DPI scale, 1 without a display
+
 bool window_init(const char* title, int width, int height);
 bool window_should_close(void);
+
+typedef enum {
+  WINDOW_FOCUSED,
+  WINDOW_UNFOCUSED,  // visible, but input goes elsewhere
+  WINDOW_HIDDEN,     // minimized or hidden, nothing drawn can be seen
+} WindowVisibility;
+
+WindowVisibility window_visibility(void);
 void window_poll(void);
 void window_clear(float r, float g, float b);
 void window_swap(void);
+bool window_save_frame(const char* path);
+void window_set_vsync(bool enable);
+bool window_resize(int width, int height);  // RENDER_HEADLESS only
+void window_gpu_timer_begin(void);
+double window_gpu_timer_end(void);  // GPU milliseconds since begin, waits for the result
 void window_shutdown(void);
 void window_draw_text(float x, float y, const char* text);
 void window_get_size(int* window_width, int* window_height);
 void window_set_text_color(float r, float g, float b);
 void window_draw_rect(float x, float y, float w, float h, float r, float g, float b);
 void set_pty_fd(int fd);
+
+// RGBA image. The GL backends sample a texture, the software ones read the
+// pixels in place; serial changes whenever the pixels do.
+typedef struct {
+  uint32_t texture;  // from window_image_upload()
+  const uint8_t* rgba;
+  int width, height;
+  uint32_t serial;
+} WindowImage;
+
+uint32_t window_image_upload(const uint8_t* rgba, int width, int height);  // 0 on the software backends
+void window_image_free(uint32_t texture);
+void window_draw_image(const WindowImage* image, int src_x, int src_y, int src_w, int src_h, float x, float y, float w,
+                       float h);
+// Rows of glyphs cached in one texture (GL backends only). Each slot holds a
+// row drawn around a fixed baseline and is composited wherever the row sits
+// now. reserve() returns how many slots there are, 0 when there is no cache;
+// they keep their contents until the framebuffer width or slot count changes.
+int window_row_cache_reserve(int slots);
+void window_row_cache_begin(void);
+float window_row_cache_select(int slot);  // clears the slot, returns the baseline to draw its text at
+void window_row_cache_end(void);
+void window_row_cache_draw(int slot, float baseline_y, float width);  // the slot's left width pixels, queued until flush
+void window_row_cache_flush(void);
 GLFWwindow* window_get_glfw_window(void);
-void set_copy_handler(void (*handler)(GLFWwindow*));
+int window_take_draw_calls(void);
+void window_get_atlas_usage(int* glyphs, int* used_px, int* total_px);
+void window_set_link_cursor(bool link);
+void set_copy_handler(bool (*handler)(GLFWwindow*));  // false when there was nothing to copy
+void set_paste_handler(void (*handler)(GLFWwindow*));
+void set_hud_handler(void (*handler)(void));
+void set_zoom_handler(void (*handler)(int step));  // +1 in, -1 out, 0 back to 100%
+void set_mark_handler(void (*handler)(int step));  // -1/+1 previous/next prompt, 0 copies a command's output
 
 #endif
@@ -0,0 +1,171 @@
+#include "writequeue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ptyio.h"
+
+#define WQ_BLOCK_SIZE 16384
+#define WQ_MAX_IOV 64
+#define WQ_MAX_FREE 8  // drained blocks kept around for reuse
+
+typedef struct WqBlock {
+  struct WqBlock* next;
+  size_t head, tail;  // unsent bytes are data[head, tail)
+  char data[WQ_BLOCK_SIZE];
+} WqBlock;
+
+static int wq_fd = -1;
+static WqBlock* wq_first = NULL;
+static WqBlock* wq_last = NULL;
+static WqBlock* wq_free = NULL;
+static int wq_nfree = 0;
+static size_t wq_bytes = 0;
+static struct iovec wq_iov[WQ_MAX_IOV];  // the batch io_uring is writing
+static bool wq_in_flight = false;
+
+void writequeue_init(int fd) {
+  wq_fd = fd;
+  int flags = fcntl(fd, F_GETFL);
+  if (flags != -1) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static WqBlock* block_get(void) {
+  WqBlock* b = wq_free;
+  if (b) {
+    wq_free = b->next;
+    wq_nfree--;
+  } else {
+    b = malloc(sizeof(*b));
+    if (!b) return NULL;
+  }
+  b->next = NULL;
+  b->head = b->tail = 0;
+  return b;
+}
+
+static void block_put(WqBlock* b) {
+  if (wq_nfree >= WQ_MAX_FREE) {
+    free(b);
+    return;
+  }
+  b->next = wq_free;
+  wq_free = b;
+  wq_nfree++;
+}
+
+// Appends to the tail block first, so consecutive keystrokes share one iovec.
+// Without a PTY (replays, benchmarks) there is no one to send to.
+void writequeue_push(const char* data, size_t len) {
+  if (wq_fd < 0) return;
+  while (len > 0) {
+    if (!wq_last || wq_last->tail == WQ_BLOCK_SIZE) {
+      WqBlock* b = block_get();
+      if (!b) return;
+      if (wq_last) {
+        wq_last->next = b;
+      } else {
+        wq_first = b;
+      }
+      wq_last = b;
+    }
+
+    size_t n = WQ_BLOCK_SIZE - wq_last->tail;
+    if (n > len) n = len;
+    memcpy(wq_last->data + wq_last->tail, data, n);
+    wq_last->tail += n;
+    wq_bytes += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static void discard_all(void) {
+  while (wq_first) {
+    WqBlock* next = wq_first->next;
+    block_put(wq_first);
+    wq_first = next;
+  }
+  wq_last = NULL;
+  wq_bytes = 0;
+}
+
+// Drops n written bytes from the front of the queue
+static void consume(size_t n) {
+  wq_bytes -= n;
+  while (n > 0) {
+    size_t avail = wq_first->tail - wq_first->head;
+    if (n < avail) {
+      wq_first->head += n;
+      break;
+    }
+    n -= avail;
+    WqBlock* next = wq_first->next;
+    block_put(wq_first);
+    wq_first = next;
+    if (!wq_first) wq_last = NULL;
+  }
+}
+
+static int gather(struct iovec* iov, size_t* batch) {
+  int niov = 0;
+  *batch = 0;
+  for (WqBlock* b = wq_first; b && niov < WQ_MAX_IOV; b = b->next) {
+    iov[niov].iov_base = b->data + b->head;
+    iov[niov].iov_len = b->tail - b->head;
+    *batch += iov[niov].iov_len;
+    niov++;
+  }
+  return niov;
+}
+
+// Blocks stay queued while the ring writes them, pushes only append past the batch
+static void ring_written(ssize_t n) {
+  wq_in_flight = false;
+  if (n >= 0) {
+    consume(n);
+  } else if (n != -EINTR && n != -EAGAIN) {
+    discard_all();
+  }
+}
+
+// Writes as much as the PTY accepts without blocking. Returns false on a
+// write error other than EAGAIN, after discarding the queue. With io_uring
+// one batch at a time is handed to the ring and the result comes later.
+bool writequeue_flush(void) {
+  if (ptyio_uring_active()) {
+    if (wq_first && !wq_in_flight) {
+      size_t batch;
+      int niov = gather(wq_iov, &batch);
+      wq_in_flight = ptyio_writev(wq_iov, niov, ring_written);
+    }
+    return true;
+  }
+
+  while (wq_first && wq_fd >= 0) {
+    struct iovec iov[WQ_MAX_IOV];
+    size_t batch;
+    int niov = gather(iov, &batch);
+
+    ssize_t n = writev(wq_fd, iov, niov);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+      discard_all();
+      return false;
+    }
+    consume(n);
+
+    // Short write: the PTY is full, wait for POLLOUT
+    if ((size_t)n < batch) return true;
+  }
+  return true;
+}
+
+bool writequeue_pending(void) { return wq_bytes > 0; }
+
+size_t writequeue_size(void) { return wq_bytes; }
@@ -0,0 +1,16 @@
+#ifndef WRITEQUEUE_H
+#define WRITEQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Outbound queue for the PTY master. Input is buffered and written with
+// writev() in batches; the fd is non-blocking so a slow reader only makes
+// the queue grow, it never stalls the UI thread.
+void writequeue_init(int fd);
+void writequeue_push(const char* data, size_t len);
+bool writequeue_flush(void);
+bool writequeue_pending(void);
+size_t writequeue_size(void);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Checks that utf8_decode_run() and utf8_decode_run_scalar() agree: same
+ * codepoints, same count, same bytes consumed. Inputs are valid sequences of
+ * every length, overlongs, surrogates, out of range and truncated sequences,
+ * each placed at every offset around the 16-byte vector window (so they
+ * straddle it at 14, 15 and 16), cut off at every length, decoded with
+ * several output capacities, plus random mixes of all of them.
+ *
+ * Usage: check_utf8 (run by make check), exits 1 on the first mismatch
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utf8.h"
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+#define MAX_INPUT 512
+#define FUZZ_ROUNDS 200000
+
+typedef struct {
+  const char* name;
+  const char* bytes;
+} Sample;
+
+static const Sample samples[] = {
+    {"2-byte", "\xC3\xA9"},
+    {"3-byte", "\xE2\x82\xAC"},
+    {"3-byte after surrogates", "\xEE\x80\x80"},
+    {"4-byte", "\xF0\x9F\x98\x80"},
+    {"4-byte lowest", "\xF0\x90\x80\x80"},
+    {"4-byte highest", "\xF4\x8F\xBF\xBF"},
+    {"overlong 2-byte C0", "\xC0\xAF"},
+    {"overlong 2-byte C1", "\xC1\xBF"},
+    {"overlong 3-byte", "\xE0\x80\xAF"},
+    {"overlong 3-byte highest", "\xE0\x9F\xBF"},
+    {"overlong 4-byte", "\xF0\x80\x80\xAF"},
+    {"overlong 4-byte highest", "\xF0\x8F\xBF\xBF"},
+    {"surrogate lowest", "\xED\xA0\x80"},
+    {"surrogate highest", "\xED\xBF\xBF"},
+    {"above U+10FFFF", "\xF4\x90\x80\x80"},
+    {"lead F5", "\xF5\x80\x80\x80"},
+    {"lead FF", "\xFF"},
+    {"lone continuation", "\x80"},
+    {"continuations", "\x80\xBF\x80"},
+    {"truncated 2-byte", "\xC3" "a"},
+    {"truncated 3-byte", "\xE2\x82" "a"},
+    {"truncated 4-byte", "\xF0\x9F\x98" "a"},
+    {"truncated 4-byte early", "\xF0\x9F" "a"},
+    {"lead before control", "\xE2\n"},
+    {"lead before lead", "\xE2\xE2\x82\xAC"},
+    {"C1 control", "\xC2\x85"},
+};
+
+static const char* fillers[] = {"a", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\t"};
+
+static const size_t caps[] = {16, 17, 31, 256};
+
+static unsigned long comparisons = 0;
+
+static void dump(const char* label, const char* s, size_t len) {
+  fprintf(stderr, "  %s:", label);
+  for (size_t i = 0; i < len; i++) fprintf(stderr, " %02X", (unsigned char)s[i]);
+  fprintf(stderr, "\n");
+}
+
+// Decodes src a run at a time as parse_input() does, stepping over the
+// control byte that ends a run, with both decoders. Exits on a mismatch.
+static void compare(const char* name, const char* src, size_t len, size_t cap) {
+  size_t i = 0;
+  while (i < len) {
+    uint32_t vec[256], ref[256];
+    size_t vec_used, ref_used;
+    size_t vec_n = utf8_decode_run(src + i, len - i, vec, cap, &vec_used);
+    size_t ref_n = utf8_decode_run_scalar(src + i, len - i, ref, cap, &ref_used);
+    comparisons++;
+
+    if (vec_n != ref_n || vec_used != ref_used || memcmp(vec, ref, vec_n * sizeof(*vec)) != 0) {
+      fprintf(stderr, "%s: decoders disagree at byte %zu of %zu, capacity %zu\n", name, i, len, cap);
+      fprintf(stderr, "  vector %zu codepoints from %zu bytes, scalar %zu from %zu\n", vec_n, vec_used, ref_n,
+              ref_used);
+      for (size_t k = 0; k < vec_n && k < ref_n; k++) {
+        if (vec[k] != ref[k]) {
+          fprintf(stderr, "  codepoint %zu: vector U+%04X, scalar U+%04X\n", k, vec[k], ref[k]);
+          break;
+        }
+      }
+      dump("input", src + i, len - i < 32 ? len - i : 32);
+      exit(1);
+    }
+
+    if (ref_used == 0) {
+      if ((unsigned char)src[i] >= 0x20 && src[i] != 0x7F) return;  // cut off by the end of input
+      ref_used = 1;
+    }
+    i += ref_used;
+  }
+}
+
+// Every cut of src, with every capacity
+static void compare_cuts(const char* name, const char* src, size_t len) {
+  for (size_t cut = 1; cut <= len; cut++) {
+    for (size_t c = 0; c < COUNT(caps); c++) compare(name, src, cut, caps[c]);
+  }
+}
+
+static size_t append(char* dst, size_t at, const char* s) {
+  size_t n = strlen(s);
+  if (at + n > MAX_INPUT) return at;
+  memcpy(dst + at, s, n);
+  return at + n;
+}
+
+// Each sample after 0..20 filler characters, then followed by more filler
+// and by itself, so it lands on every position of the first window and the
+// next one
+static void check_samples(void) {
+  char input[MAX_INPUT];
+  for (size_t s = 0; s < COUNT(samples); s++) {
+    for (size_t f = 0; f < COUNT(fillers); f++) {
+      for (int pad = 0; pad <= 20; pad++) {
+        size_t len = 0;
+        for (int k = 0; k < pad; k++) len = append(input, len, "a");
+        len = append(input, len, samples[s].bytes);
+        for (int k = 0; k < 8; k++) len = append(input, len, fillers[f]);
+        len = append(input, len, samples[s].bytes);
+        for (int k = 0; k < 12; k++) len = append(input, len, "b");
+        compare_cuts(samples[s].name, input, len);
+      }
+    }
+  }
+}
+
+// Small deterministic generator, the same inputs on every run
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// Random mixes of samples, fillers and raw bytes
+static void check_random(void) {
+  char input[MAX_INPUT];
+  for (int round = 0; round < FUZZ_ROUNDS; round++) {
+    size_t len = 0, target = 1 + rng() % 96;
+    while (len < target) {
+      uint32_t pick = rng() % 8;
+      if (pick < 3) {
+        len = append(input, len, samples[rng() % COUNT(samples)].bytes);
+      } else if (pick < 7) {
+        len = append(input, len, fillers[rng() % COUNT(fillers)]);
+      } else {
+        input[len++] = (char)(rng() & 0xFF);
+      }
+    }
+    compare("random", input, len, caps[rng() % COUNT(caps)]);
+  }
+}
+
+int main(void) {
+  check_samples();
+  check_random();
+  printf("utf8: %lu runs decoded, vector and scalar decoders agree\n", comparisons);
+  return 0;
+}